@@ -0,0 +1,302 @@
+/**
+ * @file code39.h
+ * @brief Header file for the Code 39 symbol lookup table.
+ * @details
+ * Every Code 39 symbol is made up of 9 elements (5 black bars and 4 white spaces),
+ * exactly 3 of which are wide. The elements are packed into a 9 bit key, with the
+ * first element read stored in the most significant bit and a 1 bit for a wide element.
+ * The key is then used to index a table holding the character of every valid symbol,
+ * so decoding a symbol is a single array read no matter which character it is.
+ *
+ * The narrow/wide decision is made per symbol from the 9 measured widths, using the rule
+ * that every symbol has exactly 3 wide elements, so the result does not depend on the scan speed.
+ *
+ * A symbol read right-to-left gives the same elements in the opposite order, which is its key with
+ * the 9 bits reversed. The '*' delimiter read backwards is the key of 'P', so the direction of a read
+ * is found from its start and stop symbols and the data symbols are then looked up with reversed keys.
+ *
+ * An optional mod 43 check character can follow the data characters. Its value is the sum of the
+ * values of the data characters modulo 43, using the order of characters in CODE39_CHARACTERS.
+ *
+ * @date November 3, 2023
+ */
+
+#ifndef CODE39_H
+#define CODE39_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Define the layout of a Code 39 symbol
+#define CODE39_ELEMENTS_PER_SYMBOL 9    // 5 bars and 4 spaces per symbol
+#define CODE39_WIDE_ELEMENTS 3          // Number of wide elements in every symbol
+#define CODE39_KEY_COUNT 512            // 2^9 possible element patterns
+#define CODE39_KEY_MASK 0x1FF           // Mask to keep a key within the table
+
+// Minimum ratio between the narrowest wide element and the widest narrow element (3/2 = 1.5)
+#define CODE39_MIN_WIDE_RATIO_NUM 3
+#define CODE39_MIN_WIDE_RATIO_DEN 2
+#define CODE39_MAX_CONFIDENCE 100       // Confidence of a symbol with a wide to narrow ratio of 3 or more
+
+// Define the special symbols
+#define CODE39_INVALID '\0'             // Returned for patterns that are not a Code 39 symbol
+#define CODE39_START_STOP '*'           // Start and stop delimiter character
+#define CODE39_KEY_START_STOP 0x094     // Key of the '*' delimiter read left-to-right
+#define CODE39_KEY_START_STOP_REVERSED 0x052 // Key of the '*' delimiter read right-to-left
+
+// Data characters in the order of their mod 43 check values (0 to 42)
+#define CODE39_CHARACTERS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%"
+#define CODE39_CHECK_MODULUS 43
+
+// Function prototypes
+uint16_t code39_pack_key(const bool wide[CODE39_ELEMENTS_PER_SYMBOL]);
+bool code39_classify_widths(const uint32_t widths[CODE39_ELEMENTS_PER_SYMBOL], bool wide[CODE39_ELEMENTS_PER_SYMBOL], uint8_t *confidence);
+char code39_lookup(uint16_t key);
+uint16_t code39_reverse_key(uint16_t key);
+char code39_lookup_direction(uint16_t key, bool is_reversed);
+int code39_value(char character);
+bool code39_verify_check_character(const char *message, int length);
+
+/**
+ * @brief Code 39 lookup table indexed by the packed element key.
+ *
+ * @details
+ * The comment next to each entry is the element pattern from the first bar to the last bar,
+ * 1 for wide and 0 for narrow. Every entry that is not listed is zero (CODE39_INVALID).
+ */
+static const char code39_table[CODE39_KEY_COUNT] = {
+    [0x034] = '0', // 000110100
+    [0x121] = '1', // 100100001
+    [0x061] = '2', // 001100001
+    [0x160] = '3', // 101100000
+    [0x031] = '4', // 000110001
+    [0x130] = '5', // 100110000
+    [0x070] = '6', // 001110000
+    [0x025] = '7', // 000100101
+    [0x124] = '8', // 100100100
+    [0x064] = '9', // 001100100
+    [0x109] = 'A', // 100001001
+    [0x049] = 'B', // 001001001
+    [0x148] = 'C', // 101001000
+    [0x019] = 'D', // 000011001
+    [0x118] = 'E', // 100011000
+    [0x058] = 'F', // 001011000
+    [0x00D] = 'G', // 000001101
+    [0x10C] = 'H', // 100001100
+    [0x04C] = 'I', // 001001100
+    [0x01C] = 'J', // 000011100
+    [0x103] = 'K', // 100000011
+    [0x043] = 'L', // 001000011
+    [0x142] = 'M', // 101000010
+    [0x013] = 'N', // 000010011
+    [0x112] = 'O', // 100010010
+    [0x052] = 'P', // 001010010
+    [0x007] = 'Q', // 000000111
+    [0x106] = 'R', // 100000110
+    [0x046] = 'S', // 001000110
+    [0x016] = 'T', // 000010110
+    [0x181] = 'U', // 110000001
+    [0x0C1] = 'V', // 011000001
+    [0x1C0] = 'W', // 111000000
+    [0x091] = 'X', // 010010001
+    [0x190] = 'Y', // 110010000
+    [0x0D0] = 'Z', // 011010000
+    [0x085] = '-', // 010000101
+    [0x184] = '.', // 110000100
+    [0x0C4] = ' ', // 011000100
+    [0x0A8] = '$', // 010101000
+    [0x0A2] = '/', // 010100010
+    [0x08A] = '+', // 010001010
+    [0x02A] = '%', // 000101010
+    [0x094] = '*', // 010010100
+};
+
+/**
+ * @brief Pack the narrow/wide classification of 9 elements into a Code 39 key.
+ *
+ * @param wide Array of 9 flags in the order the elements were read, true for a wide element.
+ * @return The 9 bit key of the symbol.
+ */
+uint16_t code39_pack_key(const bool wide[CODE39_ELEMENTS_PER_SYMBOL])
+{
+    uint16_t key = 0;
+
+    // Shift in each element so that the first element read ends up in the most significant bit
+    for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+    {
+        key = (key << 1) | (wide[i] ? 1 : 0);
+    }
+
+    return key;
+}
+
+/**
+ * @brief Split the 9 element widths of a symbol into narrow and wide elements.
+ *
+ * @details
+ * 1) The 3 widest elements are marked as wide and the other 6 as narrow.
+ * 2) The narrowest wide element must be at least CODE39_MIN_WIDE_RATIO times the widest narrow element,
+ *    otherwise the widths do not form a clean 3 wide / 6 narrow split and the symbol is rejected.
+ * 3) The confidence is how far apart the two groups are around the threshold between them,
+ *    200 * (wide - narrow) / (wide + narrow), so a ratio of 1.5 gives 40 and a ratio of 3 or more gives 100.
+ *    A single noisy element moves the narrowest wide or widest narrow element towards the threshold
+ *    and lowers the confidence even when the symbol still decodes.
+ * The widths can be in any unit (microseconds, encoder ticks, ...) as only their ratios are used.
+ *
+ * @param widths Array of 9 element widths in the order they were read.
+ * @param wide Array of 9 flags that is filled in, true for a wide element.
+ * @param confidence Pointer to where the confidence (0 to CODE39_MAX_CONFIDENCE) is stored, can be NULL.
+ * @return true if the widths form a valid split, false otherwise.
+ */
+bool code39_classify_widths(const uint32_t widths[CODE39_ELEMENTS_PER_SYMBOL], bool wide[CODE39_ELEMENTS_PER_SYMBOL], uint8_t *confidence)
+{
+    // Start with every element narrow
+    for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+    {
+        wide[i] = false;
+    }
+
+    // Mark the 3 widest elements as wide, keeping track of the narrowest of them
+    uint32_t narrowest_wide = UINT32_MAX;
+    for (int n = 0; n < CODE39_WIDE_ELEMENTS; n++)
+    {
+        int widest_index = -1;
+        for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+        {
+            if (!wide[i] && (widest_index < 0 || widths[i] > widths[widest_index]))
+            {
+                widest_index = i;
+            }
+        }
+        wide[widest_index] = true;
+        narrowest_wide = widths[widest_index];
+    }
+
+    // Find the widest of the remaining narrow elements
+    uint32_t widest_narrow = 0;
+    for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+    {
+        if (!wide[i])
+        {
+            // An element with no width is a missed edge, so the symbol cannot be trusted
+            if (widths[i] == 0)
+            {
+                return false;
+            }
+            if (widths[i] > widest_narrow)
+            {
+                widest_narrow = widths[i];
+            }
+        }
+    }
+
+    // Accept the split only if the wide and narrow groups are clearly separated
+    if ((uint64_t)narrowest_wide * CODE39_MIN_WIDE_RATIO_DEN < (uint64_t)widest_narrow * CODE39_MIN_WIDE_RATIO_NUM)
+    {
+        return false;
+    }
+
+    // Score how far the two groups sit from the threshold between them
+    if (confidence != NULL)
+    {
+        uint64_t score = (uint64_t)2 * CODE39_MAX_CONFIDENCE * (narrowest_wide - widest_narrow) /
+                         ((uint64_t)narrowest_wide + widest_narrow);
+        *confidence = score > CODE39_MAX_CONFIDENCE ? CODE39_MAX_CONFIDENCE : (uint8_t)score;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Look up the character for a packed Code 39 key.
+ *
+ * @param key The 9 bit key of the symbol.
+ * @return The decoded character, or CODE39_INVALID if the key is not a Code 39 symbol.
+ */
+char code39_lookup(uint16_t key)
+{
+    return code39_table[key & CODE39_KEY_MASK];
+}
+
+/**
+ * @brief Reverse the order of the elements in a Code 39 key.
+ *
+ * @param key The 9 bit key of a symbol read in one direction.
+ * @return The 9 bit key of the same symbol read in the other direction.
+ */
+uint16_t code39_reverse_key(uint16_t key)
+{
+    uint16_t reversed_key = 0;
+
+    // Move the lowest bit of the key into the reversed key, one element at a time
+    for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+    {
+        reversed_key = (reversed_key << 1) | (key & 1);
+        key >>= 1;
+    }
+
+    return reversed_key;
+}
+
+/**
+ * @brief Look up the character for a packed Code 39 key read in either direction.
+ *
+ * @param key The 9 bit key of the symbol, in the order the elements were read.
+ * @param is_reversed true if the symbol was read right-to-left.
+ * @return The decoded character, or CODE39_INVALID if the key is not a Code 39 symbol.
+ */
+char code39_lookup_direction(uint16_t key, bool is_reversed)
+{
+    return code39_lookup(is_reversed ? code39_reverse_key(key) : key);
+}
+
+/**
+ * @brief Get the mod 43 check value of a data character.
+ *
+ * @param character The data character.
+ * @return The value of the character (0 to 42), or -1 if it is not a Code 39 data character.
+ */
+int code39_value(char character)
+{
+    for (int i = 0; i < CODE39_CHECK_MODULUS; i++)
+    {
+        if (CODE39_CHARACTERS[i] == character)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Verify the mod 43 check character at the end of a message.
+ *
+ * @param message The data characters followed by the check character.
+ * @param length Number of characters in message, including the check character.
+ * @return true if the last character matches the mod 43 sum of the others, false otherwise.
+ */
+bool code39_verify_check_character(const char *message, int length)
+{
+    // There must be at least one data character before the check character
+    if (length < 2)
+    {
+        return false;
+    }
+
+    // Add up the values of the data characters
+    int sum = 0;
+    for (int i = 0; i < length - 1; i++)
+    {
+        int value = code39_value(message[i]);
+        if (value < 0)
+        {
+            return false;
+        }
+        sum += value;
+    }
+
+    return code39_value(message[length - 1]) == sum % CODE39_CHECK_MODULUS;
+}
+
+#endif // CODE39_H
@@ -0,0 +1,127 @@
+/**
+ * @file debounce.h
+ * @brief Header file for timestamp based debouncing of GPIO edges.
+ * @details
+ * Every debounced pin keeps a small state machine that is driven by the time of each edge,
+ * so the interrupt never has to be disabled and no timer is created per edge.
+ * An edge is accepted when at least dead_time_us has passed since the last accepted edge,
+ * every other edge is a bounce and is counted and ignored.
+ *
+ * The state machine also remembers the raw level of the latest edge, accepted or not:
+ * 1) An edge to the accepted level after the dead-time normally repeats the accepted level and is ignored.
+ * 2) If the raw level had changed during the dead-time, a real transition was hidden by the dead-time,
+ *    so the edge is accepted as the end of a full pulse (an encoder tick is not lost).
+ * 3) debounce_settle() accepts a level that was left behind in the dead-time once it has run out,
+ *    so a sensor cannot get stuck on the level of a bounce.
+ *
+ * @date November 16, 2023
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Default dead-times in microseconds
+#define DEBOUNCE_ENCODER_DEAD_TIME_US 500      // Well under the time between encoder edges at full speed
+#define DEBOUNCE_LINE_SENSOR_DEAD_TIME_US 5000 // IR line sensors chatter for a few ms at a black/white boundary
+
+/**
+ * @brief Debounce state of a single GPIO pin.
+ */
+typedef struct
+{
+    uint32_t dead_time_us;      // Time after an accepted edge during which edges are bounces
+    uint32_t last_edge_time;    // Time of the last accepted edge
+    bool level;                 // Level after the last accepted edge
+    bool raw_level;             // Level after the latest edge, accepted or not
+    uint32_t accepted_edges;    // Number of edges accepted
+    uint32_t rejected_edges;    // Number of edges ignored as bounces
+} debounce_t;
+
+// Function prototypes
+void debounce_init(debounce_t *debounce, uint32_t dead_time_us, bool level, uint32_t now);
+bool debounce_edge(debounce_t *debounce, uint32_t timestamp, bool level);
+bool debounce_settle(debounce_t *debounce, uint32_t now);
+
+/**
+ * @brief Initialise the debounce state of a pin.
+ *
+ * @param debounce Pointer to the debounce state.
+ * @param dead_time_us Dead-time after an accepted edge in microseconds.
+ * @param level Current level of the pin.
+ * @param now Current time from time_us_32().
+ */
+void debounce_init(debounce_t *debounce, uint32_t dead_time_us, bool level, uint32_t now)
+{
+    debounce->dead_time_us = dead_time_us;
+    debounce->last_edge_time = now - dead_time_us; // The first edge is never inside a dead-time
+    debounce->level = level;
+    debounce->raw_level = level;
+    debounce->accepted_edges = 0;
+    debounce->rejected_edges = 0;
+}
+
+/**
+ * @brief Run an edge through the debounce state machine.
+ *
+ * @details
+ * Called from the GPIO interrupt with the time of the edge taken as early as possible.
+ *
+ * @param debounce Pointer to the debounce state of the pin.
+ * @param timestamp Time of the edge from time_us_32().
+ * @param level Level of the pin after the edge, true for a rising edge.
+ * @return true if the edge is accepted, false if it is a bounce.
+ */
+bool debounce_edge(debounce_t *debounce, uint32_t timestamp, bool level)
+{
+    bool previous_raw_level = debounce->raw_level;
+    debounce->raw_level = level;
+
+    // Inside the dead-time of the last accepted edge, so it is a bounce
+    if (timestamp - debounce->last_edge_time < debounce->dead_time_us)
+    {
+        debounce->rejected_edges++;
+        return false;
+    }
+
+    // Same level as before with no change hidden in the dead-time, so nothing happened
+    if (level == debounce->level && level == previous_raw_level)
+    {
+        debounce->rejected_edges++;
+        return false;
+    }
+
+    debounce->level = level;
+    debounce->last_edge_time = timestamp;
+    debounce->accepted_edges++;
+    return true;
+}
+
+/**
+ * @brief Accept a level change that was left behind in the dead-time.
+ *
+ * @details
+ * If the last edge of a burst lands inside the dead-time, the pin ends up on a level that was never accepted.
+ * Once the dead-time has run out with no further edge, that level is real and is accepted here.
+ * Called from thread context, the pin interrupt must not run while the state is updated.
+ *
+ * @param debounce Pointer to the debounce state of the pin.
+ * @param now Current time from time_us_32().
+ * @return true if the accepted level changed, false otherwise.
+ */
+bool debounce_settle(debounce_t *debounce, uint32_t now)
+{
+    if (debounce->raw_level == debounce->level || now - debounce->last_edge_time < debounce->dead_time_us)
+    {
+        return false;
+    }
+
+    debounce->level = debounce->raw_level;
+    debounce->last_edge_time = now;
+    debounce->accepted_edges++;
+    return true;
+}
+
+#endif // DEBOUNCE_H
@@ -0,0 +1,145 @@
+/**
+ * @file event_queue.h
+ * @brief Header file for the queue of events posted by interrupts and handled in the main loop.
+ * @details
+ * Interrupts and timer callbacks must stay short, so they never drive the motors or read the magnetometer over I2C.
+ * Instead they post a typed event with the time it happened, and dispatch_events() in main.c
+ * takes the events out in thread context and carries out the action.
+ *
+ * The queue is a single producer / single consumer ring buffer, so no lock is needed:
+ * only interrupts and timer callbacks at the default priority on core 0 post events (they cannot interrupt each other)
+ * and only the main loop takes them out. When the queue is full the new event is dropped and counted.
+ * The time from the interrupt to the start of the action is measured for every event.
+ *
+ * @date November 16, 2023
+ */
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+// Number of events that can wait for the main loop, must be a power of 2
+#define EVENT_QUEUE_SIZE 32
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+/**
+ * @brief Types of event posted by the interrupts.
+ */
+typedef enum
+{
+    EVENT_LEFT_LINE_BLACK,      // Left line sensor moved onto black
+    EVENT_LEFT_LINE_WHITE,      // Left line sensor moved onto white
+    EVENT_RIGHT_LINE_BLACK,     // Right line sensor moved onto black
+    EVENT_RIGHT_LINE_WHITE,     // Right line sensor moved onto white
+    EVENT_BOTH_LINES_BLACK,     // Both line sensors are on black
+    EVENT_CONTROL_TICK,         // Time to run the motor PID controller
+} event_type_t;
+
+/**
+ * @brief A single event waiting in the queue.
+ */
+typedef struct
+{
+    event_type_t type;  // What happened
+    uint32_t timestamp; // Time it happened from time_us_32()
+} event_t;
+
+// Single producer (interrupts) / single consumer (main loop) ring buffer of events
+event_t event_queue[EVENT_QUEUE_SIZE];
+volatile uint32_t event_queue_head = 0;         // Number of events posted, only changed by interrupts
+volatile uint32_t event_queue_tail = 0;         // Number of events taken out, only changed by the main loop
+volatile uint32_t event_queue_overruns = 0;     // Number of events dropped because the queue was full
+
+// Time from an event happening to its action starting
+uint32_t event_latency_last_us = 0;             // Latency of the latest event
+uint32_t event_latency_max_us = 0;              // Longest latency seen so far
+uint64_t event_latency_total_us = 0;            // Sum of all latencies, for the average
+uint32_t events_dispatched = 0;                 // Number of events taken out of the queue
+
+// Function prototypes
+bool post_event(event_type_t type, uint32_t timestamp);
+bool pop_event(event_t *event);
+void retrieve_event_queue_statistics();
+
+/**
+ * @brief Post an event to the queue.
+ *
+ * @details
+ * Only called from interrupts at the default priority, or from thread context with interrupts disabled.
+ * The entry is written before the head is advanced, so the main loop never sees a half written event.
+ *
+ * @param type The type of event.
+ * @param timestamp Time the event happened from time_us_32().
+ * @return true if the event was queued, false if the queue was full.
+ */
+bool post_event(event_type_t type, uint32_t timestamp)
+{
+    uint32_t head = event_queue_head;
+
+    // Drop the event if the main loop has not caught up yet
+    if (head - event_queue_tail >= EVENT_QUEUE_SIZE)
+    {
+        event_queue_overruns++;
+        return false;
+    }
+
+    // Store the event, then publish it by advancing the head
+    event_queue[head & EVENT_QUEUE_MASK].type = type;
+    event_queue[head & EVENT_QUEUE_MASK].timestamp = timestamp;
+    __dmb();
+    event_queue_head = head + 1;
+
+    return true;
+}
+
+/**
+ * @brief Take the oldest event out of the queue and record its latency.
+ *
+ * @details
+ * Only called from thread context. The entry is copied out before the tail is advanced,
+ * so an interrupt cannot overwrite it while it is being read.
+ *
+ * @param event Pointer to where the event is copied.
+ * @return true if an event was read, false if the queue was empty.
+ */
+bool pop_event(event_t *event)
+{
+    uint32_t tail = event_queue_tail;
+
+    // Nothing to read when no interrupt has posted anything new
+    if (tail == event_queue_head)
+    {
+        return false;
+    }
+
+    // Copy the event, then release the slot by advancing the tail
+    __dmb();
+    *event = event_queue[tail & EVENT_QUEUE_MASK];
+    __dmb();
+    event_queue_tail = tail + 1;
+
+    // Measure how long the event waited
+    event_latency_last_us = time_us_32() - event->timestamp;
+    if (event_latency_last_us > event_latency_max_us)
+    {
+        event_latency_max_us = event_latency_last_us;
+    }
+    event_latency_total_us += event_latency_last_us;
+    events_dispatched++;
+
+    return true;
+}
+
+/**
+ * @brief Function to print the event queue statistics.
+ */
+void retrieve_event_queue_statistics()
+{
+    printf("Events: %u dispatched, %u overruns\n", events_dispatched, event_queue_overruns);
+    printf("Event latency: last %u us, max %u us, average %u us\n", event_latency_last_us, event_latency_max_us,
+           events_dispatched > 0 ? (uint32_t)(event_latency_total_us / events_dispatched) : 0);
+}
+
+#endif // EVENT_QUEUE_H
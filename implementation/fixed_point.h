@@ -0,0 +1,466 @@
+/**
+ * @file fixed_point.h
+ * @brief Header file for Q16.16 fixed-point arithmetic.
+ * @details
+ * The Cortex-M0+ of the RP2040 has no FPU, so every float operation is a library call.
+ * The controllers, the odometry and the heading use this Q16.16 format instead: a signed 32 bit
+ * integer holding the value times 65536, so from -32768 to 32767.99998 with a resolution of 1/65536.
+ *
+ * Every operation saturates at Q16_MAX and Q16_MIN instead of wrapping around, so an overflow in a
+ * controller drives the output to its limit instead of flipping its sign. Products and quotients
+ * are worked out in 64 bits and rounded to the nearest step.
+ * Angles are in radians for the trigonometry, q16_to_degrees() and q16_to_radians() convert them.
+ *
+ * @date November 22, 2023
+ */
+
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief A Q16.16 fixed-point number.
+ */
+typedef int32_t q16_t;
+
+// Define the format
+#define Q16_FRACTION_BITS 16
+#define Q16_ONE ((q16_t)1 << Q16_FRACTION_BITS)
+#define Q16_MAX ((q16_t)INT32_MAX)
+#define Q16_MIN ((q16_t)INT32_MIN)
+
+// Convert a constant to Q16.16 at compile time, rounded to the nearest step
+#define Q16(x) ((q16_t)((x) * 65536.0 + ((x) >= 0 ? 0.5 : -0.5)))
+
+// Series of the sine are worked out with 29 fraction bits, so the rounding of the terms stays below a step
+#define Q16_SERIES_FRACTION_BITS 29
+#define Q16_SERIES(x) ((int32_t)((x) * 536870912.0 + ((x) >= 0 ? 0.5 : -0.5)))
+
+// Define the constants of the trigonometry
+#define Q16_PI Q16(3.14159265358979)
+#define Q16_HALF_PI Q16(1.57079632679490)
+#define Q16_TWO_PI Q16(6.28318530717959)
+#define Q16_DEGREES_PER_RADIAN Q16(57.2957795130823)
+#define Q16_RADIANS_PER_DEGREE Q16(0.0174532925199433)
+
+// Function prototypes
+q16_t q16_saturate(int64_t value);
+q16_t q16_from_int(int32_t value);
+q16_t q16_from_float(float value);
+q16_t q16_from_us(uint32_t microseconds);
+int32_t q16_to_int(q16_t value);
+float q16_to_float(q16_t value);
+q16_t q16_add(q16_t a, q16_t b);
+q16_t q16_sub(q16_t a, q16_t b);
+q16_t q16_mul(q16_t a, q16_t b);
+q16_t q16_div(q16_t a, q16_t b);
+q16_t q16_abs(q16_t value);
+q16_t q16_clamp(q16_t value, q16_t min, q16_t max);
+q16_t q16_min(q16_t a, q16_t b);
+q16_t q16_max(q16_t a, q16_t b);
+q16_t q16_sqrt(q16_t value);
+q16_t q16_wrap(q16_t value, q16_t half_range);
+q16_t q16_sin(q16_t angle);
+q16_t q16_cos(q16_t angle);
+q16_t q16_atan2(q16_t y, q16_t x);
+q16_t q16_to_degrees(q16_t radians);
+q16_t q16_to_radians(q16_t degrees);
+
+/**
+ * @brief Limit a wide result to the Q16.16 range.
+ *
+ * @param value The result in 64 bits.
+ * @return The result, or Q16_MAX / Q16_MIN if it does not fit.
+ */
+q16_t q16_saturate(int64_t value)
+{
+    if (value > Q16_MAX)
+    {
+        return Q16_MAX;
+    }
+    if (value < Q16_MIN)
+    {
+        return Q16_MIN;
+    }
+
+    return (q16_t)value;
+}
+
+/**
+ * @brief Convert an integer to Q16.16.
+ *
+ * @param value The integer.
+ * @return The value in Q16.16, saturated.
+ */
+q16_t q16_from_int(int32_t value)
+{
+    return q16_saturate((int64_t)value << Q16_FRACTION_BITS);
+}
+
+/**
+ * @brief Convert a float to Q16.16, for values that are not known at compile time such as commands.
+ *
+ * @param value The float.
+ * @return The value in Q16.16, rounded and saturated.
+ */
+q16_t q16_from_float(float value)
+{
+    float scaled = value * 65536.0f;
+
+    if (scaled >= 2147483647.0f)
+    {
+        return Q16_MAX;
+    }
+    if (scaled <= -2147483648.0f)
+    {
+        return Q16_MIN;
+    }
+
+    return (q16_t)(scaled + (scaled >= 0 ? 0.5f : -0.5f));
+}
+
+/**
+ * @brief Convert a time in microseconds to seconds in Q16.16.
+ *
+ * @details
+ * Multiplies by 2^16 / 10^6 held in 32 fraction bits, so no division is needed.
+ *
+ * @param microseconds The time in microseconds.
+ * @return The time in seconds.
+ */
+q16_t q16_from_us(uint32_t microseconds)
+{
+    return q16_saturate(((uint64_t)microseconds * 281474977u + (1u << 31)) >> 32);
+}
+
+/**
+ * @brief Convert a Q16.16 value to the nearest integer.
+ *
+ * @param value The value in Q16.16.
+ * @return The nearest integer.
+ */
+int32_t q16_to_int(q16_t value)
+{
+    return (int32_t)(((int64_t)value + (Q16_ONE / 2)) >> Q16_FRACTION_BITS);
+}
+
+/**
+ * @brief Convert a Q16.16 value to float, for printing.
+ *
+ * @param value The value in Q16.16.
+ * @return The value as a float.
+ */
+float q16_to_float(q16_t value)
+{
+    return value / 65536.0f;
+}
+
+/**
+ * @brief Add two values.
+ *
+ * @param a The first value.
+ * @param b The second value.
+ * @return a + b, saturated.
+ */
+q16_t q16_add(q16_t a, q16_t b)
+{
+    return q16_saturate((int64_t)a + b);
+}
+
+/**
+ * @brief Subtract two values.
+ *
+ * @param a The first value.
+ * @param b The value to take away.
+ * @return a - b, saturated.
+ */
+q16_t q16_sub(q16_t a, q16_t b)
+{
+    return q16_saturate((int64_t)a - b);
+}
+
+/**
+ * @brief Multiply two values.
+ *
+ * @param a The first value.
+ * @param b The second value.
+ * @return a * b, rounded and saturated.
+ */
+q16_t q16_mul(q16_t a, q16_t b)
+{
+    int64_t product = (int64_t)a * b;
+
+    return q16_saturate((product + (1 << (Q16_FRACTION_BITS - 1))) >> Q16_FRACTION_BITS);
+}
+
+/**
+ * @brief Divide two values.
+ *
+ * @param a The dividend.
+ * @param b The divisor.
+ * @return a / b, rounded and saturated. Dividing by zero saturates towards the sign of a.
+ */
+q16_t q16_div(q16_t a, q16_t b)
+{
+    if (b == 0)
+    {
+        return a >= 0 ? Q16_MAX : Q16_MIN;
+    }
+
+    int64_t dividend = (int64_t)a << Q16_FRACTION_BITS;
+
+    // Round half away from zero, the division truncates towards zero so move the dividend away from it
+    if (dividend >= 0)
+    {
+        dividend += (b > 0 ? b : -(int64_t)b) / 2;
+    }
+    else
+    {
+        dividend -= (b > 0 ? b : -(int64_t)b) / 2;
+    }
+
+    return q16_saturate(dividend / b);
+}
+
+/**
+ * @brief Get the absolute value.
+ *
+ * @param value The value.
+ * @return |value|, saturated.
+ */
+q16_t q16_abs(q16_t value)
+{
+    return value < 0 ? q16_saturate(-(int64_t)value) : value;
+}
+
+/**
+ * @brief Keep a value within a range.
+ *
+ * @param value The value.
+ * @param min The lowest value allowed.
+ * @param max The highest value allowed.
+ * @return The value clamped to min to max.
+ */
+q16_t q16_clamp(q16_t value, q16_t min, q16_t max)
+{
+    if (value < min)
+    {
+        return min;
+    }
+    if (value > max)
+    {
+        return max;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Get the smaller of two values.
+ *
+ * @param a The first value.
+ * @param b The second value.
+ * @return The smaller value.
+ */
+q16_t q16_min(q16_t a, q16_t b)
+{
+    return a < b ? a : b;
+}
+
+/**
+ * @brief Get the larger of two values.
+ *
+ * @param a The first value.
+ * @param b The second value.
+ * @return The larger value.
+ */
+q16_t q16_max(q16_t a, q16_t b)
+{
+    return a > b ? a : b;
+}
+
+/**
+ * @brief Get the square root.
+ *
+ * @details
+ * The root of the value times 2^16 is the root in Q16.16, worked out bit by bit
+ * with shifts and additions only.
+ *
+ * @param value The value, negative values give 0.
+ * @return The square root, rounded down to a step.
+ */
+q16_t q16_sqrt(q16_t value)
+{
+    if (value <= 0)
+    {
+        return 0;
+    }
+
+    uint64_t remainder = (uint64_t)value << Q16_FRACTION_BITS;
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    // Start from the highest power of 4 within the value
+    while (bit > remainder)
+    {
+        bit >>= 2;
+    }
+
+    while (bit != 0)
+    {
+        if (remainder >= root + bit)
+        {
+            remainder -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (q16_t)root;
+}
+
+/**
+ * @brief Wrap a periodic value such as an angle into -half_range to half_range.
+ *
+ * @param value The value.
+ * @param half_range Half of the period, Q16_PI for radians or Q16(180) for degrees.
+ * @return The same value within -half_range (included) to half_range (excluded).
+ */
+q16_t q16_wrap(q16_t value, q16_t half_range)
+{
+    int64_t range = 2 * (int64_t)half_range;
+    int64_t wrapped = ((int64_t)value + half_range) % range;
+
+    if (wrapped < 0)
+    {
+        wrapped += range;
+    }
+
+    return (q16_t)(wrapped - half_range);
+}
+
+/**
+ * @brief Get the sine of an angle.
+ *
+ * @details
+ * The angle is folded into -pi/2 to pi/2, where the Taylor series up to x^9 is accurate to
+ * a quarter of a step of Q16.16. The series is evaluated in Horner form with Q16_SERIES_FRACTION_BITS,
+ * as the coefficients of the higher powers are too small to be held in Q16.16.
+ *
+ * @param angle The angle in radians.
+ * @return The sine.
+ */
+q16_t q16_sin(q16_t angle)
+{
+    q16_t x = q16_wrap(angle, Q16_PI);
+
+    // sin(pi - x) = sin(x)
+    if (x > Q16_HALF_PI)
+    {
+        x = Q16_PI - x;
+    }
+    else if (x < -Q16_HALF_PI)
+    {
+        x = -Q16_PI - x;
+    }
+
+    // Within -pi/2 to pi/2, x and its square fit in 32 bits with the extra fraction bits
+    int32_t wide_x = x << (Q16_SERIES_FRACTION_BITS - Q16_FRACTION_BITS);
+    int32_t x2 = ((int64_t)wide_x * wide_x) >> Q16_SERIES_FRACTION_BITS;
+    int32_t series = Q16_SERIES(1.0 / 362880.0);
+    series = Q16_SERIES(-1.0 / 5040.0) + (((int64_t)x2 * series) >> Q16_SERIES_FRACTION_BITS);
+    series = Q16_SERIES(1.0 / 120.0) + (((int64_t)x2 * series) >> Q16_SERIES_FRACTION_BITS);
+    series = Q16_SERIES(-1.0 / 6.0) + (((int64_t)x2 * series) >> Q16_SERIES_FRACTION_BITS);
+    series = Q16_SERIES(1.0) + (((int64_t)x2 * series) >> Q16_SERIES_FRACTION_BITS);
+
+    // Back to Q16.16, rounded
+    int64_t sine = (int64_t)x * series;
+    return (q16_t)((sine + ((int64_t)1 << (Q16_SERIES_FRACTION_BITS - 1))) >> Q16_SERIES_FRACTION_BITS);
+}
+
+/**
+ * @brief Get the cosine of an angle.
+ *
+ * @param angle The angle in radians.
+ * @return The cosine.
+ */
+q16_t q16_cos(q16_t angle)
+{
+    return q16_sin(q16_add(q16_wrap(angle, Q16_PI), Q16_HALF_PI));
+}
+
+/**
+ * @brief Get the angle of the point (x, y) from the x axis.
+ *
+ * @details
+ * The ratio of the smaller to the larger coordinate is within 0 to 1, where the polynomial of
+ * Abramowitz and Stegun 4.4.49 is accurate to 1e-5 radians, and the octant gives the rest of the angle.
+ * Only the ratio of y and x matters, so they may be raw sensor values in any unit.
+ *
+ * @param y The y coordinate.
+ * @param x The x coordinate.
+ * @return The angle in radians, -pi to pi, 0 for the origin.
+ */
+q16_t q16_atan2(q16_t y, q16_t x)
+{
+    q16_t abs_x = q16_abs(x);
+    q16_t abs_y = q16_abs(y);
+
+    if (abs_x == 0 && abs_y == 0)
+    {
+        return 0;
+    }
+
+    // atan of the ratio within 0 to 1
+    bool swapped = abs_y > abs_x;
+    q16_t z = swapped ? q16_div(abs_x, abs_y) : q16_div(abs_y, abs_x);
+    q16_t z2 = q16_mul(z, z);
+    q16_t series = Q16(0.0208351);
+    series = Q16(-0.0851330) + q16_mul(z2, series);
+    series = Q16(0.1801410) + q16_mul(z2, series);
+    series = Q16(-0.3302995) + q16_mul(z2, series);
+    series = Q16(0.9998660) + q16_mul(z2, series);
+    q16_t angle = q16_mul(z, series);
+
+    // Back to the octant of the point
+    if (swapped)
+    {
+        angle = Q16_HALF_PI - angle;
+    }
+    if (x < 0)
+    {
+        angle = Q16_PI - angle;
+    }
+
+    return y < 0 ? -angle : angle;
+}
+
+/**
+ * @brief Convert radians to degrees.
+ *
+ * @param radians The angle in radians.
+ * @return The angle in degrees, saturated.
+ */
+q16_t q16_to_degrees(q16_t radians)
+{
+    return q16_mul(radians, Q16_DEGREES_PER_RADIAN);
+}
+
+/**
+ * @brief Convert degrees to radians.
+ *
+ * @param degrees The angle in degrees.
+ * @return The angle in radians.
+ */
+q16_t q16_to_radians(q16_t degrees)
+{
+    return q16_mul(degrees, Q16_RADIANS_PER_DEGREE);
+}
+
+#endif // FIXED_POINT_H
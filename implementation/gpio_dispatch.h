@@ -0,0 +1,105 @@
+/**
+ * @file gpio_dispatch.h
+ * @brief Header file for the per-pin GPIO interrupt dispatch.
+ * @details
+ * The Pico SDK only allows one GPIO interrupt callback per core. This file owns that callback
+ * and keeps a table of handlers indexed by pin, so every sensor module registers the handler
+ * for its own pins and main.c does not need to know about any of them.
+ *
+ * The callback reads the time before anything else, so every handler gets the same early timestamp
+ * no matter how many handlers ran before it. Handlers receive the full edge mask from the SDK,
+ * which can have both GPIO_IRQ_EDGE_RISE and GPIO_IRQ_EDGE_FALL set when both edges were latched
+ * before the interrupt ran, see gpio_edge_level().
+ *
+ * @date November 17, 2023
+ */
+
+#ifndef GPIO_DISPATCH_H
+#define GPIO_DISPATCH_H
+
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+
+// Number of GPIO pins that can raise an interrupt
+#define GPIO_DISPATCH_PIN_COUNT 30
+
+/**
+ * @brief Handler for the edges of one pin.
+ *
+ * @param pin The GPIO pin.
+ * @param edge Mask of GPIO_IRQ_EDGE_RISE and GPIO_IRQ_EDGE_FALL seen on the pin.
+ * @param timestamp Time the interrupt started from time_us_32().
+ */
+typedef void (*gpio_event_handler_t)(uint pin, uint32_t edge, uint32_t timestamp);
+
+gpio_event_handler_t gpio_event_handlers[GPIO_DISPATCH_PIN_COUNT]; // Handler of every pin, NULL if none
+volatile uint32_t gpio_unhandled_events = 0;    // Number of interrupts on a pin with no handler
+
+// Function prototypes
+void gpio_dispatch_callback(uint gpio, uint32_t events);
+void register_gpio_handler(uint pin, uint32_t edge_mask, gpio_event_handler_t handler);
+bool gpio_edge_level(uint pin, uint32_t edge);
+
+/**
+ * @brief The GPIO interrupt callback shared by every pin.
+ *
+ * @param gpio The GPIO pin number generating the interrupt.
+ * @param events The type of events triggering the interrupt.
+ */
+void gpio_dispatch_callback(uint gpio, uint32_t events)
+{
+    // Record the time of the edge before anything else
+    uint32_t timestamp = time_us_32();
+
+    // Only keep the edge bits, level interrupts are not used
+    uint32_t edge = events & (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+
+    if (gpio < GPIO_DISPATCH_PIN_COUNT && gpio_event_handlers[gpio] != NULL && edge != 0)
+    {
+        gpio_event_handlers[gpio](gpio, edge, timestamp);
+    }
+    else
+    {
+        gpio_unhandled_events++;
+    }
+}
+
+/**
+ * @brief Register the handler of a pin and enable its interrupt.
+ *
+ * @param pin The GPIO pin.
+ * @param edge_mask Edges that raise the interrupt, GPIO_IRQ_EDGE_RISE and/or GPIO_IRQ_EDGE_FALL.
+ * @param handler Function called from the interrupt for every edge of the pin.
+ */
+void register_gpio_handler(uint pin, uint32_t edge_mask, gpio_event_handler_t handler)
+{
+    gpio_event_handlers[pin] = handler;
+    gpio_set_irq_enabled_with_callback(pin, edge_mask, true, &gpio_dispatch_callback);
+}
+
+/**
+ * @brief Get the level of a pin after the edges that raised the interrupt.
+ *
+ * @details
+ * If only one edge was seen, the level follows from it. If both were latched the order is lost,
+ * so the pin is read instead.
+ *
+ * @param pin The GPIO pin.
+ * @param edge Mask of the edges seen on the pin.
+ * @return true if the pin is high after the edges, false otherwise.
+ */
+bool gpio_edge_level(uint pin, uint32_t edge)
+{
+    if (edge == GPIO_IRQ_EDGE_RISE)
+    {
+        return true;
+    }
+    if (edge == GPIO_IRQ_EDGE_FALL)
+    {
+        return false;
+    }
+
+    return gpio_get(pin);
+}
+
+#endif // GPIO_DISPATCH_H
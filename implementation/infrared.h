@@ -6,6 +6,13 @@
  * @date October 27, 2023
  */
 
+#include "hardware/sync.h"
+
+#include "code39.h"
+#include "gpio_dispatch.h"
+#include "debounce.h"
+#include "event_queue.h"
+
 // Define GPIO PIN for IR Sensors
 #define LEFT_LINE_SENSOR_PIN 6
 #define RIGHT_LINE_SENSOR_PIN 7
@@ -15,115 +22,124 @@
 #define TICKS_PER_MICROSECOND 1
 #define TIMEOUT_MICROSECONDS 5000000 // 5 seconds timeout
 
-// Barcode definitions that are patterns to identify the different characters
-#define BARCODE_A "111010100010111"
-#define BARCODE_B "101110100010111"
-#define BARCODE_C "111011101000101"
-#define BARCODE_D "101011100010111"
-#define BARCODE_E "111010111000101"
-#define BARCODE_F "101110111000101"
-#define BARCODE_G "101010001110111"
-#define BARCODE_H "111010100011101"
-#define BARCODE_I "101110100011101"
-#define BARCODE_J "101011100011101"
-#define BARCODE_K "111010101000111"
-#define BARCODE_L "101110101000111"
-#define BARCODE_M "111011101010001"
-#define BARCODE_N "101011101000111"
-#define BARCODE_O "111010111010001"
-#define BARCODE_P "101110111010001"
-#define BARCODE_Q "101010111000111"
-#define BARCODE_R "111010101110001"
-#define BARCODE_S "101110101110001"
-#define BARCODE_T "101011101110001"
-#define BARCODE_U "111000101010111"
-#define BARCODE_V "100011101010111"
-#define BARCODE_W "111000111010101"
-#define BARCODE_X "100010111010111"
-#define BARCODE_Y "111000101110101"
-#define BARCODE_Z "100011101110101"
-#define BARCODE_0 "101000111011101"
-#define BARCODE_1 "111010001010111"
-#define BARCODE_2 "101110001010111"
-#define BARCODE_3 "111011100010101"
-#define BARCODE_4 "101000111010111"
-#define BARCODE_5 "111010001110101"
-#define BARCODE_6 "101110001110101"
-#define BARCODE_7 "101000101110111"
-#define BARCODE_8 "111010001011101"
-#define BARCODE_9 "101110001011101"
-#define BARCODE_DASH "100010101110111"
-#define BARCODE_PERIOD "111000101011101"
-#define BARCODE_DOLLAR "100010001000101"
-#define BARCODE_SLASH "100010001010001"
-#define BARCODE_PLUS "100010100010001"
-#define BARCODE_PERCENT "101000100010001"
-#define BARCODE_SPACE "100011101011101"
-#define BARCODE_ASTERISK "100010111011101"
-#define BARCODE_A_B "111010001010111"
-#define BARCODE_B_B "111010001011101"
-#define BARCODE_C_B "101000101110111"
-#define BARCODE_D_B "111010001110101"
-#define BARCODE_E_B "101000111010111"
-#define BARCODE_F_B "101000111011101"
-#define BARCODE_G_B "111011100010101"
-#define BARCODE_H_B "101110001010111"
-#define BARCODE_I_B "101110001011101"
-#define BARCODE_J_B "101110001110101"
-#define BARCODE_K_B "111000101010111"
-#define BARCODE_L_B "111000101011101"
-#define BARCODE_M_B "100010101110111"
-#define BARCODE_N_B "111000101110101"
-#define BARCODE_O_B "100010111010111"
-#define BARCODE_P_B "100010111011101"
-#define BARCODE_Q_B "111000111010101"
-#define BARCODE_R_B "100011101010111"
-#define BARCODE_S_B "100011101011101"
-#define BARCODE_T_B "100011101110101"
-#define BARCODE_U_B "111010101000111"
-#define BARCODE_V_B "111010101110001"
-#define BARCODE_W_B "101010111000111"
-#define BARCODE_X_B "111010111010001"
-#define BARCODE_Y_B "101011101000111"
-#define BARCODE_Z_B "101011101110001"
-#define BARCODE_0_B "101110111000101"
-#define BARCODE_1_B "111010100010111"
-#define BARCODE_2_B "111010100011101"
-#define BARCODE_3_B "101010001110111"
-#define BARCODE_4_B "111010111000101"
-#define BARCODE_5_B "101011100010111"
-#define BARCODE_6_B "101011100011101"
-#define BARCODE_7_B "111011101000101"
-#define BARCODE_8_B "101110100010111"
-#define BARCODE_9_B "101110100011101"
-#define BARCODE_DASH_B "111011101010001"
-#define BARCODE_PERIOD_B "101110101000111"
-#define BARCODE_DOLLAR_B "101000100010001"
-#define BARCODE_SLASH_B "100010100010001"
-#define BARCODE_PLUS_B "100010001010001"
-#define BARCODE_PERCENT_B "100010001000101"
-#define BARCODE_SPACE_B "101110101110001"
+// Number of barcode elements kept while decoding (one symbol and the gap before it)
+#define BARCODE_WINDOW_SIZE (CODE39_ELEMENTS_PER_SYMBOL + 1)
+// Maximum number of characters between the '*' delimiters of a barcode
+#define BARCODE_MESSAGE_SIZE 32
+// Event sent to the TCP client for every completed barcode, one line per barcode with its confidence
+#define BARCODE_EVENT_FORMAT "BARCODE:%s,%u\n"
+
+// A space this many times wider than the average element in a full window is a quiet zone, see measure_barcode_reading()
+// Any 10 elements of a barcode average at most 1.8 narrow widths, and Code 39 needs a quiet zone of at least 10
+#define BARCODE_QUIET_ZONE_RATIO 5
+
+// Define the voting and re-scan behaviour for low confidence barcodes
+#define BARCODE_CONFIDENCE_ACCEPT 60    // Confidence needed to report a barcode
+#define BARCODE_CANDIDATE_COUNT 4       // Number of different low confidence reads kept for voting
+#define BARCODE_MAX_RESCANS 2           // Number of re-scans before a low confidence barcode is dropped
+#define BARCODE_RESCAN_BACKUP_MS 1000   // Time to drive back over the barcode before passing it again
+
+// Number of barcode edges that can wait for decoding, must be a power of 2
+#define BARCODE_EDGE_BUFFER_SIZE 128
+#define BARCODE_EDGE_BUFFER_MASK (BARCODE_EDGE_BUFFER_SIZE - 1)
+
+// Define the glitch filter for barcode edges, a pulse shorter than the glitch width is merged into the element around it
+#define BARCODE_GLITCH_DISTANCE 64      // Narrowest real element in 1/ENCODER_POSITION_SCALE encoder ticks (a quarter tick, about 2.7 mm)
+#define BARCODE_GLITCH_MIN_US 100       // Shortest glitch width, used at full speed
+#define BARCODE_GLITCH_MAX_US 20000     // Longest glitch width, used when the robot is slow or not moving
+
+/**
+ * @brief A single edge seen by the barcode sensor.
+ */
+typedef struct
+{
+    uint32_t timestamp; // Time of the edge from time_us_32()
+    int32_t position;   // Distance travelled at the edge from get_encoder_position()
+    bool is_black;      // true if the sensor changed to black (rising edge), false if it changed to white
+} barcode_edge_t;
+
+/**
+ * @brief A single bar or space of a barcode.
+ */
+typedef struct
+{
+    uint32_t width; // Width of the element, see get_barcode_element_width()
+    bool is_black;  // true for a bar, false for a space
+} barcode_element_t;
+
+/**
+ * @brief A low confidence barcode read kept for voting.
+ */
+typedef struct
+{
+    char message[BARCODE_MESSAGE_SIZE + 1]; // Characters of the barcode
+    uint8_t votes;                          // Number of passes that read this barcode
+    uint16_t confidence_sum;                // Sum of the confidence of every pass
+} barcode_candidate_t;
 
 // Variables declared for IR Line Sensors
-bool is_left_line_black = false; 
-bool is_right_line_black = false;
+volatile bool is_left_line_black = false; 
+volatile bool is_right_line_black = false;
+debounce_t left_line_debounce;              // Debounce state of the left line sensor pin
+debounce_t right_line_debounce;             // Debounce state of the right line sensor pin
 
 // Variables declared for IR and Barcode Sensors
 uint32_t black_barcode_time_start = 0;      // Time the black barcode was first detected   
 uint32_t black_barcode_time_stop = 0;       // Time the black barcode was no longer detected
 uint32_t white_barcode_timer_start = 0;     // Time the white barcode was first detected 
 uint32_t white_barcode_timer_stop = 0;      // Time the white barcode was no longer detected
-uint32_t bar_detected_duration = 0;         // Time difference between first detected and no longer detected for the specific colour barcode
-
-uint32_t barcode_array[9000] = {};          // Store barcode data
-uint32_t barcode_counter = 0;               // To keep track of the length of the barcode
-uint32_t bar_thickness_divider = 999999999; // Divider to determine the thickness of the barcode
-uint32_t reset_barcode= 0;                  // Restting barcode to accept new barcode
-bool barcode_scanning_started = false;      // Flag to check if barcode started scanning
+int32_t black_barcode_position_start = 0;   // Distance travelled when the black barcode was first detected
+int32_t black_barcode_position_stop = 0;    // Distance travelled when the black barcode was no longer detected
+int32_t white_barcode_position_start = 0;   // Distance travelled when the white barcode was first detected
+int32_t white_barcode_position_stop = 0;    // Distance travelled when the white barcode was no longer detected
+bool barcode_width_from_encoder = true;     // Measure the barcode by distance travelled (true) or by time (false)
+
+barcode_element_t barcode_window[BARCODE_WINDOW_SIZE]; // Sliding window of the latest barcode elements
+uint8_t barcode_window_index = 0;           // Position in barcode_window where the next element is written
+uint8_t barcode_window_count = 0;           // Number of elements in barcode_window, up to BARCODE_WINDOW_SIZE
+uint8_t barcode_elements_since_symbol = 0;  // Number of elements read since the end of the last symbol
+bool barcode_scanning_started = false;      // Flag set once a '*' start delimiter has been read
 bool toggleBarcode = false;                 // Flag to decide whether to decode barcode or not
-char barcode_string[27] = {0};              // Store the binary for the barcode that was read
-char decoded_characters[50] = " "; /        // Store the character that was decoded.
-int count = 0;
+bool barcode_read_reversed = false;         // Flag set when the current barcode is read right-to-left
+char barcode_message[BARCODE_MESSAGE_SIZE]; // Characters read since the start delimiter, in the order they were read
+uint8_t barcode_message_length = 0;         // Number of characters in barcode_message
+bool barcode_check_character_enabled = false; // Flag to require and strip a mod 43 check character
+char decoded_characters[BARCODE_MESSAGE_SIZE + 1] = ""; // Store the characters of the last completed barcode
+int count = 0;                              // Number of characters in decoded_characters
+uint32_t barcode_messages_decoded = 0;      // Number of barcodes completed
+uint32_t barcode_check_failures = 0;        // Number of barcodes dropped because the check character did not match
+uint8_t barcode_message_confidence = 0;     // Lowest symbol confidence in the barcode being read
+uint8_t decoded_confidence = 0;             // Confidence of the last reported barcode
+
+// Low confidence reads waiting for more passes, forward and reverse passes vote together
+barcode_candidate_t barcode_candidates[BARCODE_CANDIDATE_COUNT];
+uint8_t barcode_candidate_count = 0;        // Number of entries in barcode_candidates
+uint32_t barcode_candidate_time = 0;        // Time the first candidate was stored
+uint32_t barcode_low_confidence_drops = 0;  // Number of barcodes dropped after running out of re-scans
+
+// Re-scan manoeuvre
+bool barcode_rescan_requested = false;      // Flag set when a low confidence read needs another pass
+uint8_t barcode_rescan_count = 0;           // Number of re-scans for the current barcode
+
+// Single producer (barcode interrupt, or the ADC timer in ir_adc.h) / single consumer (main loop) buffer of barcode edges
+barcode_edge_t barcode_edge_buffer[BARCODE_EDGE_BUFFER_SIZE];
+volatile uint32_t barcode_edge_head = 0;            // Number of edges written, only changed by the interrupt
+volatile uint32_t barcode_edge_tail = 0;            // Number of edges read, only changed by the main loop
+volatile uint32_t barcode_edge_overruns = 0;        // Number of edges dropped because the buffer was full
+volatile uint32_t barcode_isr_count = 0;            // Number of times the barcode interrupt ran
+volatile uint32_t barcode_isr_last_duration_us = 0; // Duration of the latest barcode interrupt
+volatile uint32_t barcode_isr_max_duration_us = 0;  // Longest barcode interrupt seen so far
+
+// Glitch filter between the edge buffer and the decoder
+bool barcode_glitch_filter_enabled = true;              // Flag to merge pulses shorter than the glitch width
+uint32_t barcode_glitch_distance = BARCODE_GLITCH_DISTANCE; // Narrowest real element in 1/ENCODER_POSITION_SCALE encoder ticks
+uint32_t barcode_glitch_min_us = BARCODE_GLITCH_MIN_US; // Lower limit of the glitch width
+uint32_t barcode_glitch_max_us = BARCODE_GLITCH_MAX_US; // Upper limit of the glitch width
+uint32_t barcode_edge_latency_us = 0;       // Longest delay between an edge and it reaching the edge buffer
+barcode_edge_t barcode_pending_edge;        // Latest edge, held until the pulse after it is known to be wide enough
+bool barcode_edge_pending = false;          // Flag set while barcode_pending_edge is held
+bool barcode_filtered_is_black = false;     // Colour after the last edge passed to the decoder
+uint32_t barcode_glitches_rejected = 0;     // Number of pulses merged by the glitch filter
 
 // GPIO pin 
 uint8_t left_sensor_pin = 6;                
@@ -132,547 +148,804 @@ uint8_t barcode_sensor_pin = 8;
 
 
 // Function Prototypes
+bool classify_barcode_symbol(uint16_t *key, uint8_t *confidence);
+void reset_barcode_decoder();
+void report_barcode(const char *message, uint8_t confidence);
+void request_barcode_rescan();
+void vote_barcode(const char *message, uint8_t confidence);
+void update_barcode_rescan();
+void finish_barcode_message();
 void decode_barcode();
-void measure_barcode_reading(char color[]);
-void handle_barcode_sensor_events(uint gpio, uint32_t events);
-void handle_lines_sensor_events(uint gpio, uint32_t events);
+void add_barcode_element(uint32_t width, bool is_black);
+void measure_barcode_reading(bool is_black);
+void handle_barcode_sensor_events(uint pin, uint32_t edge, uint32_t timestamp);
+void enable_barcode_interrupt();
+bool push_barcode_edge(uint32_t timestamp, int32_t position, bool is_black);
+uint32_t get_barcode_element_width(uint32_t time_start, uint32_t time_stop, int32_t position_start, int32_t position_stop);
+bool pop_barcode_edge(barcode_edge_t *edge);
+uint32_t get_barcode_glitch_width(uint32_t now);
+void release_barcode_edge(const barcode_edge_t *edge);
+void filter_barcode_edge(const barcode_edge_t *edge);
+void process_barcode_edges();
+void retrieve_barcode_edge_statistics();
+void handle_line_sensor_event(uint pin, uint32_t edge, uint32_t timestamp);
+void settle_line_sensors();
 void retrieve_line_sensor_value();
+bool send_tcp_event(const char *event);
 void initialise_infrared(int8_t left_line_sensor_pin, int8_t right_line_sensor_pin, int8_t barcode_sensor_pin);
 
 
 
 /**
- * @brief Function to decode the barcode
+ * @brief Classify the latest 9 elements in barcode_window and pack them into a Code 39 key.
  *
  * @details
- * This function decodes the binary representation of the barcode array and updates the character string and additional processing based on the decoded barcode string
- * 1) It will first print the barcode array and the current character decoded.
- * 2) When the barcode array is filled with 27 interger values, then it means the barcode has finished reading.
- * 3) It will start converting the barcode array's integer value to a binary string. 2 to "0" | 222 to "000" | 1 to "1" | 111 to "111"
- * 4) Clean up barcode array to use it for reading new values
- * 5) Check if the barcode contain the predefine barcode binary string, if yes, interpret it as the character associated
+ * The narrow/wide threshold is worked out from the 9 widths of the symbol itself,
+ * so a change in speed between symbols does not affect the result.
+ *
+ * @param key Pointer to where the packed key is stored.
+ * @param confidence Pointer to where the confidence of the symbol is stored.
+ * @return true if the elements form a valid 3 wide / 6 narrow symbol, false otherwise.
  */
-void decode_barcode()
+bool classify_barcode_symbol(uint16_t *key, uint8_t *confidence)
 {
-    // Print the barcode array and the string value
-    for (int i = 0; i < 27; i++)
+    uint32_t widths[CODE39_ELEMENTS_PER_SYMBOL];
+    bool wide[CODE39_ELEMENTS_PER_SYMBOL];
+
+    // Copy the latest 9 widths out of the window, oldest first
+    uint8_t index = (barcode_window_index + BARCODE_WINDOW_SIZE - CODE39_ELEMENTS_PER_SYMBOL) % BARCODE_WINDOW_SIZE;
+    for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
     {
-        printf("%d", barcode_array[i]);
+        widths[i] = barcode_window[index].width;
+        index = (index + 1) % BARCODE_WINDOW_SIZE;
     }
-    printf("\n");
-    printf("\n%s\n", decoded_characters);
 
-    // If barcode counter is 27, the barcode has finished reading.
-    if (barcode_counter == 27)
+    // Split the element widths into narrow and wide elements
+    if (!code39_classify_widths(widths, wide, confidence))
     {
-        // Convert the barcode array to a binary string
-        for (int i = 0; i < 27; i++)
-        {
-            // Convert integer 2 to string 0
-            if (barcode_array[i] == 2)
-            {
-                strcat(barcode_string, "0");
-            }
-            // Convert integer 222 to string 000
-            else if (barcode_array[i] == 222)
-            {
-                strcat(barcode_string, "000");
-            }
-            // Convert integer 1 to string 1
-            else if (barcode_array[i] == 1)
-            {
-                strcat(barcode_string, "1");
-            }
-            // Convert integer 111 to string 111
-            else if (barcode_array[i] == 111)
-            {
-                strcat(barcode_string, "111");
-            }
-        }
+        return false;
+    }
 
-        // Reset the barcode array by resetting all the elements value to 0 to prepare for reading new barcode
-        for (int i = 0; i < 27; i++)
-        {
-            barcode_array[i] = 0;
-        }
-        // Reset the barcode counter to 0
-        barcode_counter = 0;
-        // Increment the reset counter for tracking of resets
-        reset_barcode++;
-        // Shift the barcode string to the left by 16 characters
-        strcpy(barcode_string, barcode_string + 16);
-        // Remove the last 9 characters from the barcode string
-        barcode_string[strlen(barcode_string) - 9] = '\0';
-
-        // Check if the barcode string contains the predefined barcode definition for 'A' (BARCODE_A) 
-        if (strstr(barcode_string, BARCODE_A) != NULL)
-        {
-            // If BARCODE_A is found in the barcode_string, interpret it as 'A' and stored into decoded_character
-            decoded_characters[count] = 'A';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'B' (BARCODE_B) 
-        else if (strstr(barcode_string, BARCODE_B) != NULL)
-        {
-            // If BARCODE_B is found in the barcode_string, interpret it as 'B' and stored into decoded_character
-            decoded_characters[count] = 'B';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'C' (BARCODE_C) 
-        else if (strstr(barcode_string, BARCODE_C) != NULL)
-        {
-            // If BARCODE_C is found in the barcode_string, interpret it as 'C' and stored into decoded_character
-            decoded_characters[count] = 'C';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'D' (BARCODE_D) 
-        else if (strstr(barcode_string, BARCODE_D) != NULL)
-        {
-            // If BARCODE_D is found in the barcode_string, interpret it as 'D' and stored into decoded_character
-            decoded_characters[count] = 'D';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'E' (BARCODE_E) 
-        else if (strstr(barcode_string, BARCODE_E) != NULL)
-        {
-            // If BARCODE_E is found in the barcode_string, interpret it as 'E' and stored into decoded_character
-            decoded_characters[count] = 'E';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'F' (BARCODE_F) 
-        else if (strstr(barcode_string, BARCODE_F) != NULL)
-        {
-            // If BARCODE_F is found in the barcode_string, interpret it as 'F' and stored into decoded_character
-            decoded_characters[count] = 'F';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'G (BARCODE_G) 
-        else if (strstr(barcode_string, BARCODE_G) != NULL)
-        {
-            // If BARCODE_G is found in the barcode_string, interpret it as 'G' and stored into decoded_character
-            decoded_characters[count] = 'G';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'H' (BARCODE_H) 
-        else if (strstr(barcode_string, BARCODE_H) != NULL)
-        {
-            // If BARCODE_H is found in the barcode_string, interpret it as 'H' and stored into decoded_character
-            decoded_characters[count] = 'H';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'I' (BARCODE_I) 
-        else if (strstr(barcode_string, BARCODE_I) != NULL)
-        {
-            // If BARCODE_I is found in the barcode_string, interpret it as 'I' and stored into decoded_character
-            decoded_characters[count] = 'I';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'J' (BARCODE_J) 
-        else if (strstr(barcode_string, BARCODE_J) != NULL)
-        {
-            // If BARCODE_J is found in the barcode_string, interpret it as 'J' and stored into decoded_character
-            decoded_characters[count] = 'J';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'K' (BARCODE_K) 
-        else if (strstr(barcode_string, BARCODE_K) != NULL)
-        {
-            // If BARCODE_K is found in the barcode_string, interpret it as 'K' and stored into decoded_character
-            decoded_characters[count] = 'K';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'L' (BARCODE_L) 
-        else if (strstr(barcode_string, BARCODE_L) != NULL)
-        {
-            // If BARCODE_L is found in the barcode_string, interpret it as 'L' and stored into decoded_character
-            decoded_characters[count] = 'L';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'M' (BARCODE_M) 
-        else if (strstr(barcode_string, BARCODE_M) != NULL)
-        {
-            // If BARCODE_M is found in the barcode_string, interpret it as 'M' and stored into decoded_character
-            decoded_characters[count] = 'M';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'N' (BARCODE_N) 
-        else if (strstr(barcode_string, BARCODE_N) != NULL)
-        {
-            // If BARCODE_N is found in the barcode_string, interpret it as 'N' and stored into decoded_character
-            decoded_characters[count] = 'N';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'O' (BARCODE_O) 
-        else if (strstr(barcode_string, BARCODE_O) != NULL)
-        {
-            // If BARCODE_O is found in the barcode_string, interpret it as 'O' and stored into decoded_character
-            decoded_characters[count] = 'O';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'P' (BARCODE_P) 
-        else if (strstr(barcode_string, BARCODE_P) != NULL)
-        {
-            // If BARCODE_P is found in the barcode_string, interpret it as 'P' and stored into decoded_character
-            decoded_characters[count] = 'P';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'Q' (BARCODE_Q) 
-        else if (strstr(barcode_string, BARCODE_Q) != NULL)
-        {
-            // If BARCODE_Q is found in the barcode_string, interpret it as 'Q' and stored into decoded_character
-            decoded_characters[count] = 'Q';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'R' (BARCODE_R) 
-        else if (strstr(barcode_string, BARCODE_R) != NULL)
-        {n
-            // If BARCODE_R is found in the barcode_string, interpret it as 'R' and stored into decoded_character
-            decoded_characters[count] = 'R';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'S' (BARCODE_S) 
-        else if (strstr(barcode_string, BARCODE_S) != NULL)
-        {
-            // If BARCODE_S is found in the barcode_string, interpret it as 'S' and stored into decoded_character
-            decoded_characters[count] = 'S';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'T' (BARCODE_T) 
-        else if (strstr(barcode_string, BARCODE_T) != NULL)
-        {
-            // If BARCODE_T is found in the barcode_string, interpret it as 'T' and stored into decoded_character
-            decoded_characters[count] = 'T';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'U' (BARCODE_U) 
-        else if (strstr(barcode_string, BARCODE_U) != NULL)
-        {
-            // If BARCODE_U is found in the barcode_string, interpret it as 'U' and stored into decoded_character
-            decoded_characters[count] = 'U';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'V' (BARCODE_V) 
-        else if (strstr(barcode_string, BARCODE_V) != NULL)
-        {
-            // If BARCODE_V is found in the barcode_string, interpret it as 'V' and stored into decoded_character
-            decoded_characters[count] = 'V';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'W' (BARCODE_W) 
-        else if (strstr(barcode_string, BARCODE_W) != NULL)
-        {
-            // If BARCODE_W is found in the barcode_string, interpret it as 'W' and stored into decoded_character
-            decoded_characters[count] = 'W';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'X' (BARCODE_X) 
-        else if (strstr(barcode_string, BARCODE_X) != NULL)
-        {
-            // If BARCODE_X is found in the barcode_string, interpret it as 'X' and stored into decoded_character
-            decoded_characters[count] = 'X';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for 'Y' (BARCODE_Y) 
-        else if (strstr(barcode_string, BARCODE_Y) != NULL)
-        {
-            // If BARCODE_Y is found in the barcode_string, interpret it as 'Y' and stored into decoded_character
-            decoded_characters[count] = 'Y';
-            count++;
-        }
-        // If barcode string contains predefined barcode(BARCODE_Z), interpret it as 'Z' and stored into decoded_character
-        else if (strstr(barcode_string, BARCODE_Z) != NULL)
-        {
-            // If BARCODE_Z is found in the barcode_string, interpret it as 'Z' and stored into decoded_character
-            decoded_characters[count] = 'Z';
-            count++;
-        }
+    *key = code39_pack_key(wide);
+    return true;
+}
 
-        // Check if the barcode string contains the predefined barcode definition for '0' (BARCODE_0) 
-        else if (strstr(barcode_string, BARCODE_0) != NULL)
-        {
-            // If BARCODE_0 is found in the barcode_string, interpret it as '0' and stored into decoded_character
-            decoded_characters[count] = '0';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '1' (BARCODE_1) 
-        else if (strstr(barcode_string, BARCODE_1) != NULL)
-        {
-            // If BARCODE_1 is found in the barcode_string, interpret it as '1' and stored into decoded_character
-            decoded_characters[count] = '1';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '2' (BARCODE_2) 
-        else if (strstr(barcode_string, BARCODE_2) != NULL)
-        {
-            // If BARCODE_2 is found in the barcode_string, interpret it as '2' and stored into decoded_character
-            decoded_characters[count] = '2';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '3' (BARCODE_3) 
-        else if (strstr(barcode_string, BARCODE_3) != NULL)
-        {
-            // If BARCODE_3 is found in the barcode_string, interpret it as '3' and stored into decoded_character
-            decoded_characters[count] = '3';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '4' (BARCODE_4) 
-        else if (strstr(barcode_string, BARCODE_4) != NULL)
-        {
-            // If BARCODE_4 is found in the barcode_string, interpret it as '4' and stored into decoded_character
-            decoded_characters[count] = '4';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '5' (BARCODE_5) 
-        else if (strstr(barcode_string, BARCODE_5) != NULL)
-        {
-            // If BARCODE_5 is found in the barcode_string, interpret it as '5' and stored into decoded_character
-            decoded_characters[count] = '5';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '6' (BARCODE_6) 
-        else if (strstr(barcode_string, BARCODE_6) != NULL)
-        {
-            // If BARCODE_6 is found in the barcode_string, interpret it as '6' and stored into decoded_character
-            decoded_characters[count] = '6';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '7' (BARCODE_7) 
-        else if (strstr(barcode_string, BARCODE_7) != NULL)
-        {
-            // If BARCODE_7 is found in the barcode_string, interpret it as '7' and stored into decoded_character
-            decoded_characters[count] = '7';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '8' (BARCODE_8) 
-        else if (strstr(barcode_string, BARCODE_8) != NULL)
-        {
-            // If BARCODE_8 is found in the barcode_string, interpret it as '8' and stored into decoded_character
-            decoded_characters[count] = '8';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '9' (BARCODE_9) 
-        else if (strstr(barcode_string, BARCODE_9) != NULL)
-        {
-            // If BARCODE_9 is found in the barcode_string, interpret it as '9' and stored into decoded_character
-            decoded_characters[count] = '9';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '-' (BARCODE_DASH) 
-        else if (strstr(barcode_string, BARCODE_DASH) != NULL)
-        {
-            // If BARCODE_DASH is found in the barcode_string, interpret it as '-' and stored into decoded_character
-            decoded_characters[count] = '-';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '.' (BARCODE_PERIOD) 
-        else if (strstr(barcode_string, BARCODE_PERIOD) != NULL)
-        {
-            // If BARCODE_PERIOD is found in the barcode_string, interpret it as '.' and stored into decoded_character
-            decoded_characters[count] = '.';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '$' (BARCODE_DOLLAR) 
-        else if ((strstr(barcode_string, BARCODE_DOLLAR) != NULL))
-        {
-            // If BARCODE_DOLLAR is found in the barcode_string, interpret it as '$' and stored into decoded_character
-            decoded_characters[count] = '$';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '/' (BARCODE_SLASH) 
-        else if ((strstr(barcode_string, BARCODE_SLASH) != NULL))
-        {
-            // If BARCODE_SLASH is found in the barcode_string, interpret it as '/' and stored into decoded_character
-            decoded_characters[count] = '/';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '+' (BARCODE_PLUS) 
-        else if ((strstr(barcode_string, BARCODE_PLUS) != NULL))
-        {
-            // If BARCODE_PLUS is found in the barcode_string, interpret it as '+' and stored into decoded_character
-            decoded_characters[count] = '+';
-            count++;
-        }
-        // Check if the barcode string contains the predefined barcode definition for '%' (BARCODE_PERCENT) 
-        else if ((strstr(barcode_string, BARCODE_PERCENT) != NULL))
+/**
+ * @brief Drop the barcode being read and go back to looking for a start delimiter.
+ */
+void reset_barcode_decoder()
+{
+    barcode_scanning_started = false;
+    barcode_elements_since_symbol = 0;
+    barcode_message_length = 0;
+}
+
+/**
+ * @brief Report a barcode to the TCP client and forget the reads that were voting for it.
+ *
+ * @param message Characters of the barcode.
+ * @param confidence Confidence of the barcode, 0 to CODE39_MAX_CONFIDENCE.
+ */
+void report_barcode(const char *message, uint8_t confidence)
+{
+    char event[sizeof(BARCODE_EVENT_FORMAT) + BARCODE_MESSAGE_SIZE + 3];
+
+    // Keep the reported barcode in decoded_characters
+    strncpy(decoded_characters, message, BARCODE_MESSAGE_SIZE);
+    decoded_characters[BARCODE_MESSAGE_SIZE] = '\0';
+    count = strlen(decoded_characters);
+    decoded_confidence = confidence;
+    barcode_messages_decoded++;
+
+    // Start the next barcode with no votes and no re-scans
+    barcode_candidate_count = 0;
+    barcode_rescan_count = 0;
+
+    // Send the barcode to the TCP client
+    snprintf(event, sizeof(event), BARCODE_EVENT_FORMAT, decoded_characters, confidence);
+    send_tcp_event(event);
+}
+
+/**
+ * @brief Ask for another pass over the barcode, or give up once BARCODE_MAX_RESCANS is reached.
+ */
+void request_barcode_rescan()
+{
+    if (barcode_rescan_count < BARCODE_MAX_RESCANS)
+    {
+        barcode_rescan_requested = true;
+        return;
+    }
+
+    // Out of re-scans, so drop the low confidence reads instead of reporting them
+    barcode_low_confidence_drops++;
+    barcode_candidate_count = 0;
+    barcode_rescan_count = 0;
+}
+
+/**
+ * @brief Add a low confidence read to the vote and report the barcode once enough passes agree.
+ *
+ * @details
+ * Every pass that reads the same characters adds its confidence to the candidate, so two passes
+ * that only just decode can together be trusted. Passes read in the reverse direction have already
+ * been put back in left-to-right order, so they vote for the same candidate.
+ * Candidates older than TIMEOUT_MICROSECONDS belong to an earlier barcode and are dropped.
+ *
+ * @param message Characters of the barcode.
+ * @param confidence Confidence of this read.
+ */
+void vote_barcode(const char *message, uint8_t confidence)
+{
+    // Forget candidates from an earlier barcode
+    uint32_t now = time_us_32();
+    if (barcode_candidate_count > 0 && now - barcode_candidate_time > TIMEOUT_MICROSECONDS)
+    {
+        barcode_candidate_count = 0;
+        barcode_rescan_count = 0;
+    }
+    if (barcode_candidate_count == 0)
+    {
+        barcode_candidate_time = now;
+    }
+
+    // Find the candidate with the same characters, or add a new one
+    barcode_candidate_t *candidate = NULL;
+    for (int i = 0; i < barcode_candidate_count; i++)
+    {
+        if (strcmp(barcode_candidates[i].message, message) == 0)
         {
-            // If BARCODE_PERCENT is found in the barcode_string, interpret it as '%' and stored into decoded_character
-            decoded_characters[count] = '%';
-            count++;
+            candidate = &barcode_candidates[i];
+            break;
         }
-        // Check if the barcode string contains the predefined barcode definition for ' ' (BARCODE_SPACE) 
-        else if ((strstr(barcode_string, BARCODE_SPACE) != NULL))
+    }
+    if (candidate == NULL && barcode_candidate_count < BARCODE_CANDIDATE_COUNT)
+    {
+        candidate = &barcode_candidates[barcode_candidate_count];
+        barcode_candidate_count++;
+        strncpy(candidate->message, message, BARCODE_MESSAGE_SIZE);
+        candidate->message[BARCODE_MESSAGE_SIZE] = '\0';
+        candidate->votes = 0;
+        candidate->confidence_sum = 0;
+    }
+
+    // Add this pass to the candidate and report it once the passes together are confident enough
+    if (candidate != NULL)
+    {
+        candidate->votes++;
+        candidate->confidence_sum += confidence;
+        if (candidate->votes > 1 && candidate->confidence_sum >= BARCODE_CONFIDENCE_ACCEPT)
         {
-            // If BARCODE_SPACE is found in the barcode_string, interpret it as ' ' and stored into decoded_character
-            decoded_characters[count] = ' ';
-            count++;
+            uint16_t combined_confidence = candidate->confidence_sum;
+            if (combined_confidence > CODE39_MAX_CONFIDENCE)
+            {
+                combined_confidence = CODE39_MAX_CONFIDENCE;
+            }
+            report_barcode(candidate->message, combined_confidence);
+            return;
         }
     }
+
+    request_barcode_rescan();
 }
 
 /**
- * @brief Measures and records barcode data.
+ * @brief Drive the re-scan manoeuvre, called from the main loop.
  *
  * @details
- * This function assesses the thickness of the barcode and updates the barcode_array based on the provided color.
- * If the barcode_array is full, it shifts the values to make space for new data.
+ * The manoeuvre is queued as two motion commands (see motion_queue.h) in place of the current movement:
+ * 1) The robot drives the opposite way for BARCODE_RESCAN_BACKUP_MS.
+ *    The decoder reads barcodes in both directions, so backing up over the barcode is already a second pass.
+ * 2) It then drives the original way again for a third pass, until the next command.
+ * A re-scan is only possible while driving straight forward or backward.
+ */
+void update_barcode_rescan()
+{
+    if (!barcode_rescan_requested)
+    {
+        return;
+    }
+    barcode_rescan_requested = false;
+
+    // Only re-scan while driving straight over the barcode
+    if (movement_direction != 'w' && movement_direction != 's')
+    {
+        return;
+    }
+
+    // Back up over the barcode, then pass over it again in the original direction
+    float speed = movement_direction == 'w' ? SPEED : -SPEED;
+    barcode_rescan_count++;
+    preempt_motion();
+    queue_velocity(-speed, BARCODE_RESCAN_BACKUP_MS);
+    queue_velocity(speed, 0);
+}
+
+/**
+ * @brief Assemble a completed barcode and report it, or vote on it if the read is not confident enough.
  *
- * @param color The color of the barcode being measured ("black" or "white").
+ * @details
+ * 1) A barcode read right-to-left gives its characters last first, so they are copied in reverse.
+ * 2) If barcode_check_character_enabled is set, the last character must be the mod 43 check character.
+ *    It is removed from the message, and a barcode with a wrong check character needs another pass.
+ * 3) A barcode with a confidence of at least BARCODE_CONFIDENCE_ACCEPT is sent to the TCP client straight away,
+ *    otherwise it goes to vote_barcode().
  */
-void measure_barcode_reading(char color[])
+void finish_barcode_message()
 {
-    // Shift the array to the left if the barcode is complete to make space for new barcode
-    if (barcode_counter == 27)
+    char message[BARCODE_MESSAGE_SIZE + 1];
+    int length;
+
+    // Copy the characters in left-to-right order
+    for (length = 0; length < barcode_message_length; length++)
     {
-        for (int i = 0; i < 8; i++)
+        int message_index = barcode_read_reversed ? barcode_message_length - 1 - length : length;
+        message[length] = barcode_message[message_index];
+    }
+
+    // Check and remove the check character
+    if (barcode_check_character_enabled)
+    {
+        if (!code39_verify_check_character(message, length))
         {
-            barcode_array[i] = barcode_array[i + 1];
+            barcode_check_failures++;
+            request_barcode_rescan();
+            return;
         }
-        barcode_counter--;
+        length--;
     }
+    message[length] = '\0';
 
-    // When the barcode is black, measure it using 0
-    if (strcmp(color, "black") == 0)
+    // Report confident reads, vote on the others
+    if (barcode_message_confidence >= BARCODE_CONFIDENCE_ACCEPT)
     {
+        report_barcode(message, barcode_message_confidence);
+    }
+    else
+    {
+        vote_barcode(message, barcode_message_confidence);
+    }
+}
 
-        // Calculate the time difference to get the total time the barcode is black
-        bar_detected_duration = black_barcode_time_stop - black_barcode_time_start;
+/**
+ * @brief Function to decode the barcode
+ *
+ * @details
+ * Called every time a new element is added to barcode_window. A symbol always ends with a bar,
+ * so nothing is done for spaces.
+ * 1) While no barcode has started, the latest 9 elements are checked after every bar for a '*' start delimiter.
+ *    A '*' read left-to-right means the barcode is read forwards. A '*' read right-to-left means it is read
+ *    backwards (driving in reverse or from the other side).
+ * 2) Once started, every symbol takes 10 elements (the gap and 9 elements), so the latest 9 elements are
+ *    classified every 10 elements and looked up in code39_table for the read direction.
+ * 3) Another '*' in the same direction ends the barcode and its characters are stored.
+ * 4) An invalid symbol drops the barcode, and the same elements are checked for a new start delimiter.
+ * The confidence of the barcode is the lowest confidence of any of its symbols, including the delimiters.
+ */
+void decode_barcode()
+{
+    uint16_t key = 0;
+    uint8_t confidence = 0;
+
+    // A symbol always ends with a bar, and needs 9 elements to check
+    uint8_t newest_index = (barcode_window_index + BARCODE_WINDOW_SIZE - 1) % BARCODE_WINDOW_SIZE;
+    if (!barcode_window[newest_index].is_black || barcode_window_count < CODE39_ELEMENTS_PER_SYMBOL)
+    {
+        return;
+    }
 
-        // Set the divider used to determine whether the barcode is thick or thin. 
-        if (barcode_counter == 0 && reset_barcode == 0)
+    if (barcode_scanning_started)
+    {
+        // Wait until the gap and the 9 elements of the next symbol have been read
+        if (barcode_elements_since_symbol < BARCODE_WINDOW_SIZE)
         {
-            bar_thickness_divider = bar_detected_duration + 20000;
+            return;
         }
+        barcode_elements_since_symbol = 0;
 
-        // Determine the thickness of the barcode
-        // When the barcode is thick
-        if (bar_detected_duration / bar_thickness_divider > 0)
+        if (classify_barcode_symbol(&key, &confidence))
         {
+            // Keep the lowest symbol confidence
+            if (confidence < barcode_message_confidence)
+            {
+                barcode_message_confidence = confidence;
+            }
 
-            barcode_array[barcode_counter] = 111;
-            barcode_counter++;
-        }
-        // When the barcode is thin
-        else
-        {
-            barcode_array[barcode_counter] = 1;
-            barcode_counter++;
+            // A '*' in the same direction as the start delimiter ends the barcode
+            uint16_t delimiter_key = barcode_read_reversed ? CODE39_KEY_START_STOP_REVERSED : CODE39_KEY_START_STOP;
+            if (key == delimiter_key)
+            {
+                finish_barcode_message();
+                reset_barcode_decoder();
+                return;
+            }
+
+            // Store the data character
+            char decoded_character = code39_lookup_direction(key, barcode_read_reversed);
+            if (decoded_character != CODE39_INVALID && decoded_character != CODE39_START_STOP &&
+                barcode_message_length < BARCODE_MESSAGE_SIZE)
+            {
+                barcode_message[barcode_message_length] = decoded_character;
+                barcode_message_length++;
+                return;
+            }
         }
+
+        // The symbol could not be read, so drop the barcode and check these elements for a new start
+        reset_barcode_decoder();
+    }
+
+    // Look for a '*' start delimiter in either direction
+    if (!classify_barcode_symbol(&key, &confidence))
+    {
+        return;
+    }
+    if (key == CODE39_KEY_START_STOP || key == CODE39_KEY_START_STOP_REVERSED)
+    {
+        barcode_scanning_started = true;
+        barcode_read_reversed = (key == CODE39_KEY_START_STOP_REVERSED);
+        barcode_elements_since_symbol = 0;
+        barcode_message_length = 0;
+        barcode_message_confidence = confidence;
+    }
+}
+
+/**
+ * @brief Add an element to barcode_window and try to decode the barcode.
+ *
+ * @details
+ * The window only holds the latest BARCODE_WINDOW_SIZE elements, the oldest element is overwritten.
+ *
+ * @param width Width of the element, see get_barcode_element_width().
+ * @param is_black true for a bar, false for a space.
+ */
+void add_barcode_element(uint32_t width, bool is_black)
+{
+    barcode_window[barcode_window_index].width = width;
+    barcode_window[barcode_window_index].is_black = is_black;
+    barcode_window_index = (barcode_window_index + 1) % BARCODE_WINDOW_SIZE;
+
+    if (barcode_window_count < BARCODE_WINDOW_SIZE)
+    {
+        barcode_window_count++;
+    }
+    barcode_elements_since_symbol++;
+
+    decode_barcode();
+}
+
+/**
+ * @brief Get the width of a barcode element.
+ *
+ * @details
+ * When barcode_width_from_encoder is set, the width is the distance travelled over the element
+ * in 1/ENCODER_POSITION_SCALE encoder ticks, so it does not change with the speed of the robot.
+ * Otherwise the width is the time the element was seen in microseconds.
+ *
+ * @param time_start Time the element was first detected.
+ * @param time_stop Time the element was no longer detected.
+ * @param position_start Distance travelled when the element was first detected.
+ * @param position_stop Distance travelled when the element was no longer detected.
+ * @return The width of the element, 0 if the robot did not move forward over it.
+ */
+uint32_t get_barcode_element_width(uint32_t time_start, uint32_t time_stop, int32_t position_start, int32_t position_stop)
+{
+    if (!barcode_width_from_encoder)
+    {
+        return time_stop - time_start;
+    }
+
+    // A negative distance means the encoder counts were reset during the element
+    if (position_stop < position_start)
+    {
+        return 0;
+    }
+
+    return position_stop - position_start;
+}
+
+/**
+ * @brief Measures and records barcode data.
+ *
+ * @details
+ * This function records the width of the element that just ended in barcode_window, see get_barcode_element_width().
+ * Whether the element is narrow or wide is decided later, per symbol, by classify_barcode_symbol().
+ * Spaces before the first bar are not part of a barcode and are skipped.
+ * Once the window is full, a space more than BARCODE_QUIET_ZONE_RATIO times wider than the average element in it
+ * is the quiet zone between two barcodes, or between two passes over the same barcode. The window is emptied,
+ * so the elements of the last pass cannot make up a false start delimiter with the first elements of the next pass.
+ *
+ * @param is_black true if the element that ended is a bar, false if it is a space.
+ */
+void measure_barcode_reading(bool is_black)
+{
+    // When the barcode is black, record its width
+    if (is_black)
+    {
+        add_barcode_element(get_barcode_element_width(black_barcode_time_start, black_barcode_time_stop,
+                                                      black_barcode_position_start, black_barcode_position_stop),
+                            true);
     }
-    // When the barcode is white, measure it using 2
-    else if (strcmp(color, "white") == 0)
+    // When the barcode is white, record its width once the first bar has been seen
+    else if (barcode_window_count > 0)
     {
-        // Calculate the time difference to get the total time the barcode is white
-        bar_detected_duration = white_barcode_timer_stop - white_barcode_timer_start;
+        uint32_t width = get_barcode_element_width(white_barcode_timer_start, white_barcode_timer_stop,
+                                                   white_barcode_position_start, white_barcode_position_stop);
 
-        // When the barcode has not started. 
-        if (barcode_counter == 0)
+        // Start over after a quiet zone
+        uint64_t window_width = 0;
+        for (int i = 0; i < barcode_window_count; i++)
         {
-            // Barcode has not started yet
+            window_width += barcode_window[i].width;
         }
-        else
+        if (barcode_window_count == BARCODE_WINDOW_SIZE &&
+            (uint64_t)width * BARCODE_WINDOW_SIZE > window_width * BARCODE_QUIET_ZONE_RATIO)
         {
-            // Determine the thickness of the barcode
-            // When the barcode is thick
-            if (bar_detected_duration / bar_thickness_divider > 0)
-            {
-                barcode_array[barcode_counter] = 222;
-                barcode_counter++;
-            }
-            // When the barcode is thin
-            else
-            {
-                barcode_array[barcode_counter] = 2;
-                barcode_counter++;
-            }
+            barcode_window_count = 0;
+            barcode_window_index = 0;
+            reset_barcode_decoder();
+            return;
         }
+
+        add_barcode_element(width, false);
+    }
+}
+
+/**
+ * @brief Add an edge to the barcode edge buffer.
+ *
+ * @details
+ * Only called from the barcode interrupt, or from the ADC timer when the barcode is read from the
+ * analog output (never both). The entry is written before the head is advanced,
+ * so the main loop never sees a half written edge. When the buffer is full the edge is dropped
+ * and counted in barcode_edge_overruns.
+ *
+ * @param timestamp Time of the edge from time_us_32().
+ * @param position Distance travelled at the edge from get_encoder_position().
+ * @param is_black true if the sensor changed to black.
+ * @return true if the edge was stored, false if the buffer was full.
+ */
+bool push_barcode_edge(uint32_t timestamp, int32_t position, bool is_black)
+{
+    uint32_t head = barcode_edge_head;
+
+    // Drop the edge if the main loop has not caught up yet
+    if (head - barcode_edge_tail >= BARCODE_EDGE_BUFFER_SIZE)
+    {
+        barcode_edge_overruns++;
+        return false;
     }
+
+    // Store the edge, then publish it by advancing the head
+    barcode_edge_buffer[head & BARCODE_EDGE_BUFFER_MASK].timestamp = timestamp;
+    barcode_edge_buffer[head & BARCODE_EDGE_BUFFER_MASK].position = position;
+    barcode_edge_buffer[head & BARCODE_EDGE_BUFFER_MASK].is_black = is_black;
+    __dmb();
+    barcode_edge_head = head + 1;
+
+    return true;
+}
+
+/**
+ * @brief Take the oldest edge out of the barcode edge buffer.
+ *
+ * @details
+ * Only called from thread context. The entry is copied out before the tail is advanced,
+ * so the interrupt cannot overwrite it while it is being read.
+ *
+ * @param edge Pointer to where the edge is copied.
+ * @return true if an edge was read, false if the buffer was empty.
+ */
+bool pop_barcode_edge(barcode_edge_t *edge)
+{
+    uint32_t tail = barcode_edge_tail;
+
+    // Nothing to read when the interrupt has not written anything new
+    if (tail == barcode_edge_head)
+    {
+        return false;
+    }
+
+    // Copy the edge, then release the slot by advancing the tail
+    __dmb();
+    *edge = barcode_edge_buffer[tail & BARCODE_EDGE_BUFFER_MASK];
+    __dmb();
+    barcode_edge_tail = tail + 1;
+
+    return true;
 }
 
 /**
  * @brief Function to Barcode Sensor Interrupt Handler
  *
  * @details
- * If events is GPIO_IRQ_EDGE_RISE, then the barcode is black.
- * if the barcode is black, then measure the previous white barcode and decode it.
+ * The interrupt only records the time, the distance travelled and the new colour of the edge in the barcode edge buffer.
+ * All the measuring and decoding is done by process_barcode_edges() outside of the interrupt,
+ * so no edges are missed while a barcode is being decoded or printed.
  * 
- * If events is GPIO_IRQ_EDGE_FALL, then the barcode is white.
- * If the barcode is white, then measure the previous black barcode and decode it.
+ * The new colour comes from gpio_edge_level(): a rising edge means the barcode is black, a falling edge white.
+ * If both edges were latched, only the level the pin ended up at is pushed, so no element of zero width
+ * is made up from the two.
  * 
- * @param gpio The GPIO pin.
- * @param events The type of GPIO event.
+ * @param pin The GPIO pin.
+ * @param edge Mask of the edges seen on the pin.
+ * @param timestamp Time of the edge from time_us_32().
  */
-void handle_barcode_sensor_events(uint gpio, uint32_t events)
+void handle_barcode_sensor_events(uint pin, uint32_t edge, uint32_t timestamp)
 {
     if (toggleBarcode == true)
     {
-        // When the barcode detected is black
-        if (events == GPIO_IRQ_EDGE_RISE && gpio == BARCODE_SENSOR_PIN)
-        {
-            // Start the timer for black by storing the current time as this is when the black is first detected
-            black_barcode_time_start = time_us_32();
+        // Sample the wheel encoders at the edge and record the colour the sensor changed to
+        push_barcode_edge(timestamp, get_encoder_position(timestamp), gpio_edge_level(pin, edge));
+    }
 
-            // Stop the timer for white by storing the current time as this is when white is no logner detected
-            white_barcode_timer_stop = time_us_32();
+    // Update the interrupt statistics
+    barcode_isr_count++;
+    barcode_isr_last_duration_us = time_us_32() - timestamp;
+    if (barcode_isr_last_duration_us > barcode_isr_max_duration_us)
+    {
+        barcode_isr_max_duration_us = barcode_isr_last_duration_us;
+    }
+}
 
-            // Start scanning for barcode
-            if (barcode_scanning_start == false)
-            {
-                barcode_scanning_start = true;
-            }
+/**
+ * @brief Get the shortest pulse the barcode glitch filter lets through.
+ *
+ * @details
+ * The glitch width is the time the robot takes to travel barcode_glitch_distance at its current speed,
+ * so it shrinks as the robot speeds up and a real narrow bar is never mistaken for a glitch.
+ * The time per encoder tick of each wheel is the time between its last two encoder edges, or the time
+ * since its last edge if that is longer (the wheel is slowing down or has stopped).
+ * The result is kept between barcode_glitch_min_us and barcode_glitch_max_us.
+ *
+ * @param now Time to work out the speed at, from time_us_32().
+ * @return The glitch width in microseconds.
+ */
+uint32_t get_barcode_glitch_width(uint32_t now)
+{
+    // Without a measured period on both wheels the speed is unknown, so use the widest filter
+    uint32_t left_period = left_encoder_period;
+    uint32_t right_period = right_encoder_period;
+    if (left_period == 0 || right_period == 0)
+    {
+        return barcode_glitch_max_us;
+    }
 
-            //Measure the previous white barcode
-            measure_barcode_reading("white");
-        }
-        // When the barcode detected is white
-        else if (events == GPIO_IRQ_EDGE_FALL && gpio == BARCODE_SENSOR_PIN)
+    // A wheel that has not ticked for longer than its period is going slower than its period says
+    int32_t left_elapsed = (int32_t)(now - left_last_pulse_time);
+    int32_t right_elapsed = (int32_t)(now - right_last_pulse_time);
+    if (left_elapsed > (int32_t)left_period)
+    {
+        left_period = left_elapsed;
+    }
+    if (right_elapsed > (int32_t)right_period)
+    {
+        right_period = right_elapsed;
+    }
+
+    // Time to travel the glitch distance at the average time per tick of the two wheels
+    uint64_t width = (uint64_t)barcode_glitch_distance * ((left_period + right_period) / 2) / ENCODER_POSITION_SCALE;
+    if (width < barcode_glitch_min_us)
+    {
+        return barcode_glitch_min_us;
+    }
+    if (width > barcode_glitch_max_us)
+    {
+        return barcode_glitch_max_us;
+    }
+
+    return width;
+}
+
+/**
+ * @brief Pass an edge to the decoder.
+ *
+ * @details
+ * If the edge is black, then measure the previous white barcode.
+ * If the edge is white, then measure the previous black barcode.
+ * Every measured element is decoded as it arrives by decode_barcode().
+ *
+ * @param edge The edge that passed the glitch filter.
+ */
+void release_barcode_edge(const barcode_edge_t *edge)
+{
+    barcode_filtered_is_black = edge->is_black;
+
+    // When the barcode detected is black
+    if (edge->is_black)
+    {
+        // Start the timer for black as this is when the black is first detected
+        black_barcode_time_start = edge->timestamp;
+        black_barcode_position_start = edge->position;
+
+        // Stop the timer for white as this is when white is no longer detected
+        white_barcode_timer_stop = edge->timestamp;
+        white_barcode_position_stop = edge->position;
+
+        // Measure the previous white barcode
+        measure_barcode_reading(false);
+    }
+    // When the barcode detected is white
+    else
+    {
+        // Start the timer for white as this is when the white is first detected
+        white_barcode_timer_start = edge->timestamp;
+        white_barcode_position_start = edge->position;
+
+        // Stop the timer for black because barcode detected is no longer black.
+        black_barcode_time_stop = edge->timestamp;
+        black_barcode_position_stop = edge->position;
+
+        // Measure the previous black barcode
+        measure_barcode_reading(true);
+    }
+}
+
+/**
+ * @brief Run an edge through the barcode glitch filter.
+ *
+ * @details
+ * Every edge is held in barcode_pending_edge until the pulse that starts at it is known to be real:
+ * 1) If the next edge comes within the glitch width, the pulse between the two edges is a glitch.
+ *    Both edges are dropped, so the element before the pulse carries on as if the pulse never happened.
+ * 2) Otherwise the held edge is passed to the decoder and the new edge is held in its place.
+ * process_barcode_edges() also passes the held edge on once the glitch width has gone by with no new edge.
+ * Unlike a lockout, nothing is ignored after a real edge, so a narrow bar right after it is still seen.
+ *
+ * @param edge The edge taken out of the barcode edge buffer.
+ */
+void filter_barcode_edge(const barcode_edge_t *edge)
+{
+    if (!barcode_glitch_filter_enabled)
+    {
+        release_barcode_edge(edge);
+        return;
+    }
+
+    // An edge to the colour the sensor is already on does not start a new element
+    bool is_black = barcode_edge_pending ? barcode_pending_edge.is_black : barcode_filtered_is_black;
+    if (edge->is_black == is_black)
+    {
+        return;
+    }
+
+    if (barcode_edge_pending)
+    {
+        // The pulse since the held edge is too short to be a bar or a space, so merge it away
+        if (edge->timestamp - barcode_pending_edge.timestamp < get_barcode_glitch_width(edge->timestamp))
         {
-            // Start the timer for white by storing the current time as this is when the white is first detected
-            white_barcode_time_start = time_us_32();
-            
-            // Stop the timer for black because barcode detected is no longer black.
-            black_barcode_time_stop = time_us_32();
-
-            // Measure the previous black barcode
-            measure_barcode_reading("black");
+            barcode_edge_pending = false;
+            barcode_glitches_rejected++;
+            return;
         }
 
-        // Try to decode the barcode based on what is read.
-        decode_barcode();
+        // The pulse is real, so its starting edge can be decoded
+        release_barcode_edge(&barcode_pending_edge);
     }
+
+    // Hold the new edge until the pulse after it is known to be real
+    barcode_pending_edge = *edge;
+    barcode_edge_pending = true;
 }
 
 /**
- * @brief Function to update isLeftLineBlack and isRightLineBlack boolean value based on the event that occured. 
+ * @brief Filter and decode every barcode edge waiting in the barcode edge buffer.
  *
  * @details
- * If events is GPIO_IRQ_EDGE_RISE, then the line is black
- * If events is GPIO_IRQ_EDGE_FALL, then the line is white
- * Update the isLeftLineBlack and isRightLineBlack variables
+ * Called from the main loop. Every edge goes through filter_barcode_edge() first.
+ * Once the buffer is empty, a held edge older than the glitch width (plus the time edges can take
+ * to reach the buffer) cannot be a glitch any more and is passed to the decoder.
  */
-void handle_lines_sensor_events(uint gpio, uint32_t events)
+void process_barcode_edges()
 {
-    // When the right line is black
-    if (events == GPIO_IRQ_EDGE_RISE && gpio == RIGHT_LINE_SENSOR_PIN)
+    barcode_edge_t edge;
+
+    while (pop_barcode_edge(&edge))
+    {
+        filter_barcode_edge(&edge);
+    }
+
+    // Release the held edge once no edge can still arrive to cancel it
+    if (barcode_edge_pending)
     {
-        isRightLineBlack = true;
+        uint32_t now = time_us_32();
+        if (now - barcode_pending_edge.timestamp >= get_barcode_glitch_width(now) + barcode_edge_latency_us)
+        {
+            barcode_edge_pending = false;
+            release_barcode_edge(&barcode_pending_edge);
+        }
     }
-    // When the left line is black
-    else if (events == GPIO_IRQ_EDGE_RISE && gpio == LEFT_LINE_SENSOR_PIN)
+}
+
+/**
+ * @brief Function to print the barcode edge buffer and interrupt statistics
+ */
+void retrieve_barcode_edge_statistics()
+{
+    printf("Barcode edges: %u, overruns: %u\n", barcode_edge_head, barcode_edge_overruns);
+    printf("Barcodes decoded: %u, check character failures: %u\n", barcode_messages_decoded, barcode_check_failures);
+    printf("Barcodes dropped for low confidence: %u\n", barcode_low_confidence_drops);
+    printf("Barcode glitches rejected: %u\n", barcode_glitches_rejected);
+    printf("Barcode interrupt: count %u, last %u us, max %u us\n", barcode_isr_count, barcode_isr_last_duration_us, barcode_isr_max_duration_us);
+}
+
+/**
+ * @brief Function to update is_left_line_black and is_right_line_black based on the edge that occured.
+ *
+ * @details
+ * Called from the GPIO interrupt through gpio_dispatch.h. Every edge is debounced by its timestamp.
+ * If the accepted level is high, then the line is black, otherwise it is white.
+ * The change is posted as an event for dispatch_events(), together with EVENT_BOTH_LINES_BLACK
+ * when both sensors are on black.
+ *
+ * @param pin The line sensor pin.
+ * @param edge Mask of the edges seen on the pin.
+ * @param timestamp Time of the edge from time_us_32().
+ */
+void handle_line_sensor_event(uint pin, uint32_t edge, uint32_t timestamp)
+{
+    bool level = gpio_edge_level(pin, edge);
+
+    // When the left line changes colour
+    if (pin == left_sensor_pin && debounce_edge(&left_line_debounce, timestamp, level))
     {
-        isLeftLineBlack = true;
+        is_left_line_black = left_line_debounce.level;
+        post_event(is_left_line_black ? EVENT_LEFT_LINE_BLACK : EVENT_LEFT_LINE_WHITE, timestamp);
     }
-    // When the right line is white
-    else if (events == GPIO_IRQ_EDGE_FALL && gpio == RIGHT_LINE_SENSOR_PIN)
+    // When the right line changes colour
+    else if (pin == right_sensor_pin && debounce_edge(&right_line_debounce, timestamp, level))
     {
-        isRightLineBlack = false;
+        is_right_line_black = right_line_debounce.level;
+        post_event(is_right_line_black ? EVENT_RIGHT_LINE_BLACK : EVENT_RIGHT_LINE_WHITE, timestamp);
     }
-    // When the left line is white
-    else if (events == GPIO_IRQ_EDGE_FALL && gpio == LEFT_LINE_SENSOR_PIN)
+    else
     {
-        isLeftLineBlack = false;
+        return;
+    }
+
+    // Check if both left and right line sensors are black
+    if (is_left_line_black && is_right_line_black)
+    {
+        post_event(EVENT_BOTH_LINES_BLACK, timestamp);
     }
 }
 
+/**
+ * @brief Function to update the line sensor values when a line sensor settled inside its dead-time.
+ *
+ * @details
+ * Called from the main loop, with interrupts disabled while the debounce state is updated and the events posted.
+ * Every settled change is posted like in handle_line_sensor_event(), together with EVENT_BOTH_LINES_BLACK
+ * when both sensors are on black.
+ */
+void settle_line_sensors()
+{
+    uint32_t interrupt_state = save_and_disable_interrupts();
+    uint32_t now = time_us_32();
+    bool changed = false;
+
+    if (debounce_settle(&left_line_debounce, now))
+    {
+        is_left_line_black = left_line_debounce.level;
+        post_event(is_left_line_black ? EVENT_LEFT_LINE_BLACK : EVENT_LEFT_LINE_WHITE, now);
+        changed = true;
+    }
+    if (debounce_settle(&right_line_debounce, now))
+    {
+        is_right_line_black = right_line_debounce.level;
+        post_event(is_right_line_black ? EVENT_RIGHT_LINE_BLACK : EVENT_RIGHT_LINE_WHITE, now);
+        changed = true;
+    }
+
+    // Check if both left and right line sensors are black
+    if (changed && is_left_line_black && is_right_line_black)
+    {
+        post_event(EVENT_BOTH_LINES_BLACK, now);
+    }
+
+    restore_interrupts(interrupt_state);
+}
+
 /**
  * @brief Function to prints value for left and right to see if it detects black
  *
@@ -683,8 +956,8 @@ void handle_lines_sensor_events(uint gpio, uint32_t events)
  */
 void retrieve_line_sensor_value()
 {
-    printf("Left Line Sensor: %s\n", isLeftLineBlack ? "true" : "false");
-    printf("Right Line Sensor: %s\n", isRightLineBlack ? "true" : "false");
+    printf("Left Line Sensor: %s\n", is_left_line_black ? "true" : "false");
+    printf("Right Line Sensor: %s\n", is_right_line_black ? "true" : "false");
 }
 
 /**
@@ -692,18 +965,19 @@ void retrieve_line_sensor_value()
  *
  * @details
  * This function initialises the GPIO pins for the left line sensor,
- * right line sensor and barcode sensor.
+ * right line sensor and barcode sensor, and registers the line sensor interrupt handler.
+ * The barcode interrupt is only enabled by enable_barcode_interrupt(), as the barcode can also be read with the ADC.
  *
  * @param left_line_sensor_pin GPIO pin for the left line sensor.
  * @param right_line_sensor_pin GPIO pin for the right line sensor.
- * @param barcode_sensor_pin GPIO pin for the barcode sensor.
+ * @param barcode_pin GPIO pin for the barcode sensor.
  */
-void initialise_infrared(int8_t left_line_sensor_pin, int8_t right_line_sensor_pin, int8_t barcode_sensor_pin)
+void initialise_infrared(int8_t left_line_sensor_pin, int8_t right_line_sensor_pin, int8_t barcode_pin)
 {
     // Set the GPIO pins
     left_sensor_pin = left_line_sensor_pin;
     right_sensor_pin = right_line_sensor_pin;
-    barcode_sensor_pin = barcode_sensor_pin;
+    barcode_sensor_pin = barcode_pin;
 
     // Initialize GPIO pins
     gpio_init(left_line_sensor_pin);
@@ -714,4 +988,20 @@ void initialise_infrared(int8_t left_line_sensor_pin, int8_t right_line_sensor_p
     gpio_set_dir(left_line_sensor_pin, GPIO_IN);
     gpio_set_dir(right_line_sensor_pin, GPIO_IN);
     gpio_set_dir(barcode_sensor_pin, GPIO_IN);
+
+    // Start debouncing the line sensors from their current colour and handle their edges
+    is_left_line_black = gpio_get(left_sensor_pin);
+    is_right_line_black = gpio_get(right_sensor_pin);
+    debounce_init(&left_line_debounce, DEBOUNCE_LINE_SENSOR_DEAD_TIME_US, is_left_line_black, time_us_32());
+    debounce_init(&right_line_debounce, DEBOUNCE_LINE_SENSOR_DEAD_TIME_US, is_right_line_black, time_us_32());
+    register_gpio_handler(left_sensor_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, handle_line_sensor_event);
+    register_gpio_handler(right_sensor_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, handle_line_sensor_event);
+}
+
+/**
+ * @brief Function to read the barcode from the digital output of the IR sensor with the GPIO interrupt.
+ */
+void enable_barcode_interrupt()
+{
+    register_gpio_handler(barcode_sensor_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, handle_barcode_sensor_events);
 }
\ No newline at end of file
@@ -0,0 +1,323 @@
+/**
+ * @file ir_adc.h
+ * @brief Header file for high rate analog sampling of the barcode and line IR sensors.
+ * @details
+ * The ADC runs free in round robin over the barcode sensor and the two line sensors, so each of them is
+ * sampled at IR_ADC_SAMPLE_RATE_HZ, and a DMA channel copies every sample into a ring buffer,
+ * so no CPU time is spent per sample. Sample n of a DMA run belongs to channel n % IR_ADC_CHANNEL_COUNT.
+ *
+ * A repeating timer walks the new samples. Barcode samples go through a hysteresis threshold and every
+ * black/white change is pushed into the barcode edge buffer with the time of the sample that crossed the
+ * threshold. The barcode decoder then works exactly as it does with the digital sensor output, but with
+ * narrow bars resolved to IR_ADC_SAMPLE_PERIOD_US. Line sensor samples are averaged over each timer
+ * interval into ir_adc_left_line_value and ir_adc_right_line_value for the line follower, and the barcode
+ * sensor, which sits at the front centre of the robot, into ir_adc_barcode_value for the junction detector.
+ *
+ * The analog outputs are only used when BARCODE_USE_ADC or LINE_USE_ADC is set and the outputs are wired
+ * to GP26 to GP28, see below. Otherwise the digital outputs of infrared.h are used and the ADC is not started.
+ *
+ * @date November 14, 2023
+ */
+
+#ifndef IR_ADC_H
+#define IR_ADC_H
+
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+
+// Analog inputs of the IR sensors, both off by default. The robot as built only wires the digital outputs
+// of the sensors, to GP6 (left line), GP7 (right line) and GP8 (barcode). Before turning a flag on, also wire
+// the analog output (A0) of the sensor to its ADC pin below: the barcode sensor to GP26, the line sensors to GP27 and GP28.
+#ifndef BARCODE_USE_ADC
+#define BARCODE_USE_ADC 0               // Set to 1 to read the barcode from the analog output of the IR sensor on GP26
+#endif
+#ifndef LINE_USE_ADC
+#define LINE_USE_ADC 0                  // Set to 1 to follow lines and detect junctions from the analog line sensor outputs on GP27 and GP28
+#endif
+#define IR_ADC_ENABLED (BARCODE_USE_ADC || LINE_USE_ADC) // The ADC, its DMA and the IR calibration only run when an analog input is wired
+
+// Define the ADC inputs, in round robin order (ascending channel numbers)
+#define IR_ADC_PIN 26                   // GPIO pin connected to the analog output of the barcode IR sensor
+#define IR_ADC_CHANNEL 0                // ADC channel of IR_ADC_PIN
+#define IR_ADC_LEFT_LINE_PIN 27         // GPIO pin connected to the analog output of the left line sensor
+#define IR_ADC_LEFT_LINE_CHANNEL 1      // ADC channel of IR_ADC_LEFT_LINE_PIN
+#define IR_ADC_RIGHT_LINE_PIN 28        // GPIO pin connected to the analog output of the right line sensor
+#define IR_ADC_RIGHT_LINE_CHANNEL 2     // ADC channel of IR_ADC_RIGHT_LINE_PIN
+#define IR_ADC_CHANNEL_COUNT 3
+#define IR_ADC_ROUND_ROBIN_MASK ((1 << IR_ADC_CHANNEL) | (1 << IR_ADC_LEFT_LINE_CHANNEL) | (1 << IR_ADC_RIGHT_LINE_CHANNEL))
+
+// Define the sampling rate
+#define IR_ADC_CLOCK_HZ 48000000        // ADC clock
+#define IR_ADC_SAMPLE_RATE_HZ 20000     // Samples per second of each channel
+#define IR_ADC_SAMPLE_PERIOD_US (1000000 / IR_ADC_SAMPLE_RATE_HZ)
+#define IR_ADC_PROCESS_INTERVAL_MS 10   // How often the samples are thresholded
+
+// Define the DMA ring buffer, the byte size must be a power of 2 for the DMA ring wrap
+#define IR_ADC_BUFFER_SIZE 4096         // Samples in the ring buffer (about 68 ms at 3 x 20 kHz)
+#define IR_ADC_BUFFER_MASK (IR_ADC_BUFFER_SIZE - 1)
+#define IR_ADC_RING_BITS 13             // log2 of the buffer size in bytes (4096 samples * 2 bytes)
+#define IR_ADC_TRANSFER_COUNT 0xFFFFFFFF // Samples per DMA run, about 19 hours at 3 x 20 kHz
+
+// Default thresholds, an ADC value above IR_ADC_THRESHOLD_HIGH is black and below IR_ADC_THRESHOLD_LOW is white
+#define IR_ADC_THRESHOLD_HIGH 1200
+#define IR_ADC_THRESHOLD_LOW 800
+
+// DMA ring buffer, aligned to its size so the DMA write address can wrap around it
+uint16_t ir_adc_buffer[IR_ADC_BUFFER_SIZE] __attribute__((aligned(IR_ADC_BUFFER_SIZE * sizeof(uint16_t))));
+int ir_adc_dma_channel = -1;                    // DMA channel claimed for the ADC
+uint32_t ir_adc_start_time = 0;                 // Time the first sample of the DMA run was taken
+uint32_t ir_adc_samples_read = 0;               // Number of samples of the DMA run already thresholded
+uint32_t ir_adc_overruns = 0;                   // Number of samples lost because they were not read in time
+volatile bool ir_adc_paused = false;            // Flag set while the ADC and its DMA are stopped
+uint16_t ir_adc_threshold_high = IR_ADC_THRESHOLD_HIGH; // ADC value above which the sensor is on black
+uint16_t ir_adc_threshold_low = IR_ADC_THRESHOLD_LOW;   // ADC value below which the sensor is on white
+bool ir_adc_is_black = false;                   // Colour under the sensor after the last sample
+volatile uint16_t ir_adc_barcode_value = 0;     // Average barcode sensor sample over the last interval
+volatile uint16_t ir_adc_left_line_value = 0;   // Average left line sensor sample over the last interval
+volatile uint16_t ir_adc_right_line_value = 0;  // Average right line sensor sample over the last interval
+volatile uint32_t ir_adc_intervals = 0;         // Number of intervals averaged, changes when the values above are new
+struct repeating_timer ir_adc_timer;            // Timer that thresholds the new samples
+
+// Function prototypes
+void start_ir_adc_capture();
+void pause_ir_adc();
+void resume_ir_adc();
+void initialise_ir_adc();
+uint32_t get_ir_adc_samples_written();
+bool threshold_ir_adc_sample(uint16_t sample, bool *is_black);
+bool process_ir_adc_samples(struct repeating_timer *t);
+
+#endif // IR_ADC_H
+
+/**
+ * @brief Start a new DMA run that copies ADC samples into ir_adc_buffer.
+ */
+void start_ir_adc_capture()
+{
+    // Stop the ADC and clear old samples before the DMA is pointed at the start of the buffer
+    adc_run(false);
+    adc_fifo_drain();
+
+    dma_channel_config config = dma_channel_get_default_config(ir_adc_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);          // Always read the ADC FIFO
+    channel_config_set_write_increment(&config, true);          // Move along the buffer
+    channel_config_set_ring(&config, true, IR_ADC_RING_BITS);   // Wrap the write address around the buffer
+    channel_config_set_dreq(&config, DREQ_ADC);                 // Copy a sample whenever the ADC has one
+
+    dma_channel_configure(ir_adc_dma_channel, &config, ir_adc_buffer, &adc_hw->fifo, IR_ADC_TRANSFER_COUNT, true);
+
+    // Start the ADC running free from the barcode channel and remember when the first sample was taken
+    adc_select_input(IR_ADC_CHANNEL);
+    ir_adc_samples_read = 0;
+    ir_adc_start_time = time_us_32();
+    adc_run(true);
+}
+
+/**
+ * @brief Stop the ADC and its DMA, for as long as the samples could not be read in time.
+ *
+ * @details
+ * Called from thread context. The samples not yet processed are processed first, so no edge is lost
+ * before the pause, and the timer leaves the DMA alone until resume_ir_adc() is called.
+ */
+void pause_ir_adc()
+{
+    uint32_t interrupts = save_and_disable_interrupts();
+
+    process_ir_adc_samples(&ir_adc_timer);
+    ir_adc_paused = true;
+    adc_run(false);
+    dma_channel_abort(ir_adc_dma_channel);
+
+    restore_interrupts(interrupts);
+}
+
+/**
+ * @brief Start the ADC and its DMA again after pause_ir_adc().
+ */
+void resume_ir_adc()
+{
+    uint32_t interrupts = save_and_disable_interrupts();
+
+    start_ir_adc_capture();
+    ir_adc_paused = false;
+
+    restore_interrupts(interrupts);
+}
+
+/**
+ * @brief Initialise the ADC, the DMA channel and the timer for the barcode and line IR sensors.
+ *
+ * @details
+ * Only the pins of the analog inputs turned on are handed to the ADC. The round robin still samples
+ * all three channels, so the buffer layout stays the same, but the values of the others are not used.
+ */
+void initialise_ir_adc()
+{
+    // Set up the ADC for the IR sensors
+    adc_init();
+#if BARCODE_USE_ADC
+    adc_gpio_init(IR_ADC_PIN);
+#endif
+#if LINE_USE_ADC
+    adc_gpio_init(IR_ADC_LEFT_LINE_PIN);
+    adc_gpio_init(IR_ADC_RIGHT_LINE_PIN);
+#endif
+    adc_select_input(IR_ADC_CHANNEL);
+    adc_set_round_robin(IR_ADC_ROUND_ROBIN_MASK);
+
+    // Put every sample in the FIFO and ask the DMA for every sample, full 12 bit samples
+    adc_fifo_setup(true, true, 1, false, false);
+
+    // One conversion of each channel every IR_ADC_CLOCK_HZ / IR_ADC_SAMPLE_RATE_HZ ADC clocks
+    adc_set_clkdiv((IR_ADC_CLOCK_HZ / (IR_ADC_SAMPLE_RATE_HZ * IR_ADC_CHANNEL_COUNT)) - 1);
+
+    // Claim a DMA channel and start copying samples
+    ir_adc_dma_channel = dma_claim_unused_channel(true);
+    start_ir_adc_capture();
+
+#if BARCODE_USE_ADC
+    // Edges reach the barcode edge buffer up to one processing interval after they happened
+    barcode_edge_latency_us = IR_ADC_PROCESS_INTERVAL_MS * 1000;
+#endif
+
+    // Threshold the new samples regularly, well before the ring buffer wraps
+    add_repeating_timer_ms(IR_ADC_PROCESS_INTERVAL_MS, process_ir_adc_samples, NULL, &ir_adc_timer);
+}
+
+/**
+ * @brief Get the number of samples the DMA has written since the run started.
+ *
+ * @return The number of samples written.
+ */
+uint32_t get_ir_adc_samples_written()
+{
+    return IR_ADC_TRANSFER_COUNT - dma_channel_hw_addr(ir_adc_dma_channel)->transfer_count;
+}
+
+/**
+ * @brief Apply the hysteresis threshold to one sample.
+ *
+ * @details
+ * The colour only changes to black above ir_adc_threshold_high and only back to white
+ * below ir_adc_threshold_low, so noise around a single threshold does not create edges.
+ *
+ * @param sample The ADC sample.
+ * @param is_black Pointer to the current colour, updated when the colour changes.
+ * @return true if the sample changed the colour, false otherwise.
+ */
+bool threshold_ir_adc_sample(uint16_t sample, bool *is_black)
+{
+    // White to black
+    if (!*is_black && sample > ir_adc_threshold_high)
+    {
+        *is_black = true;
+        return true;
+    }
+    // Black to white
+    if (*is_black && sample < ir_adc_threshold_low)
+    {
+        *is_black = false;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Process the samples written since the last call.
+ *
+ * @details
+ * Called by a repeating timer every IR_ADC_PROCESS_INTERVAL_MS.
+ * 1) Barcode samples are thresholded and the edges pushed to the barcode decoder. Each edge is timestamped
+ *    with the time of the sample that crossed the threshold, worked out from the start of the DMA run and the sample rate.
+ * 2) Samples of every channel are averaged into ir_adc_barcode_value, ir_adc_left_line_value and ir_adc_right_line_value.
+ * If the timer was held up for longer than the ring buffer, the oldest samples are skipped and counted.
+ * Nothing is done while the ADC is paused by pause_ir_adc().
+ *
+ * @param t A pointer to the repeating timer structure.
+ * @return true to keep the timer running.
+ */
+bool process_ir_adc_samples(struct repeating_timer *t)
+{
+    // Nothing is sampled while the ADC is paused
+    if (ir_adc_paused)
+    {
+        return true;
+    }
+
+    uint32_t samples_written = get_ir_adc_samples_written();
+
+    // Skip samples that have already been overwritten
+    if (samples_written - ir_adc_samples_read > IR_ADC_BUFFER_SIZE)
+    {
+        ir_adc_overruns += samples_written - ir_adc_samples_read - IR_ADC_BUFFER_SIZE;
+        ir_adc_samples_read = samples_written - IR_ADC_BUFFER_SIZE;
+    }
+
+    uint32_t barcode_sum = 0;
+    uint32_t barcode_count = 0;
+    uint32_t left_line_sum = 0;
+    uint32_t right_line_sum = 0;
+    uint32_t left_line_count = 0;
+    uint32_t right_line_count = 0;
+
+    while (ir_adc_samples_read != samples_written)
+    {
+        uint16_t sample = ir_adc_buffer[ir_adc_samples_read & IR_ADC_BUFFER_MASK];
+
+        switch (ir_adc_samples_read % IR_ADC_CHANNEL_COUNT)
+        {
+        case IR_ADC_CHANNEL:
+            barcode_sum += sample;
+            barcode_count++;
+#if BARCODE_USE_ADC
+            if (threshold_ir_adc_sample(sample, &ir_adc_is_black) && toggleBarcode)
+            {
+                // Time of this sample
+                uint32_t timestamp = ir_adc_start_time + (ir_adc_samples_read / IR_ADC_CHANNEL_COUNT) * IR_ADC_SAMPLE_PERIOD_US;
+                push_barcode_edge(timestamp, get_encoder_position(timestamp), ir_adc_is_black);
+            }
+#endif
+            break;
+
+        case IR_ADC_LEFT_LINE_CHANNEL:
+            left_line_sum += sample;
+            left_line_count++;
+            break;
+
+        case IR_ADC_RIGHT_LINE_CHANNEL:
+            right_line_sum += sample;
+            right_line_count++;
+            break;
+        }
+
+        ir_adc_samples_read++;
+    }
+
+    // Average the sensors over this interval
+    if (barcode_count > 0)
+    {
+        ir_adc_barcode_value = barcode_sum / barcode_count;
+    }
+    if (left_line_count > 0)
+    {
+        ir_adc_left_line_value = left_line_sum / left_line_count;
+    }
+    if (right_line_count > 0)
+    {
+        ir_adc_right_line_value = right_line_sum / right_line_count;
+    }
+    ir_adc_intervals++;
+
+    // Start a new run once the DMA has written all its samples
+    if (!dma_channel_is_busy(ir_adc_dma_channel))
+    {
+        start_ir_adc_capture();
+    }
+
+    return true;
+}
@@ -0,0 +1,479 @@
+/**
+ * @file ir_calibration.h
+ * @brief Header file for calibrating the thresholds of the IR sensors.
+ * @details
+ * The ADC values of the IR sensors on black and white change with the ambient light and the surface,
+ * so the thresholds are measured instead of hard-coded. Three things keep them right:
+ * 1) A calibration sweep spins the robot on the spot for IR_CALIBRATION_SWEEP_MS, so every sensor passes
+ *    over the line and the floor, and tracks the lowest (white) and highest (black) value of each sensor.
+ * 2) The range of each sensor gives its thresholds: the barcode threshold sits in the middle of the range with
+ *    a hysteresis of the contrast / IR_CALIBRATION_HYSTERESIS_DIVISOR either side, and the white and black
+ *    levels of the line sensors, and of the barcode sensor as the centre sensor of the junction detector,
+ *    sit just inside their range. The ranges are stored in the last flash sector once the robot has come
+ *    to rest, and loaded at start up, so the sweep only has to be run again when the site changes.
+ * 3) While the robot drives, a running min/max of every sensor follows new extremes quickly and drifts
+ *    slowly back towards the current value otherwise, and the thresholds are derived from it again every second.
+ * A sensor whose range is narrower than IR_CALIBRATION_MIN_CONTRAST has not seen both colours yet,
+ * so its thresholds are left as they are.
+ *
+ * The sensors are read from the interval averages of ir_adc.h, which smooth out single noisy samples,
+ * so the calibration only runs when an analog input is wired, see IR_ADC_ENABLED.
+ * The digital outputs of the line sensors are set by the comparator on the sensor board and cannot be calibrated here.
+ *
+ * @date November 20, 2023
+ */
+
+#ifndef IR_CALIBRATION_H
+#define IR_CALIBRATION_H
+
+#include <stddef.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+// Define where the calibration is stored, the last sector of the flash is clear of the program
+#define IR_CALIBRATION_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define IR_CALIBRATION_MAGIC 0x4C414352 // "RCAL"
+#define IR_CALIBRATION_VERSION 1
+
+// Define the calibration sweep
+#define IR_CALIBRATION_SWEEP_MS 4000            // How long the robot spins over the surface
+#define IR_CALIBRATION_SWEEP_SPEED 5000         // PWM level of both wheels while spinning
+#define IR_CALIBRATION_SAVE_REST_MS 500         // Time without an encoder edge before the robot is at rest for a save
+
+// Define how the thresholds are derived from the range of a sensor
+#define IR_CALIBRATION_MIN_CONTRAST 300         // Narrowest range between white and black that gives thresholds
+#define IR_CALIBRATION_HYSTERESIS_DIVISOR 8     // Barcode hysteresis either side of the middle is the contrast / 8
+#define IR_CALIBRATION_MARGIN_DIVISOR 8         // Line white and black levels sit the contrast / 8 inside the range
+
+// Define the running min/max, kept in 1/256 of an ADC step so a slow drift is not lost to rounding
+#define IR_CALIBRATION_FRACTION_BITS 8
+#define IR_CALIBRATION_ATTACK_SHIFT 3           // A new extreme moves the running min/max 1/8 of the way each interval
+#define IR_CALIBRATION_DECAY_SHIFT 14           // Otherwise it drifts 1/16384 of the way back each interval (about 3 minutes)
+#define IR_CALIBRATION_APPLY_INTERVALS 100      // Intervals between thresholds derived from the running range (1 s)
+
+/**
+ * @brief The IR sensors read through the ADC.
+ */
+typedef enum
+{
+    IR_SENSOR_BARCODE,
+    IR_SENSOR_LEFT_LINE,
+    IR_SENSOR_RIGHT_LINE,
+    IR_SENSOR_COUNT,
+} ir_sensor_t;
+
+/**
+ * @brief Lowest and highest ADC value seen by a sensor.
+ */
+typedef struct
+{
+    uint16_t min;   // ADC value on white
+    uint16_t max;   // ADC value on black
+} ir_sensor_range_t;
+
+/**
+ * @brief Calibration as it is stored in flash.
+ */
+typedef struct
+{
+    uint32_t magic;                                 // IR_CALIBRATION_MAGIC, anything else is an erased or foreign sector
+    uint32_t version;                               // IR_CALIBRATION_VERSION the record was written with
+    ir_sensor_range_t ranges[IR_SENSOR_COUNT];      // Range of every sensor
+    uint32_t checksum;                              // Sum of the words before it
+} ir_calibration_record_t;
+
+ir_sensor_range_t ir_calibration_ranges[IR_SENSOR_COUNT];  // Range of every sensor from the last sweep or flash
+bool ir_calibrating = false;                    // Flag set while the calibration sweep runs
+uint32_t ir_calibration_start_time = 0;         // Time the calibration sweep started
+uint32_t ir_calibration_last_interval = 0;      // Value of ir_adc_intervals when the sensors were last read
+uint32_t ir_calibration_apply_countdown = IR_CALIBRATION_APPLY_INTERVALS; // Intervals until the running range is applied
+uint32_t ir_running_min[IR_SENSOR_COUNT];       // Running min of every sensor in 1/2^IR_CALIBRATION_FRACTION_BITS
+uint32_t ir_running_max[IR_SENSOR_COUNT];       // Running max of every sensor in 1/2^IR_CALIBRATION_FRACTION_BITS
+bool ir_running_range_started = false;          // Flag set once the running range holds a value
+bool ir_calibration_save_pending = false;       // Flag set while a new calibration waits for the robot to rest
+
+// Function prototypes
+void get_ir_sensor_values(uint16_t values[IR_SENSOR_COUNT]);
+uint32_t get_ir_calibration_checksum(const ir_calibration_record_t *record);
+bool load_ir_calibration();
+bool is_ir_calibration_save_safe(uint32_t now);
+void save_ir_calibration();
+bool apply_ir_calibration(const ir_sensor_range_t ranges[IR_SENSOR_COUNT]);
+void reset_ir_running_range(const ir_sensor_range_t ranges[IR_SENSOR_COUNT]);
+void track_ir_running_range(const uint16_t values[IR_SENSOR_COUNT]);
+void start_ir_calibration(uint32_t now);
+void finish_ir_calibration();
+void update_ir_calibration(uint32_t now);
+void initialise_ir_calibration();
+void retrieve_ir_calibration();
+
+/**
+ * @brief Read the latest interval averages of every sensor.
+ *
+ * @param values Array the values are copied into, indexed by ir_sensor_t.
+ */
+void get_ir_sensor_values(uint16_t values[IR_SENSOR_COUNT])
+{
+    values[IR_SENSOR_BARCODE] = ir_adc_barcode_value;
+    values[IR_SENSOR_LEFT_LINE] = ir_adc_left_line_value;
+    values[IR_SENSOR_RIGHT_LINE] = ir_adc_right_line_value;
+}
+
+/**
+ * @brief Work out the checksum of a calibration record.
+ *
+ * @param record Pointer to the record.
+ * @return The sum of every word before the checksum.
+ */
+uint32_t get_ir_calibration_checksum(const ir_calibration_record_t *record)
+{
+    const uint32_t *words = (const uint32_t *)record;
+    uint32_t checksum = 0;
+
+    for (int i = 0; i < offsetof(ir_calibration_record_t, checksum) / sizeof(uint32_t); i++)
+    {
+        checksum += words[i];
+    }
+
+    return checksum;
+}
+
+/**
+ * @brief Load the calibration stored in flash into ir_calibration_ranges.
+ *
+ * @return true if a valid calibration was found, false otherwise.
+ */
+bool load_ir_calibration()
+{
+    // The flash is mapped into the address space, so the record can be read in place
+    const ir_calibration_record_t *record = (const ir_calibration_record_t *)(XIP_BASE + IR_CALIBRATION_FLASH_OFFSET);
+
+    if (record->magic != IR_CALIBRATION_MAGIC || record->version != IR_CALIBRATION_VERSION ||
+        record->checksum != get_ir_calibration_checksum(record))
+    {
+        return false;
+    }
+
+    memcpy(ir_calibration_ranges, record->ranges, sizeof(ir_calibration_ranges));
+    return true;
+}
+
+/**
+ * @brief Check whether the robot is at rest, so the calibration can be stored.
+ *
+ * @param now Current time from time_us_32().
+ * @return true if no movement is running and neither wheel has turned for IR_CALIBRATION_SAVE_REST_MS.
+ */
+bool is_ir_calibration_save_safe(uint32_t now)
+{
+    return movement_direction == 'x' && now - left_last_pulse_time >= IR_CALIBRATION_SAVE_REST_MS * 1000 &&
+           now - right_last_pulse_time >= IR_CALIBRATION_SAVE_REST_MS * 1000;
+}
+
+/**
+ * @brief Store ir_calibration_ranges in flash.
+ *
+ * @details
+ * Called from thread context only, once is_ir_calibration_save_safe() holds. Interrupts are disabled while
+ * the sector is erased and programmed, as nothing may run from flash in the meantime. A sector erase can take
+ * up to about 400 ms, far longer than the ADC ring buffer, and every encoder and sensor edge in that time is lost.
+ * So the robot must be at rest, and the ADC is paused around the save instead of letting its ring overrun.
+ */
+void save_ir_calibration()
+{
+    // Flash is programmed a whole page at a time, the rest of the page is left erased
+    uint8_t page[FLASH_PAGE_SIZE];
+    ir_calibration_record_t record;
+
+    record.magic = IR_CALIBRATION_MAGIC;
+    record.version = IR_CALIBRATION_VERSION;
+    memcpy(record.ranges, ir_calibration_ranges, sizeof(record.ranges));
+    record.checksum = get_ir_calibration_checksum(&record);
+
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, &record, sizeof(record));
+
+    pause_ir_adc();
+
+    uint32_t interrupts = save_and_disable_interrupts();
+    flash_range_erase(IR_CALIBRATION_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(IR_CALIBRATION_FLASH_OFFSET, page, FLASH_PAGE_SIZE);
+    restore_interrupts(interrupts);
+
+    resume_ir_adc();
+}
+
+/**
+ * @brief Derive the thresholds of the barcode and line sensors from their ranges.
+ *
+ * @details
+ * The barcode thresholds and the line sensor levels are only changed if their sensors
+ * have seen both colours. Both line sensors share one scale, so the average of their ranges is used.
+ * The barcode sensor also gives the white and black levels of the centre sensor of the junction detector.
+ *
+ * @param ranges Range of every sensor, indexed by ir_sensor_t.
+ * @return true if any threshold was changed, false otherwise.
+ */
+bool apply_ir_calibration(const ir_sensor_range_t ranges[IR_SENSOR_COUNT])
+{
+    bool applied = false;
+
+    // Barcode hysteresis around the middle of its range
+    const ir_sensor_range_t *barcode = &ranges[IR_SENSOR_BARCODE];
+    if (barcode->max - barcode->min >= IR_CALIBRATION_MIN_CONTRAST)
+    {
+        uint16_t contrast = barcode->max - barcode->min;
+        uint16_t middle = barcode->min + contrast / 2;
+
+        ir_adc_threshold_high = middle + contrast / IR_CALIBRATION_HYSTERESIS_DIVISOR;
+        ir_adc_threshold_low = middle - contrast / IR_CALIBRATION_HYSTERESIS_DIVISOR;
+        line_centre_adc_white = barcode->min + contrast / IR_CALIBRATION_MARGIN_DIVISOR;
+        line_centre_adc_black = barcode->max - contrast / IR_CALIBRATION_MARGIN_DIVISOR;
+        applied = true;
+    }
+
+    // Line sensor white and black levels just inside the range, so the ends read fully white and fully black
+    const ir_sensor_range_t *left = &ranges[IR_SENSOR_LEFT_LINE];
+    const ir_sensor_range_t *right = &ranges[IR_SENSOR_RIGHT_LINE];
+    if (left->max - left->min >= IR_CALIBRATION_MIN_CONTRAST && right->max - right->min >= IR_CALIBRATION_MIN_CONTRAST)
+    {
+        uint16_t white = (left->min + right->min) / 2;
+        uint16_t black = (left->max + right->max) / 2;
+        uint16_t margin = (black - white) / IR_CALIBRATION_MARGIN_DIVISOR;
+
+        line_adc_white = white + margin;
+        line_adc_black = black - margin;
+        applied = true;
+    }
+
+    return applied;
+}
+
+/**
+ * @brief Start the running range of every sensor from the given ranges.
+ *
+ * @param ranges Range of every sensor, indexed by ir_sensor_t.
+ */
+void reset_ir_running_range(const ir_sensor_range_t ranges[IR_SENSOR_COUNT])
+{
+    for (int i = 0; i < IR_SENSOR_COUNT; i++)
+    {
+        ir_running_min[i] = (uint32_t)ranges[i].min << IR_CALIBRATION_FRACTION_BITS;
+        ir_running_max[i] = (uint32_t)ranges[i].max << IR_CALIBRATION_FRACTION_BITS;
+    }
+    ir_running_range_started = true;
+}
+
+/**
+ * @brief Move the running range of every sensor towards the latest values.
+ *
+ * @details
+ * A value outside the range pulls that end out by 1/2^IR_CALIBRATION_ATTACK_SHIFT of the difference,
+ * so a new extreme is followed within a few intervals but a single noisy interval is not.
+ * Every other end drifts back by 1/2^IR_CALIBRATION_DECAY_SHIFT of the difference, so a change of light
+ * that narrows the range is followed too, but far slower than the robot drives over both colours.
+ *
+ * @param values Latest value of every sensor, indexed by ir_sensor_t.
+ */
+void track_ir_running_range(const uint16_t values[IR_SENSOR_COUNT])
+{
+    for (int i = 0; i < IR_SENSOR_COUNT; i++)
+    {
+        uint32_t value = (uint32_t)values[i] << IR_CALIBRATION_FRACTION_BITS;
+
+        if (value < ir_running_min[i])
+        {
+            ir_running_min[i] -= (ir_running_min[i] - value) >> IR_CALIBRATION_ATTACK_SHIFT;
+        }
+        else
+        {
+            ir_running_min[i] += (value - ir_running_min[i]) >> IR_CALIBRATION_DECAY_SHIFT;
+        }
+
+        if (value > ir_running_max[i])
+        {
+            ir_running_max[i] += (value - ir_running_max[i]) >> IR_CALIBRATION_ATTACK_SHIFT;
+        }
+        else
+        {
+            ir_running_max[i] -= (ir_running_max[i] - value) >> IR_CALIBRATION_DECAY_SHIFT;
+        }
+    }
+}
+
+/**
+ * @brief Start the calibration sweep.
+ *
+ * @details
+ * The robot spins to the left on the spot until update_ir_calibration() ends the sweep.
+ * The movement direction is set to 'c' so neither the heading PID nor the line sensor events stop the spin,
+ * and the motion queue is held so no queued command does either.
+ *
+ * @param now Current time from time_us_32().
+ */
+void start_ir_calibration(uint32_t now)
+{
+    // Start every range empty, the first values fill it in
+    for (int i = 0; i < IR_SENSOR_COUNT; i++)
+    {
+        ir_calibration_ranges[i].min = UINT16_MAX;
+        ir_calibration_ranges[i].max = 0;
+    }
+
+    // No controller runs the spin, so drive the wheels straight at the sweep speed, with the motion queue held
+    hold_motion_queue(true);
+    turn_left(IR_CALIBRATION_SWEEP_SPEED, 0);
+    movement_direction = 'c';
+    set_speed(IR_CALIBRATION_SWEEP_SPEED, IR_CALIBRATION_SWEEP_SPEED);
+
+    ir_calibration_start_time = now;
+    ir_calibrating = true;
+}
+
+/**
+ * @brief End the calibration sweep, apply the thresholds and store them if every sensor saw both colours.
+ *
+ * @details
+ * The robot is still turning when the sweep ends, so the new calibration is only marked to be stored,
+ * and update_ir_calibration() stores it once the robot is at rest.
+ */
+void finish_ir_calibration()
+{
+    ir_calibrating = false;
+    stop_motors();
+    hold_motion_queue(false);
+
+    // Keep the old calibration if a sensor never crossed the line
+    for (int i = 0; i < IR_SENSOR_COUNT; i++)
+    {
+        if (ir_calibration_ranges[i].max < ir_calibration_ranges[i].min ||
+            ir_calibration_ranges[i].max - ir_calibration_ranges[i].min < IR_CALIBRATION_MIN_CONTRAST)
+        {
+            printf("IR calibration failed, sensor %d did not see black and white\n", i);
+            load_ir_calibration();
+            return;
+        }
+    }
+
+    apply_ir_calibration(ir_calibration_ranges);
+    reset_ir_running_range(ir_calibration_ranges);
+    ir_calibration_save_pending = true;
+    retrieve_ir_calibration();
+}
+
+/**
+ * @brief Track the sensors for the calibration sweep or the running range, and store a new calibration.
+ *
+ * @details
+ * Called from the main loop. The sensors are only read once per ADC interval, so the
+ * running range drifts at the same rate no matter how often this is called.
+ * A calibration waiting to be stored is stored once the robot is at rest, see save_ir_calibration().
+ *
+ * @param now Current time from time_us_32().
+ */
+void update_ir_calibration(uint32_t now)
+{
+    uint16_t values[IR_SENSOR_COUNT];
+
+    // Nothing new since the last call
+    if (ir_adc_intervals == ir_calibration_last_interval)
+    {
+        return;
+    }
+    ir_calibration_last_interval = ir_adc_intervals;
+    get_ir_sensor_values(values);
+
+    // Store a new calibration once nothing is lost while the flash is busy
+    if (ir_calibration_save_pending && is_ir_calibration_save_safe(now))
+    {
+        save_ir_calibration();
+        ir_calibration_save_pending = false;
+    }
+
+    if (ir_calibrating)
+    {
+        // Widen the range of every sensor to the values seen
+        for (int i = 0; i < IR_SENSOR_COUNT; i++)
+        {
+            if (values[i] < ir_calibration_ranges[i].min)
+            {
+                ir_calibration_ranges[i].min = values[i];
+            }
+            if (values[i] > ir_calibration_ranges[i].max)
+            {
+                ir_calibration_ranges[i].max = values[i];
+            }
+        }
+
+        if (now - ir_calibration_start_time >= IR_CALIBRATION_SWEEP_MS * 1000)
+        {
+            finish_ir_calibration();
+        }
+        return;
+    }
+
+    // Only adapt while driving over the surface, a robot standing still only sees one colour
+    if (movement_direction == 'x')
+    {
+        return;
+    }
+
+    // Without a stored calibration, the running range starts from the first values seen
+    if (!ir_running_range_started)
+    {
+        for (int i = 0; i < IR_SENSOR_COUNT; i++)
+        {
+            ir_running_min[i] = ir_running_max[i] = (uint32_t)values[i] << IR_CALIBRATION_FRACTION_BITS;
+        }
+        ir_running_range_started = true;
+    }
+    track_ir_running_range(values);
+
+    // Derive the thresholds from the running range every IR_CALIBRATION_APPLY_INTERVALS
+    if (--ir_calibration_apply_countdown == 0)
+    {
+        ir_sensor_range_t ranges[IR_SENSOR_COUNT];
+
+        ir_calibration_apply_countdown = IR_CALIBRATION_APPLY_INTERVALS;
+        for (int i = 0; i < IR_SENSOR_COUNT; i++)
+        {
+            ranges[i].min = ir_running_min[i] >> IR_CALIBRATION_FRACTION_BITS;
+            ranges[i].max = ir_running_max[i] >> IR_CALIBRATION_FRACTION_BITS;
+        }
+        apply_ir_calibration(ranges);
+    }
+}
+
+/**
+ * @brief Load the stored calibration and apply it, the default thresholds are kept if there is none.
+ */
+void initialise_ir_calibration()
+{
+    if (load_ir_calibration())
+    {
+        apply_ir_calibration(ir_calibration_ranges);
+        reset_ir_running_range(ir_calibration_ranges);
+        retrieve_ir_calibration();
+    }
+    else
+    {
+        printf("No IR calibration stored, using the default thresholds\n");
+    }
+}
+
+/**
+ * @brief Function to print the IR sensor ranges and thresholds.
+ */
+void retrieve_ir_calibration()
+{
+    printf("IR barcode: %u-%u, threshold %u/%u, white %u, black %u\n", ir_calibration_ranges[IR_SENSOR_BARCODE].min,
+           ir_calibration_ranges[IR_SENSOR_BARCODE].max, ir_adc_threshold_low, ir_adc_threshold_high,
+           line_centre_adc_white, line_centre_adc_black);
+    printf("IR line: left %u-%u, right %u-%u, white %u, black %u\n", ir_calibration_ranges[IR_SENSOR_LEFT_LINE].min,
+           ir_calibration_ranges[IR_SENSOR_LEFT_LINE].max, ir_calibration_ranges[IR_SENSOR_RIGHT_LINE].min,
+           ir_calibration_ranges[IR_SENSOR_RIGHT_LINE].max, line_adc_white, line_adc_black);
+}
+
+#endif // IR_CALIBRATION_H
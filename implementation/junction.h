@@ -0,0 +1,225 @@
+/**
+ * @file junction.h
+ * @brief Header file for detecting and classifying junctions of a line maze.
+ * @details
+ * Three IR sensors are used: the two line sensors either side of the line, and the barcode sensor,
+ * which sits at the front centre of the robot and so is over the line while it is being followed.
+ * They are read through their digital outputs, or through the ADC when LINE_USE_ADC or BARCODE_USE_ADC is set
+ * (see ir_adc.h), with get_left_line_black_level(), get_right_line_black_level() and get_centre_black_level().
+ *
+ * A junction is looked at over a short window measured with the wheel encoders instead of time,
+ * so the result does not depend on the speed the robot crosses it at:
+ * 1) The window opens when a side sensor goes fully black while the centre sensor is still on the line.
+ * 2) Until the robot has travelled JUNCTION_WINDOW_DISTANCE, every side sensor that sees black is remembered.
+ * 3) At the end of the window, the centre sensor tells whether the line carries on ahead.
+ * The side arms seen and the line ahead give the junction type:
+ *
+ *     arms seen     line ahead       no line ahead
+ *     left, right   JUNCTION_CROSS   JUNCTION_T
+ *     left          LEFT_BRANCH      LEFT_TURN
+ *     right         RIGHT_BRANCH     RIGHT_TURN
+ *
+ * A dead end is the centre sensor losing the line with no side arm, for the same distance.
+ * Every junction is stamped with the time, the encoder counts and the pose from get_odometry_pose()
+ * (see odometry.h) where its window opened, and passed to handle_junction(), so the robot can act on it
+ * without stopping and the TCP client can place it on a map of the maze.
+ *
+ * @date November 19, 2023
+ */
+
+#ifndef JUNCTION_H
+#define JUNCTION_H
+
+#include "pico/stdlib.h"
+
+// Define the detection window in 1/ENCODER_POSITION_SCALE encoder ticks
+#define JUNCTION_WINDOW_DISTANCE (2 * ENCODER_POSITION_SCALE) // About 2.2 cm, wider than a line crossing the path
+// Event sent to the TCP client for every junction, with its type, the distance travelled in encoder ticks and its x and y in cm
+#define JUNCTION_EVENT_FORMAT "JUNCTION:%s,%ld,%.1f,%.1f\n"
+
+/**
+ * @brief Types of junction.
+ */
+typedef enum
+{
+    JUNCTION_DEAD_END,      // The line ends
+    JUNCTION_LEFT_TURN,     // The line only carries on to the left
+    JUNCTION_RIGHT_TURN,    // The line only carries on to the right
+    JUNCTION_LEFT_BRANCH,   // The line carries on ahead and to the left
+    JUNCTION_RIGHT_BRANCH,  // The line carries on ahead and to the right
+    JUNCTION_T,             // The line carries on to the left and to the right
+    JUNCTION_CROSS,         // The line carries on ahead, to the left and to the right
+} junction_type_t;
+
+/**
+ * @brief A junction found by the detector.
+ */
+typedef struct
+{
+    junction_type_t type;   // What kind of junction
+    uint32_t timestamp;     // Time the window of the junction opened
+    int32_t position;       // Distance travelled when the window opened, from get_encoder_position()
+    int left_count;         // Left encoder count when the window opened
+    int right_count;        // Right encoder count when the window opened
+    odometry_pose_t pose;   // Pose of the robot when the window opened, from get_odometry_pose()
+} junction_t;
+
+/**
+ * @brief States of the junction detector.
+ */
+typedef enum
+{
+    JUNCTION_STATE_FOLLOWING,   // On the line, waiting for a junction
+    JUNCTION_STATE_ARMS,        // A side sensor went black, recording the arms
+    JUNCTION_STATE_LOST,        // The centre sensor lost the line, checking for a dead end
+    JUNCTION_STATE_LEAVING,     // Junction reported, waiting to be back on a single line
+} junction_state_t;
+
+// Names of the junction types, in the order of junction_type_t
+static const char *junction_names[] = {"DEAD_END", "LEFT_TURN", "RIGHT_TURN", "LEFT_BRANCH", "RIGHT_BRANCH", "T", "CROSS"};
+
+junction_state_t junction_state = JUNCTION_STATE_FOLLOWING; // Current state of the detector
+junction_t junction_pending;            // Junction whose window is open
+bool junction_left_seen = false;        // Flag set when the left sensor saw black in the window
+bool junction_right_seen = false;       // Flag set when the right sensor saw black in the window
+junction_t last_junction;               // Latest junction found
+uint32_t junctions_detected = 0;        // Number of junctions found
+
+// Function prototypes
+void reset_junction_detector();
+void open_junction_window(uint32_t now, int32_t position, junction_state_t state);
+junction_type_t classify_junction(bool left_seen, bool right_seen, bool line_ahead);
+void update_junction_detector(uint32_t now);
+void handle_junction(const junction_t *junction);
+
+/**
+ * @brief Go back to waiting for a junction.
+ */
+void reset_junction_detector()
+{
+    junction_state = JUNCTION_STATE_FOLLOWING;
+    junction_left_seen = false;
+    junction_right_seen = false;
+}
+
+/**
+ * @brief Open the window of a possible junction and stamp it with the odometry.
+ *
+ * @param now Current time from time_us_32().
+ * @param position Distance travelled from get_encoder_position().
+ * @param state JUNCTION_STATE_ARMS or JUNCTION_STATE_LOST.
+ */
+void open_junction_window(uint32_t now, int32_t position, junction_state_t state)
+{
+    junction_pending.timestamp = now;
+    junction_pending.position = position;
+    junction_pending.left_count = left_encoder_count;
+    junction_pending.right_count = right_encoder_count;
+    get_odometry_pose(&junction_pending.pose);
+    junction_left_seen = false;
+    junction_right_seen = false;
+    junction_state = state;
+}
+
+/**
+ * @brief Work out the junction type from the arms seen and whether the line carries on ahead.
+ *
+ * @param left_seen true if the left sensor saw an arm.
+ * @param right_seen true if the right sensor saw an arm.
+ * @param line_ahead true if the centre sensor is on the line after the window.
+ * @return The junction type.
+ */
+junction_type_t classify_junction(bool left_seen, bool right_seen, bool line_ahead)
+{
+    if (left_seen && right_seen)
+    {
+        return line_ahead ? JUNCTION_CROSS : JUNCTION_T;
+    }
+    if (left_seen)
+    {
+        return line_ahead ? JUNCTION_LEFT_BRANCH : JUNCTION_LEFT_TURN;
+    }
+    if (right_seen)
+    {
+        return line_ahead ? JUNCTION_RIGHT_BRANCH : JUNCTION_RIGHT_TURN;
+    }
+
+    return JUNCTION_DEAD_END;
+}
+
+/**
+ * @brief Run the junction detector on the latest sensor values.
+ *
+ * @details
+ * Called from the main loop while the robot follows a line. The sensors change on their edges, or every
+ * IR_ADC_PROCESS_INTERVAL_MS when read through the ADC, so calling it more often does no harm.
+ *
+ * @param now Current time from time_us_32().
+ */
+void update_junction_detector(uint32_t now)
+{
+    if (!line_following)
+    {
+        reset_junction_detector();
+        return;
+    }
+
+    bool left_black = get_left_line_black_level() > LINE_JUNCTION_LEVEL;
+    bool right_black = get_right_line_black_level() > LINE_JUNCTION_LEVEL;
+    bool centre_black = get_centre_black_level() > LINE_JUNCTION_LEVEL;
+    int32_t position = get_encoder_position(now);
+
+    // The encoder counts were reset by a new movement, so the window cannot be measured
+    if (junction_state != JUNCTION_STATE_FOLLOWING && position < junction_pending.position)
+    {
+        reset_junction_detector();
+    }
+
+    switch (junction_state)
+    {
+    case JUNCTION_STATE_FOLLOWING:
+        if (centre_black && (left_black || right_black))
+        {
+            open_junction_window(now, position, JUNCTION_STATE_ARMS);
+        }
+        else if (!centre_black && !left_black && !right_black)
+        {
+            open_junction_window(now, position, JUNCTION_STATE_LOST);
+        }
+        break;
+
+    case JUNCTION_STATE_LOST:
+        // Back on the line, or a side arm after a gap, so it is not a dead end
+        if (centre_black || left_black || right_black)
+        {
+            reset_junction_detector();
+            break;
+        }
+        // Close the window the same way once the robot has travelled past it
+        // Fall through
+
+    case JUNCTION_STATE_ARMS:
+        junction_left_seen |= left_black;
+        junction_right_seen |= right_black;
+
+        if (position - junction_pending.position >= JUNCTION_WINDOW_DISTANCE)
+        {
+            junction_pending.type = classify_junction(junction_left_seen, junction_right_seen, centre_black);
+            last_junction = junction_pending;
+            junctions_detected++;
+            junction_state = JUNCTION_STATE_LEAVING;
+            handle_junction(&last_junction);
+        }
+        break;
+
+    case JUNCTION_STATE_LEAVING:
+        // Only look for the next junction once the side sensors are off this one and the centre is back on a line
+        if (!left_black && !right_black && centre_black)
+        {
+            reset_junction_detector();
+        }
+        break;
+    }
+}
+
+#endif // JUNCTION_H
@@ -0,0 +1,300 @@
+/**
+ * @file line_follow.h
+ * @brief Header file for line position estimation and line following.
+ * @details
+ * The two line sensors sit either side of the line, so both see white while the robot is centred
+ * and one of them starts to see black as the line drifts under it. Each sensor gives how much black it sees,
+ * 0 to LINE_SCALE, and the line position is the difference between them: negative when the line is towards
+ * the left sensor, positive towards the right. By default the digital outputs of infrared.h are used, so a sensor
+ * sees either 0 or LINE_SCALE. With LINE_USE_ADC set and the analog outputs wired (see ir_adc.h),
+ * their analog values are scaled between the white and black levels, so the position changes smoothly.
+ *
+ * If the line leaves a sensor on the outside, both sensors see white again, just like when the robot
+ * is centred. The estimate tells the two apart by remembering the last position: when the line was
+ * last seen further out than LINE_EDGE_POSITION, it is taken to be beyond that sensor and the
+ * position is held at the limit, so the controller keeps steering back towards it.
+ *
+ * A PID controller on the line position steers by driving the wheels at different speeds around
+ * a cruise speed, so curves are followed without stopping to pivot. The cruise speed ramps up along the
+ * motion profile started by move_forward() (see motion_profile.h), so the wheels do not slip off the mark. It runs in Q16.16 fixed point
+ * like the motor controller (see fixed_point.h).
+ *
+ * @date November 18, 2023
+ */
+
+#ifndef LINE_FOLLOW_H
+#define LINE_FOLLOW_H
+
+#include "pico/stdlib.h"
+#include "fixed_point.h"
+
+// Define the scale of the line position estimate
+#define LINE_SCALE 1000                 // A sensor fully on black, and the position at either limit
+#define LINE_DETECT_LEVEL 100           // A sensor seeing less black than this is on white
+#define LINE_EDGE_POSITION 500          // Line last seen further out than this is beyond the sensor when lost
+#define LINE_JUNCTION_LEVEL 700         // Both sensors seeing more black than this are on a junction
+
+// Default ADC values of the line sensors on white and on black
+#define LINE_ADC_WHITE 400
+#define LINE_ADC_BLACK 2000
+// Default ADC values of the centre (barcode) sensor on white and on black
+#define LINE_CENTRE_ADC_WHITE 400
+#define LINE_CENTRE_ADC_BLACK 2000
+
+// Define the line following controller
+#define LINE_FOLLOW_CRUISE_SPEED 6250   // PWM level of both wheels on a straight line
+#define LINE_FOLLOW_MAX_SPEED 12500     // PWM wrap, the highest level a wheel can be driven at
+#define LINE_FOLLOW_INTEGRAL_LIMIT Q16(2000) // Limit of the integral of the position in position seconds
+
+uint16_t line_adc_white = LINE_ADC_WHITE;   // ADC value of a line sensor on white
+uint16_t line_adc_black = LINE_ADC_BLACK;   // ADC value of a line sensor on black
+uint16_t line_centre_adc_white = LINE_CENTRE_ADC_WHITE; // ADC value of the centre sensor on white
+uint16_t line_centre_adc_black = LINE_CENTRE_ADC_BLACK; // ADC value of the centre sensor on black
+int16_t line_position = 0;                  // Latest line position, -LINE_SCALE (left) to LINE_SCALE (right)
+bool line_junction_detected = false;        // Flag set while both sensors are on black
+
+q16_t line_kp = Q16(4.0);   // PWM level per unit of line position
+q16_t line_ki = Q16(0.5);   // PWM level per unit of line position per second
+q16_t line_kd = Q16(0.1);   // PWM level per unit of line position per second of change
+q16_t line_integral = 0;                    // Integral of the line position in position seconds
+int16_t line_previous_position = 0;         // Line position at the previous control step
+uint32_t line_previous_time = 0;            // Time of the previous control step
+bool line_following = false;                // Flag set while the robot follows the line
+
+// Function prototypes
+uint16_t scale_black_level(uint16_t adc_value, uint16_t white, uint16_t black);
+uint16_t get_line_sensor_black_level(uint16_t adc_value);
+uint16_t get_centre_sensor_black_level(uint16_t adc_value);
+uint16_t get_left_line_black_level();
+uint16_t get_right_line_black_level();
+uint16_t get_centre_black_level();
+int16_t estimate_line_position(uint16_t left_level, uint16_t right_level);
+q16_t clamp_line_speed(q16_t speed);
+void start_line_following();
+void stop_line_following();
+void line_follow_control(uint32_t now);
+
+/**
+ * @brief Scale an ADC value to how much black a sensor sees, between its values on white and on black.
+ *
+ * @param adc_value The ADC value of the sensor.
+ * @param white The ADC value of the sensor on white.
+ * @param black The ADC value of the sensor on black.
+ * @return 0 on white up to LINE_SCALE on black.
+ */
+uint16_t scale_black_level(uint16_t adc_value, uint16_t white, uint16_t black)
+{
+    if (adc_value <= white || black <= white)
+    {
+        return 0;
+    }
+    if (adc_value >= black)
+    {
+        return LINE_SCALE;
+    }
+
+    return (uint32_t)(adc_value - white) * LINE_SCALE / (black - white);
+}
+
+/**
+ * @brief Scale an ADC value of a line sensor to how much black the sensor sees.
+ *
+ * @param adc_value The ADC value of the line sensor.
+ * @return 0 on white up to LINE_SCALE on black.
+ */
+uint16_t get_line_sensor_black_level(uint16_t adc_value)
+{
+    return scale_black_level(adc_value, line_adc_white, line_adc_black);
+}
+
+/**
+ * @brief Scale an ADC value of the centre (barcode) sensor to how much black the sensor sees.
+ *
+ * @details
+ * The barcode sensor is a different part at a different height from the line sensors,
+ * so it has its own white and black values.
+ *
+ * @param adc_value The ADC value of the barcode sensor.
+ * @return 0 on white up to LINE_SCALE on black.
+ */
+uint16_t get_centre_sensor_black_level(uint16_t adc_value)
+{
+    return scale_black_level(adc_value, line_centre_adc_white, line_centre_adc_black);
+}
+
+/**
+ * @brief Get how much black the left line sensor sees, from its analog output if LINE_USE_ADC is set.
+ *
+ * @return 0 on white up to LINE_SCALE on black.
+ */
+uint16_t get_left_line_black_level()
+{
+#if LINE_USE_ADC
+    return get_line_sensor_black_level(ir_adc_left_line_value);
+#else
+    return is_left_line_black ? LINE_SCALE : 0;
+#endif
+}
+
+/**
+ * @brief Get how much black the right line sensor sees, from its analog output if LINE_USE_ADC is set.
+ *
+ * @return 0 on white up to LINE_SCALE on black.
+ */
+uint16_t get_right_line_black_level()
+{
+#if LINE_USE_ADC
+    return get_line_sensor_black_level(ir_adc_right_line_value);
+#else
+    return is_right_line_black ? LINE_SCALE : 0;
+#endif
+}
+
+/**
+ * @brief Get how much black the centre (barcode) sensor sees, from its analog output if BARCODE_USE_ADC is set.
+ *
+ * @details
+ * The digital output is high on black, as for the barcode edges of infrared.h.
+ *
+ * @return 0 on white up to LINE_SCALE on black.
+ */
+uint16_t get_centre_black_level()
+{
+#if BARCODE_USE_ADC
+    return get_centre_sensor_black_level(ir_adc_barcode_value);
+#else
+    return gpio_get(barcode_sensor_pin) ? LINE_SCALE : 0;
+#endif
+}
+
+/**
+ * @brief Estimate the position of the line between the two line sensors.
+ *
+ * @details
+ * Updates line_position and line_junction_detected.
+ * 1) Both sensors on black is a junction, the position is centred so the robot goes straight across.
+ * 2) Both sensors on white after the line was last seen beyond LINE_EDGE_POSITION holds the position
+ *    at the limit on that side, as the line has passed outside the sensor.
+ * 3) Otherwise the position is the right black level minus the left black level.
+ *
+ * @param left_level How much black the left line sensor sees, from get_left_line_black_level().
+ * @param right_level How much black the right line sensor sees, from get_right_line_black_level().
+ * @return The line position, -LINE_SCALE (left) to LINE_SCALE (right).
+ */
+int16_t estimate_line_position(uint16_t left_level, uint16_t right_level)
+{
+    line_junction_detected = left_level > LINE_JUNCTION_LEVEL && right_level > LINE_JUNCTION_LEVEL;
+
+    if (line_junction_detected)
+    {
+        line_position = 0;
+    }
+    else if (left_level < LINE_DETECT_LEVEL && right_level < LINE_DETECT_LEVEL)
+    {
+        // Line lost outside one of the sensors, keep steering back towards it
+        if (line_position > LINE_EDGE_POSITION)
+        {
+            line_position = LINE_SCALE;
+        }
+        else if (line_position < -LINE_EDGE_POSITION)
+        {
+            line_position = -LINE_SCALE;
+        }
+        else
+        {
+            line_position = 0;
+        }
+    }
+    else
+    {
+        line_position = (int16_t)right_level - (int16_t)left_level;
+    }
+
+    return line_position;
+}
+
+/**
+ * @brief Keep a wheel speed within the PWM range.
+ *
+ * @param speed The requested PWM level.
+ * @return The PWM level clamped to 0 to LINE_FOLLOW_MAX_SPEED.
+ */
+q16_t clamp_line_speed(q16_t speed)
+{
+    return q16_clamp(speed, 0, Q16(LINE_FOLLOW_MAX_SPEED));
+}
+
+/**
+ * @brief Start following the line at the cruise speed.
+ */
+void start_line_following()
+{
+    // Drive forward, then take the wheels over from the heading PID
+    move_forward(LINE_FOLLOW_CRUISE_SPEED);
+    movement_direction = 'f';
+
+    // Start the controller from a centred line
+    line_integral = 0;
+    line_position = 0;
+    line_previous_position = 0;
+    line_previous_time = time_us_32();
+    line_following = true;
+}
+
+/**
+ * @brief Stop following the line and stop the motors.
+ */
+void stop_line_following()
+{
+    line_following = false;
+    stop_motors();
+}
+
+/**
+ * @brief Run one step of the line following controller.
+ *
+ * @details
+ * Called from thread context at the control rate. The correction from the PID controller
+ * is added to the left wheel and taken from the right wheel, so a line towards the right
+ * sensor (positive position) turns the robot right, around the speed of the motion profile.
+ * The integral is limited to LINE_FOLLOW_INTEGRAL_LIMIT so it cannot wind up while the line is lost.
+ *
+ * @param now Current time from time_us_32().
+ */
+void line_follow_control(uint32_t now)
+{
+    if (!line_following)
+    {
+        return;
+    }
+
+    // Time since the previous step in seconds
+    q16_t dt = q16_from_us(now - line_previous_time);
+    line_previous_time = now;
+    if (dt <= 0)
+    {
+        return;
+    }
+
+    int16_t position = estimate_line_position(get_left_line_black_level(), get_right_line_black_level());
+
+    // Integrate the position, limited to stop wind-up
+    line_integral = q16_add(line_integral, q16_mul(q16_from_int(position), dt));
+    line_integral = q16_clamp(line_integral, -LINE_FOLLOW_INTEGRAL_LIMIT, LINE_FOLLOW_INTEGRAL_LIMIT);
+
+    // Rate of change of the position, scaled by its gain first so a sharp change cannot overflow the format
+    q16_t derivative_term = q16_div(q16_mul(line_kd, q16_from_int(position - line_previous_position)), dt);
+    line_previous_position = position;
+
+    q16_t correction = q16_add(q16_mul(line_kp, q16_from_int(position)), q16_mul(line_ki, line_integral));
+    correction = q16_add(correction, derivative_term);
+
+    // PWM level of the profile speed, up to LINE_FOLLOW_CRUISE_SPEED
+    q16_t cruise_speed = q16_mul(update_motion_profile(&motion_profile, dt), PID_WHEEL_FEEDFORWARD);
+
+    // Steer by driving the wheels at different speeds around the cruise speed
+    set_speed(q16_to_int(clamp_line_speed(q16_add(cruise_speed, correction))),
+              q16_to_int(clamp_line_speed(q16_sub(cruise_speed, correction))));
+}
+
+#endif // LINE_FOLLOW_H
@@ -14,6 +14,7 @@
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
 #include "math.h"
+#include "fixed_point.h"
 
 #define MAGNETOMETER_ADDRESS 0x1E           // Address of the magnetometer
 #define MAGNETOMETER_CONFIG_REGISTER_A 0x00 // CRA_REG_M
@@ -24,7 +25,7 @@
 bool initialise_i2c_bus();
 bool initialise_magnetometer();
 uint16_t *get_magnetometer_data();
-float get_heading();
+q16_t get_heading();
 
 #endif // MAGNETOMETER_H
 
@@ -74,13 +75,14 @@ bool initialise_magnetometer()
  * @brief Calculates the heading in degrees based on magnetometer data.
  *
  * This function reads the magnetometer data, computes the heading angle, and returns the result.
+ * The angle is worked out in Q16.16 fixed point, as the Cortex-M0+ has no FPU.
  *
- * @return The heading in degrees.
+ * @return The heading in degrees, 0 to 360, in Q16.16.
  */
-float get_heading() 
+q16_t get_heading() 
 {
 
-    float heading = 0;
+    q16_t heading = 0;
 
     // Request for magnetometer to read the data
     uint8_t magnetometer_reg[1] = {MAGNETOMETER_DATA_REGISTER};
@@ -88,19 +90,19 @@ float get_heading()
 
     // Read the data from magnetometer
     uint8_t magnetometer_data[6];
-    i2c_read_blocking(i2c0, MAGNETOMETERER_ADDRESS, magnetometer_data, 6, false);
+    i2c_read_blocking(i2c0, MAGNETOMETER_ADDRESS, magnetometer_data, 6, false);
 
     // Convert the data to 16-bit signed values
     int16_t x = (magnetometer_data[0] << 8) | magnetometer_data[1];
     int16_t y = (magnetometer_data[4] << 8) | magnetometer_data[5];
 
-    // Calculate the heading using atan2
-    heading = atan2(y, x) * 180.0 / M_PI;
+    // Calculate the heading using atan2, only the ratio of y to x matters so the raw values are used
+    heading = q16_to_degrees(q16_atan2(q16_from_int(y), q16_from_int(x)));
 
     // Normalize heading to 0-360 degrees
     if (heading < 0)
     {
-        heading += 360;
+        heading += Q16(360);
     }
 
     return heading;
@@ -18,7 +18,14 @@
 #include "lwip/tcp.h"
 
 #include "motor.h"
+#include "motion_queue.h"
+#include "odometry.h"
 #include "infrared.h"
+#include "ir_adc.h"
+#include "line_follow.h"
+#include "ir_calibration.h"
+#include "junction.h"
+#include "event_queue.h"
 #include "ultrasonic_sensor.h"
 #include "wifi.h"
 
@@ -36,6 +43,8 @@
 #define RIGHT_MOTOR_PIN2 12
 #define LEFT_MOTOR_PWM_PIN 15
 #define RIGHT_MOTOR_PWM_PIN 10
+// Define how often the main loop reads the ultrasonic sensor, events are dispatched while it waits
+#define MAIN_LOOP_PERIOD_US 100000
 
 uint32_t ultraval = 100;
 bool count_notches = false;
@@ -60,30 +69,27 @@ const static char *START_SCAN = "p";
 const static char *STOP_SCAN = "o";
 const static char *SCAN_LEFT = "l";
 const static char *SCAN_RIGHT = "r";
+const static char *FOLLOW_LINE = "f";
+const static char *CALIBRATE_IR = "c";
 
 int currentDir = 1;
 
 double front_heading = 0.0;
-struct repeating_timer left_encoder_cool_down_timer;
-struct repeating_timer right_encoder_cool_down_timer;
-struct repeating_timer left_infrared_cool_down_timer;
-struct repeating_timer right_infrared_cool_down_timer;
 
 uint32_t countOfArr = 0;
 
-volatile uint32_t left_last_pulse_time = 0;
-volatile uint32_t right_last_pulse_time = 0;
-
-bool left_line_tiggered = false;
-bool right_line_tiggered = false;
+volatile bool control_tick_pending = false;     // Flag set while EVENT_CONTROL_TICK waits in the queue
 
 // Function prototypes
 bool ultrasonic_sensor_handler();
 uint32_t runUltrasonic();
-bool reset_left_encoder_cool_down(struct repeating_timer *t);
-bool reset_right_encoder_cool_down(struct repeating_timer *t);
-bool reset_left_infrared_cool_down(struct repeating_timer *t);
-bool reset_right_infrared_cool_down(struct repeating_timer *t);
+void handle_left_line_black();
+void handle_junction(const junction_t *junction);
+void handle_motion_complete(const motion_command_t *command, bool completed);
+void dispatch_events();
+void dispatch_commands();
+void turn_away_from_obstacle();
+bool post_control_tick(struct repeating_timer *t);
 bool check_wifi_status(struct repeating_timer *t);
 
 /**
@@ -91,7 +97,10 @@ bool check_wifi_status(struct repeating_timer *t);
  *
  * This function interprets Wi-Fi commands and triggers corresponding movements
  * or actions of the robotic vehicle. Supported commands include moving forward,
- * moving backward, turning left, turning right, stopping, and initiating/terminating scanning.
+ * moving backward, turning left, turning right, stopping, following a line and initiating/terminating scanning.
+ * The movements are queued (see motion_queue.h), so a turn finishes before the next command drives on,
+ * while driving forward or backward gives way to the next command at once.
+ * It is called by dispatch_commands() from the main loop, never from the lwIP receive callback.
  *
  * @param recv_buffer A buffer containing the received Wi-Fi command.
  */
@@ -104,45 +113,63 @@ void motor_control(char *recv_buffer)
     if (recv_buffer[0] == MOVE_FORWARD[0])
     {
         printf("Moving forward\n");
-        move_forward(6250);
+        queue_velocity(6250, 0);
     }
     // Move backward when command received is "s"
     else if (recv_buffer[0] == MOVE_BACKWARD[0])
     {
         printf("Moving backward\n");
-        move_backward(6250);
+        queue_velocity(-6250, 0);
     }
     // Turn left when command received is "a"
     else if (recv_buffer[0] == TURN_LEFT[0])
     {
         printf("Turning left\n");
-        turn_left(6250, 90);
+        queue_angle(6250, -90);
     }
     // Turn right when command received is "d"
     else if (recv_buffer[0] == TURN_RIGHT[0])
     {
         printf("Turning right\n");
-        turn_right(6250, 90);
+        queue_angle(6250, 90);
     }
     // Stop when command received is "x"
     else if (recv_buffer[0] == STOP[0])
     {
         printf("Stopping\n");
-        stop_motors();
+        clear_motion_queue();
+    }
+    // Follow the line when command received is "f"
+    else if (recv_buffer[0] == FOLLOW_LINE[0])
+    {
+        printf("Following line\n");
+        clear_motion_queue();
+        start_line_following();
+    }
+    // Calibrate the IR sensor thresholds when command received is "c"
+    else if (recv_buffer[0] == CALIBRATE_IR[0])
+    {
+#if IR_ADC_ENABLED
+        printf("Calibrating IR sensors\n");
+        clear_motion_queue();
+        start_ir_calibration(time_us_32());
+#else
+        printf("IR calibration needs the analog sensor outputs, see ir_adc.h\n");
+#endif
     }
     // Start scanning for barcode when command received is "p"
     else if (recv_buffer[0] == START_SCAN[0])
     {
         printf("Stopping\n");
         toggleBarcode = true;
-        move_forward(6250);
+        queue_velocity(6250, 0);
     }
     // Stop scanning for barcode when command received is "o"
     else if (recv_buffer[0] == STOP_SCAN[0])
     {
         printf("Stopping\n");
         toggleBarcode = false;
-        move_forward(6250);
+        queue_velocity(6250, 0);
     }
     // Start counting notches when the command received is "g"
     else if (recv_buffer[0] == START_COUNTING_NOTCHES[0])
@@ -180,6 +207,9 @@ void motor_control(char *recv_buffer)
         countOfArr++;
         currentNotchCount = tempNotchCount;
 
+        // Print the pose tracked by the odometry alongside the grid below
+        retrieve_odometry();
+
         // Loop through the received notches and update the 2D array
         for (int i = 0; i < notch_arr[0]; i++)
         {
@@ -316,167 +346,203 @@ void motor_control(char *recv_buffer)
 }
 
 /**
- * @brief Handle interrupts from various sensors.
+ * @brief Turn at a line seen by the left line sensor.
  *
- * This function handles interrupts from encoders, line sensors, barcode sensor, and ultrasonic sensor.
- * Use only "if" as all the different types of interrupts are not mutually exclusive
- *
- * @param gpio The GPIO pin number generating the interrupt.
- * @param events The type of events triggering the interrupt.
+ * This function is called by dispatch_events() and uses leCounter to decide which way to turn.
+ * The turn takes over from the current movement, and the forward movement is queued behind it.
  */
-void interrupt_handler(uint gpio, uint32_t events)
+void handle_left_line_black()
 {
-    // Interrupt for the
-    if (gpio == ENCODER_LEFT_PIN)
-    {
-        //  Left encoder triggered time
-        uint32_t current_time = time_us_32();
-        uint32_t time_since_last_pulse = current_time - left_last_pulse_time;
-        
-        // Check if it's a rising edge, indicating a pulse
-        if (events == GPIO_IRQ_EDGE_RISE)
-        {
-            left_encoder_count++;
-        }
+    // Turn at the line now, whatever was queued before
+    preempt_motion();
 
-        // Calculate the speed of the left encoder based on time between pulses
-        if (time_since_last_pulse != 0)
-        {
-            left_encoder_speed = 1000000.0 / time_since_last_pulse;
-        }
-        
-        // Update the time of the last pulse
-        left_last_pulse_time = current_time;
-
-        // Disable the interrupt for 100ms to prevent multiple interrupts from being triggered
-        gpio_set_irq_enabled_with_callback(ENCODER_LEFT_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false, &interrupt_handler);
-        // Add a repeating timer for 200ms to reset the left encoder cooldown
-        add_repeating_timer_ms(200, reset_left_encoder_cool_down, NULL, &left_encoder_cool_down_timer);
+    // Check the current state of leCounter for the appropriate action
+    if (leCounter == 1)
+    {
+        // First trigger: Set leCounter to 2 and perform left turn followed by forward movement
+        leCounter = 2;
+        queue_angle(6250, -90);
+        queue_velocity(6250, 0);
     }
-
-    if (gpio == ENCODER_RIGHT_PIN)
+    else if (leCounter == 2)
     {
-        // Right encoder triggered time
-        uint32_t current_time = time_us_32();
-        uint32_t time_since_last_pulse = current_time - right_last_pulse_time;
-        
-        // Check if it's a rising edge, indicating a pulse
-        if (events == GPIO_IRQ_EDGE_RISE)
-        {
-            // Increment the right encoder count for each rising edge
-            right_encoder_count++;
-        }
-        
-        // Calculate the speed of the right encoder based on time between pulses
-        if (time_since_last_pulse != 0)
-        {
-            right_encoder_speed = 1000000.0 / time_since_last_pulse;
-        }
+        // Second trigger: Set leCounter to 3 and perform left turn followed by forward movement
+        leCounter = 3;
+        queue_angle(6250, -90);
+        queue_velocity(6250, 0);
+    }
+    else
+    {
+        // Any other trigger: Perform right turn followed by forward movement
+        queue_angle(6250, 90);
+        queue_velocity(6250, 0);
+    }
+}
+
+/**
+ * @brief Report a junction found while following the line.
+ *
+ * This function is called by update_junction_detector(). The robot keeps following the line
+ * through every junction except a dead end, the TCP client decides where to go next.
+ *
+ * @param junction The junction found.
+ */
+void handle_junction(const junction_t *junction)
+{
+    char event[sizeof(JUNCTION_EVENT_FORMAT) + 48];
+    long ticks = (long)(junction->position / ENCODER_POSITION_SCALE);
+    float x = q16_to_float(junction->pose.x);
+    float y = q16_to_float(junction->pose.y);
 
-        // Calculate the total degrees turned by the right encoder
-        float degrees_turned = right_encoder_count * 4.6;
+    printf("Junction %s at %ld ticks, x %.1f cm, y %.1f cm\n", junction_names[junction->type], ticks, x, y);
 
-        // Check if the turn has reached the desired angle for the right movement
-        if (degrees_turned > set_heading && movement_direction == 'd')
-        {
-            // Stop the motors if the desired angle is reached
-            stop_motors();
-        }
-        
-        // Update the time of the last pulse
-        right_last_pulse_time = current_time;
-
-        // Disable the interrupt for 100ms to prevent multiple interrupts from being triggered
-        gpio_set_irq_enabled_with_callback(ENCODER_RIGHT_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false, &interrupt_handler);
-        // Add a repeating timer for 200ms to reset the right encoder cooldown
-        add_repeating_timer_ms(200, reset_right_encoder_cool_down, NULL, &right_encoder_cool_down_timer);
+    // Send the junction to the TCP client
+    snprintf(event, sizeof(event), JUNCTION_EVENT_FORMAT, junction_names[junction->type], ticks, x, y);
+    send_tcp_event(event);
+
+    // Nowhere to go at a dead end
+    if (junction->type == JUNCTION_DEAD_END)
+    {
+        stop_line_following();
     }
+}
+
+/**
+ * @brief Report a motion command that has ended.
+ *
+ * This function is called by the motion queue, so the TCP client can send the next commands before the robot runs out.
+ *
+ * @param command The command that ended.
+ * @param completed true if it ran to its end, false if it was cut short.
+ */
+void handle_motion_complete(const motion_command_t *command, bool completed)
+{
+    char event[sizeof(MOTION_EVENT_FORMAT) + 32];
+
+    printf("Motion %s %lu %s\n", get_motion_name(command->type), (unsigned long)command->id, completed ? "done" : "cancelled");
 
-    if (gpio == LEFT_LINE_SENSOR_PIN)
+    // Send the result to the TCP client
+    snprintf(event, sizeof(event), MOTION_EVENT_FORMAT, get_motion_name(command->type), (unsigned long)command->id, completed ? "DONE" : "CANCELLED");
+    send_tcp_event(event);
+}
+
+/**
+ * @brief Carry out the actions for every event posted by the interrupts.
+ *
+ * This function is called from the main loop, so the actions may drive the motors and read the magnetometer.
+ */
+void dispatch_events()
+{
+    event_t event;
+
+    while (pop_event(&event))
     {
-        if (events == GPIO_IRQ_EDGE_RISE)
+        switch (event.type)
         {
-            // Left line sensor triggered on a rising edge
-            left_line_tiggered = true;
+        case EVENT_LEFT_LINE_BLACK:
+            // The line follower steers continuously and the calibration spins over the line, so only turn at the line otherwise
+            if (movement_direction != 'f' && movement_direction != 'c')
+            {
+                handle_left_line_black();
+            }
+            break;
 
-            // Check the current state of leCounter for the appropriate action
-            if (leCounter == 1)
+        case EVENT_BOTH_LINES_BLACK:
+            // Print a message and stop the motors if both line sensors are triggered, junctions are crossed while following the line or calibrating
+            if (movement_direction != 'f' && movement_direction != 'c')
             {
-            // First trigger: Set leCounter to 2 and perform left turn followed by forward movement   
-                leCounter = 2;
-                turn_left(6250, 90);
-                move_forward(6250);
+                printf("Both line sensors triggered\n");
+                clear_motion_queue();
             }
-            else if (leCounter == 2)
+            break;
+
+        case EVENT_CONTROL_TICK:
+            control_tick_pending = false;
+
+            // Filter the wheel speeds measured by the encoder interrupts
+            update_encoder_speeds(time_us_32());
+
+            // Steer along the line while following it, otherwise hold the heading
+            if (movement_direction == 'f')
             {
-            // Second trigger: Set leCounter to 3 and perform left turn followed by forward movement
-                leCounter = 3;
-                turn_left(6250, 90);
-                move_forward(6250);
+                line_follow_control(time_us_32());
             }
             else
             {
-            // Any other trigger: Perform right turn followed by forward movement
-                turn_right(6250, 90);
-                move_forward(6250);
+                line_following = false;
+                pid_control();
             }
-        }
 
-        else if (events == GPIO_IRQ_EDGE_FALL)
-        {
-            left_line_tiggered = false;
-        }
+            // Start the next queued movement once the current one has finished
+            update_motion_queue(time_us_32());
+            break;
 
-        // Disable the interrupt for 100ms to prevent multiple interrupts from being triggered
-        gpio_set_irq_enabled_with_callback(LEFT_LINE_SENSOR_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false, &interrupt_handler);
-        // Add a repeating timer for 200ms to reset the left infrared cooldown
-        add_repeating_timer_ms(200, reset_left_infrared_cool_down, NULL, &left_infrared_cool_down_timer);
-    }
-
-    if (gpio == RIGHT_LINE_SENSOR_PIN)
-    {
-        if (events == GPIO_IRQ_EDGE_RISE)
-        {
-            // The right line sensor signal has risen which mean it is black
-            right_line_tiggered = true;
+        default:
+            // The line sensor flags are already updated by the interrupt
+            break;
         }
-        else if (events == GPIO_IRQ_EDGE_FALL)
-        {
-            // The right line sensor signal has fallen which mean it is white
-            right_line_tiggered = false;
-        }
-
-        // Disable the interrupt for 100ms to prevent multiple interrupts from being triggered
-        gpio_set_irq_enabled_with_callback(RIGHT_LINE_SENSOR_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false, &interrupt_handler);
-        // Add a repeating timer for 200ms to reset the right infrared cooldown
-        add_repeating_timer_ms(200, reset_right_infrared_cool_down, NULL, &right_infrared_cool_down_timer);
     }
+}
 
-    if (gpio == BARCODE_SENSOR_PIN)
+/**
+ * @brief Carry out the commands received from the TCP client.
+ *
+ * This function is called from the main loop. The lwIP receive callback only queues the commands (see wifi.h),
+ * as it runs in the background and must not queue motion or drive the motors.
+ */
+void dispatch_commands()
+{
+    char command[2] = {'\0', '\0'};
+
+    while (pop_command(&command[0]))
     {
-         // If the event is on the barcode sensor pin, call the barcode sensor handler
-        barcode_sensor_handler(gpio, events);
+        motor_control(command);
     }
+}
 
-    // Check if both left and right line sensors are triggered
-    if (left_line_tiggered && right_line_tiggered)
+/**
+ * @brief Turn the robot around, away from an obstacle in front of it.
+ *
+ * This function is called from the main loop. The U-turn takes over from the current movement through the
+ * motion queue, unless a turn is already running or a command is about to start.
+ */
+void turn_away_from_obstacle()
+{
+    if ((motion_active && motion_current.type == MOTION_ANGLE) || motion_queue_head != motion_queue_tail)
     {
-        // Print a message and stop the motors if both line sensors are triggered
-        printf("Both line sensors triggered\n");
-        stop_motors();
+        return;
     }
 
-    if (gpio == ECHO_PIN)
+    preempt_motion();
+    queue_angle(SPEED, 180);
+}
+
+/**
+ * @brief Ask the main loop to run the PID controller.
+ *
+ * This function is called by a repeating timer. pid_control() reads the magnetometer over I2C,
+ * so it runs from dispatch_events() instead of the timer interrupt.
+ *
+ * @param t A pointer to the repeating timer structure.
+ * @return true to keep the timer running.
+ */
+bool post_control_tick(struct repeating_timer *t)
+{
+    // Skip this tick if the last one has not been handled yet
+    if (!control_tick_pending)
     {
-        // If the event is on the echo pin, call the function to handle changes on that pin
-        on_echo_pin_change(gpio, events);
+        control_tick_pending = true;
+        post_event(EVENT_CONTROL_TICK, time_us_32());
     }
+
+    return true;
 }
 
 /**
  * @brief Handle ultrasonic sensor events.
  *
- * This function handles events related to the ultrasonic sensor.
+ * This function handles events related to the ultrasonic sensor. It queues motion,
+ * so it must be called from the main loop and not from a timer.
  *
  * @return true if the ultrasonic sensor event is successfully handled.
  */
@@ -490,7 +556,7 @@ bool ultrasonic_sensor_handler()
         {
             printf("Too close to a wall\n");
             // U-turn
-            move_backward(LEFT_MOTOR_PIN1, LEFT_MOTOR_PIN2, RIGHT_MOTOR_PIN1, RIGHT_MOTOR_PIN2);
+            turn_away_from_obstacle();
         }
     }
 
@@ -515,67 +581,6 @@ uint32_t runUltrasonic()
     return distance_cm;
 }
 
-/**
- * @brief Reset left encoder cooldown period.
- *
- * This function resets the cooldown period for the left encoder interrupt.
- *
- * @param t A pointer to the repeating timer structure.
- * @return true if the cooldown period is successfully reset.
- */
-bool reset_left_encoder_cool_down(struct repeating_timer *t)
-{
-    gpio_set_irq_enabled_with_callback(ENCODER_LEFT_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-    // disable the timer
-    cancel_repeating_timer(t);
-    return true;
-}
-
-/**
- * @brief Reset right encoder cooldown period.
- *
- * This function resets the cooldown period for the right encoder interrupt.
- *
- * @param t A pointer to the repeating timer structure.
- * @return true if the cooldown period is successfully reset.
- */
-bool reset_right_encoder_cool_down(struct repeating_timer *t)
-{
-    gpio_set_irq_enabled_with_callback(ENCODER_RIGHT_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-    cancel_repeating_timer(t);
-    return true;
-}
-
-/**
- * @brief Reset left infrared sensor cooldown period.
- *
- * This function resets the cooldown period for the left infrared sensor interrupt.
- *
- * @param t A pointer to the repeating timer structure.
- * @return true if the cooldown period is successfully reset.
- */
-bool reset_left_infrared_cool_down(struct repeating_timer *t)
-{
-    gpio_set_irq_enabled_with_callback(LEFT_LINE_SENSOR_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-    cancel_repeating_timer(t);
-    return true;
-}
-
-/**
- * @brief Reset right infrared sensor cooldown period.
- *
- * This function resets the cooldown period for the right infrared sensor interrupt.
- *
- * @param t A pointer to the repeating timer structure.
- * @return true if the cooldown period is successfully reset.
- */
-bool reset_right_infrared_cool_down(struct repeating_timer *t)
-{
-    gpio_set_irq_enabled_with_callback(RIGHT_LINE_SENSOR_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-    cancel_repeating_timer(t);
-    return true;
-}
-
 /**
  * @brief Check the Wi-Fi status using a repeating timer.
  *
@@ -603,6 +608,14 @@ int main()
     // Initialize the motor
     initialise_motors(LEFT_MOTOR_PIN1, LEFT_MOTOR_PIN2, RIGHT_MOTOR_PIN1, RIGHT_MOTOR_PIN2, LEFT_MOTOR_PWM_PIN, RIGHT_MOTOR_PWM_PIN, ENCODER_LEFT_PIN, ENCODER_RIGHT_PIN);
 
+    // Track the pose of the robot from the encoders
+    initialise_odometry();
+
+#if ENCODER_PROFILE_CYCLES
+    // Compare the cycles of the encoder speed calculations
+    retrieve_encoder_speed_cycles();
+#endif
+
     // Initialize the Wi-Fi driver
     start_wifi();
 
@@ -612,14 +625,16 @@ int main()
     // Initialize the ultrasonic sensor
     initialise_ultrasonic();
 
-    // Enable interrupt on line sensor and barcode sensor
-    gpio_set_irq_enabled_with_callback(LEFT_LINE_SENSOR_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-    gpio_set_irq_enabled_with_callback(RIGHT_LINE_SENSOR_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-    gpio_set_irq_enabled_with_callback(BARCODE_SENSOR_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-
-    // Enable interrupt on encoder
-    gpio_set_irq_enabled_with_callback(ENCODER_LEFT_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
-    gpio_set_irq_enabled_with_callback(ENCODER_RIGHT_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
+#if IR_ADC_ENABLED
+    // Read the analog outputs of the IR sensors using the ADC and DMA
+    initialise_ir_adc();
+    // Use the IR thresholds stored by the last calibration
+    initialise_ir_calibration();
+#endif
+#if !BARCODE_USE_ADC
+    // Read the barcode from the digital output of the IR sensor using the GPIO interrupt
+    enable_barcode_interrupt();
+#endif
 
     // Configure the repeating timer to poll the Wi-Fi driver
     struct repeating_timer check_wifi;
@@ -627,7 +642,7 @@ int main()
 
     // Configure the repeating timer to poll the PID_controller
     struct repeating_timer pid_timer;
-    add_repeating_timer_ms(50, pid_control, NULL, &pid_timer);
+    add_repeating_timer_ms(-PID_CONTROL_PERIOD_MS, post_control_tick, NULL, &pid_timer);
 
     // struct repeating_timer ultrasonic_timer;
     // add_repeating_timer_ms(-50, &ultrasonic_sensor_handler, NULL, &ultrasonic_timer);
@@ -637,11 +652,28 @@ int main()
         ultraval = runUltrasonic();
         if (ultraval < 20)
         {
-            turn_right(LEFT_MOTOR_PIN1, LEFT_MOTOR_PIN2, RIGHT_MOTOR_PIN1, RIGHT_MOTOR_PIN2, 180);
+            turn_away_from_obstacle();
+        }
+
+        // Handle the events posted by the interrupts until the next ultrasonic reading
+        uint32_t loop_start_time = time_us_32();
+        while (time_us_32() - loop_start_time < MAIN_LOOP_PERIOD_US)
+        {
+            dispatch_events();
+            dispatch_commands();
+            update_junction_detector(time_us_32());
+            update_ir_calibration(time_us_32());
+
+            // Decode the barcode edges recorded by the barcode interrupt as they arrive
+            process_barcode_edges();
+            // Pass over the barcode again if the last read was not confident enough
+            update_barcode_rescan();
         }
-        sleep_ms(100);
         cyw43_arch_poll(); // Poll for Wi-Fi driver or lwIP work
 
+        // Catch line sensor changes that ended inside a dead-time
+        settle_line_sensors();
+
         // TODO: Mapping algorithm
     }
 
@@ -0,0 +1,195 @@
+/**
+ * @file motion_profile.h
+ * @brief Header file for the velocity profiles of the movements of the robot.
+ * @details
+ * Driving the wheels straight to the speed of a command makes them slip, which corrupts the encoder
+ * odometry and the barcode timing. Instead, every movement gets a velocity profile that the control loop
+ * steps once per tick, and whose speed is the wheel speed setpoint of that tick:
+ * 1) The speed ramps up from standstill with the acceleration limited to motion_max_acceleration.
+ * 2) The acceleration itself changes by at most motion_max_jerk per second, which rounds the corners
+ *    of the ramp into an S-curve. A jerk of 0 gives a trapezoidal profile.
+ * 3) With a target distance, the profile starts braking as soon as the distance it needs to stop, with the
+ *    same limits, reaches the distance left, so the deceleration is planned to end on the target.
+ *
+ * Distances are in wheel encoder ticks and speeds in ticks per second, the units of the wheel speed loops
+ * in motor.h, all in Q16.16 (see fixed_point.h). A pivot turns each wheel by the angle over
+ * ENCODER_DEGREES_PER_TICK ticks.
+ *
+ * @date November 23, 2023
+ */
+
+#ifndef MOTION_PROFILE_H
+#define MOTION_PROFILE_H
+
+#include "pico/stdlib.h"
+#include "fixed_point.h"
+
+// Define the default limits of the profiles
+#define MOTION_PROFILE_ACCELERATION Q16(30.0)   // Wheel ticks per second per second, about half a second to cruise speed
+#define MOTION_PROFILE_JERK Q16(150.0)          // Wheel ticks per second per second per second, 0 for a trapezoidal profile
+#define MOTION_PROFILE_TOLERANCE Q16(0.05)      // A profile within this many ticks of its distance has finished
+
+/**
+ * @brief State of the velocity profile of one movement.
+ */
+typedef struct
+{
+    q16_t max_speed;        // Cruise speed in ticks per second
+    q16_t max_acceleration; // Acceleration limit in ticks per second per second
+    q16_t max_jerk;         // Jerk limit in ticks per second per second per second, 0 for none
+    q16_t distance;         // Distance to stop at in ticks, 0 to cruise until the movement is stopped
+    q16_t position;         // Distance covered so far in ticks
+    q16_t speed;            // Speed setpoint in ticks per second
+    q16_t acceleration;     // Acceleration of the setpoint in ticks per second per second
+    bool braking;           // Flag set once the profile is stopping at its distance
+    bool finished;          // Flag set once the profile has reached its distance
+} motion_profile_t;
+
+q16_t motion_max_acceleration = MOTION_PROFILE_ACCELERATION;  // Acceleration limit of new profiles
+q16_t motion_max_jerk = MOTION_PROFILE_JERK;                  // Jerk limit of new profiles
+motion_profile_t motion_profile;                              // Profile of the current movement
+
+// Function prototypes
+void start_motion_profile(motion_profile_t *profile, q16_t max_speed, q16_t distance);
+q16_t get_braking_distance(const motion_profile_t *profile);
+q16_t update_motion_profile(motion_profile_t *profile, q16_t dt);
+
+/**
+ * @brief Start a profile from standstill with the current limits.
+ *
+ * @param profile Pointer to the profile.
+ * @param max_speed Cruise speed in ticks per second.
+ * @param distance Distance to stop at in ticks, 0 to cruise until the movement is stopped.
+ */
+void start_motion_profile(motion_profile_t *profile, q16_t max_speed, q16_t distance)
+{
+    profile->max_speed = max_speed;
+    profile->max_acceleration = motion_max_acceleration;
+    profile->max_jerk = motion_max_jerk;
+    profile->distance = distance;
+    profile->position = 0;
+    profile->speed = 0;
+    profile->acceleration = 0;
+    profile->braking = false;
+    profile->finished = false;
+}
+
+/**
+ * @brief Get the distance the profile needs to stop from its current speed and acceleration.
+ *
+ * @details
+ * With the jerk limit j, an acceleration a0 first takes t = a0 / j to ramp down, covering v t + a0 t^2 / 3
+ * and gaining a0 t / 2 of speed. From the speed v1 reached then, braking with the deceleration ramped in and
+ * out up to the acceleration limit a takes v1 * (v1 / a + a / j) / 2. Without a jerk limit it is v^2 / (2 a).
+ * Below a^2 / j the deceleration never reaches a, so the distance is an overestimate and the profile
+ * stops a little short, then creeps up to the target.
+ *
+ * @param profile Pointer to the profile.
+ * @return The braking distance in ticks.
+ */
+q16_t get_braking_distance(const motion_profile_t *profile)
+{
+    q16_t speed = profile->speed;
+    q16_t distance = 0;
+    q16_t ramp_time = 0;
+
+    if (profile->max_jerk > 0 && profile->acceleration > 0)
+    {
+        // Ramp the acceleration down to zero first
+        ramp_time = q16_div(profile->acceleration, profile->max_jerk);
+        distance = q16_add(q16_mul(speed, ramp_time), q16_mul(profile->acceleration, q16_mul(ramp_time, ramp_time)) / 3);
+        speed = q16_add(speed, q16_mul(profile->acceleration, ramp_time) / 2);
+    }
+
+    // Then brake, v^2 / (2 a) plus v a / (2 j) for the ramps of the deceleration
+    distance = q16_add(distance, q16_div(q16_mul(speed, speed), 2 * profile->max_acceleration));
+    if (profile->max_jerk > 0)
+    {
+        distance = q16_add(distance, q16_div(q16_mul(speed, profile->max_acceleration), 2 * profile->max_jerk));
+    }
+
+    return distance;
+}
+
+/**
+ * @brief Step the profile by one control tick.
+ *
+ * @details
+ * The speed is aimed at the cruise speed within the acceleration limit until the braking distance, half a
+ * tick ahead, reaches the distance left. From then on it is aimed at zero with the deceleration that stops
+ * on the target from the current speed, worked out again every tick so the errors of the discrete steps do
+ * not add up. Either way the acceleration is limited to what can still be ramped back to zero at the jerk
+ * limit by the time the speed arrives, and moves by at most the jerk limit times dt.
+ * A profile that stops short of its distance starts again from standstill for the rest of it.
+ * The profile finishes within MOTION_PROFILE_TOLERANCE of its distance, or if it has passed it.
+ *
+ * @param profile Pointer to the profile.
+ * @param dt Time since the previous tick in seconds, more than 0.
+ * @return The speed setpoint in ticks per second, 0 once the profile has finished.
+ */
+q16_t update_motion_profile(motion_profile_t *profile, q16_t dt)
+{
+    if (profile->finished)
+    {
+        return 0;
+    }
+
+    // Speed to aim for, and the acceleration limit towards it
+    q16_t speed_error = q16_sub(profile->max_speed, profile->speed);
+    q16_t limit = profile->max_acceleration;
+    if (profile->distance > 0)
+    {
+        // Finished once stopped close enough to the target, or past it
+        q16_t remaining = q16_sub(profile->distance, profile->position);
+        if (remaining <= 0 || (profile->speed == 0 && remaining <= MOTION_PROFILE_TOLERANCE))
+        {
+            profile->position = profile->distance;
+            profile->speed = 0;
+            profile->acceleration = 0;
+            profile->finished = true;
+            return 0;
+        }
+
+        // Brake once the braking distance half a tick ahead reaches the distance left
+        if (!profile->braking && remaining <= q16_add(get_braking_distance(profile), q16_mul(profile->speed, dt) / 2))
+        {
+            profile->braking = true;
+        }
+        if (profile->braking)
+        {
+            // Stop on the target with the deceleration v^2 / (2 d), worked out again every tick
+            speed_error = -profile->speed;
+            limit = q16_div(q16_mul(profile->speed, profile->speed), 2 * remaining);
+        }
+    }
+
+    // Acceleration that reaches the speed this tick, within the limit
+    q16_t acceleration = q16_clamp(q16_div(speed_error, dt), -limit, limit);
+    if (profile->max_jerk > 0)
+    {
+        // No more than can be ramped back to zero by the time the speed arrives
+        q16_t ramp_limit = q16_sqrt(q16_mul(2 * profile->max_jerk, q16_abs(speed_error)));
+        acceleration = q16_clamp(acceleration, -ramp_limit, ramp_limit);
+
+        // Change the acceleration at the jerk limit
+        q16_t jerk_step = q16_mul(profile->max_jerk, dt);
+        acceleration = q16_clamp(acceleration, q16_sub(profile->acceleration, jerk_step), q16_add(profile->acceleration, jerk_step));
+    }
+
+    // Integrate the speed, then the position with the average speed over the tick
+    q16_t speed = q16_clamp(q16_add(profile->speed, q16_mul(acceleration, dt)), 0, profile->max_speed);
+    profile->position = q16_add(profile->position, q16_mul(q16_add(profile->speed, speed) / 2, dt));
+    profile->speed = speed;
+    profile->acceleration = acceleration;
+
+    // Stopped short of the distance, plan the rest of it from standstill
+    if (profile->braking && speed == 0)
+    {
+        profile->braking = false;
+        profile->acceleration = 0;
+    }
+
+    return speed;
+}
+
+#endif // MOTION_PROFILE_H
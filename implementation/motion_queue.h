@@ -0,0 +1,320 @@
+/**
+ * @file motion_queue.h
+ * @brief Header file for the queue of motion commands run one after the other by the control loop.
+ * @details
+ * Calling a motion function starts its movement straight away and replaces the one before it, so a turn
+ * followed by move_forward() never turned. Instead, movements are queued as commands and run in order:
+ * 1) queue_motion() adds a command to the end of the queue.
+ * 2) update_motion_queue() runs after every control step and is the only place a command is started. A command
+ *    has finished once the control loop has stopped its movement, or a timed velocity command has run for its time,
+ *    and the next command starts on the same step, without waiting for the TCP client.
+ * 3) Every command that ends is passed to handle_motion_complete(), finished or cut short.
+ *
+ * The commands are the movements of motor.h: a distance (move_distance()), an angle (rotate_by()),
+ * an arc (move_arc()) and a velocity for a time (move_forward() or move_backward()). A velocity command
+ * without a time drives on until the next command is queued.
+ * preempt_motion() cuts the current command short and drops the queue, so the next command queued takes
+ * over at the next control step, and clear_motion_queue() also stops the robot. Anything else that drives the
+ * motors itself, like the IR calibration sweep, holds the queue with hold_motion_queue() until it is done.
+ *
+ * Every function here starts or stops the motors and so is only called from thread context, never from an
+ * interrupt or the lwIP callbacks: commands from the TCP client are passed on through the command ring of wifi.h.
+ * With a single context using it, the queue needs no lock.
+ *
+ * @date November 24, 2023
+ */
+
+#ifndef MOTION_QUEUE_H
+#define MOTION_QUEUE_H
+
+#include "pico/stdlib.h"
+
+// Number of commands that can wait, must be a power of 2
+#define MOTION_QUEUE_SIZE 16
+#define MOTION_QUEUE_MASK (MOTION_QUEUE_SIZE - 1)
+// Event sent to the TCP client for every command that ends, with its type, its number and DONE or CANCELLED
+#define MOTION_EVENT_FORMAT "MOTION:%s,%lu,%s\n"
+
+/**
+ * @brief Types of motion command.
+ */
+typedef enum
+{
+    MOTION_DISTANCE,    // Drive straight for a distance
+    MOTION_ANGLE,       // Pivot by an angle
+    MOTION_ARC,         // Drive forward along an arc
+    MOTION_VELOCITY,    // Drive straight at a speed for a time
+} motion_type_t;
+
+/**
+ * @brief A motion command waiting in the queue.
+ */
+typedef struct
+{
+    motion_type_t type;     // What kind of movement
+    float speed;            // Speed as for move_forward(), negative to drive a velocity command backward
+    float amount;           // Distance in cm, negative backward, or angle in degrees, negative anticlockwise
+    float radius;           // Radius of an arc in cm
+    uint32_t duration_ms;   // Time a velocity command runs for, 0 until the next command is queued
+    uint32_t id;            // Number of the command, counted from start up
+} motion_command_t;
+
+motion_command_t motion_queue[MOTION_QUEUE_SIZE];
+uint32_t motion_queue_head = 0;         // Number of commands queued, also the number of the next command
+uint32_t motion_queue_tail = 0;         // Number of commands taken out of the queue
+uint32_t motion_queue_overruns = 0;     // Number of commands dropped because the queue was full
+motion_command_t motion_current;        // Command being run
+bool motion_active = false;             // Flag set while motion_current is running
+bool motion_queue_held = false;         // Flag set while something outside the queue drives the motors
+uint32_t motion_start_time = 0;         // Time motion_current started from time_us_32()
+
+// Function prototypes
+const char *get_motion_name(motion_type_t type);
+bool queue_motion(const motion_command_t *command);
+bool queue_distance(float speed, float distance);
+bool queue_angle(float speed, float angle);
+bool queue_arc(float speed, float radius, float angle);
+bool queue_velocity(float speed, uint32_t duration_ms);
+void start_motion(const motion_command_t *command, uint32_t now);
+void end_motion(bool completed);
+void update_motion_queue(uint32_t now);
+void preempt_motion();
+void clear_motion_queue();
+void hold_motion_queue(bool held);
+void handle_motion_complete(const motion_command_t *command, bool completed);
+
+/**
+ * @brief Get the name of a motion type, as sent to the TCP client.
+ *
+ * @param type The motion type.
+ * @return The name of the type.
+ */
+const char *get_motion_name(motion_type_t type)
+{
+    // Names of the motion types, in the order of motion_type_t
+    static const char *names[] = {"DISTANCE", "ANGLE", "ARC", "VELOCITY"};
+
+    return names[type];
+}
+
+/**
+ * @brief Add a command to the end of the queue, update_motion_queue() starts it once the commands before it are done.
+ *
+ * @param command The command, its number is filled in.
+ * @return true if the command was queued, false if the queue was full.
+ */
+bool queue_motion(const motion_command_t *command)
+{
+    // Drop the command if too many are waiting
+    if (motion_queue_head - motion_queue_tail >= MOTION_QUEUE_SIZE)
+    {
+        motion_queue_overruns++;
+        return false;
+    }
+
+    motion_queue[motion_queue_head & MOTION_QUEUE_MASK] = *command;
+    motion_queue[motion_queue_head & MOTION_QUEUE_MASK].id = motion_queue_head;
+    motion_queue_head++;
+
+    return true;
+}
+
+/**
+ * @brief Queue a straight move to a distance, see move_distance().
+ *
+ * @param speed The speed at which the robot should move.
+ * @param distance The distance to move in cm, negative to move backward.
+ * @return true if the command was queued, false if the queue was full.
+ */
+bool queue_distance(float speed, float distance)
+{
+    motion_command_t command = {.type = MOTION_DISTANCE, .speed = speed, .amount = distance};
+    return queue_motion(&command);
+}
+
+/**
+ * @brief Queue a pivot by an angle, see rotate_by().
+ *
+ * @param speed The speed at which the robot should turn.
+ * @param angle The angle to turn in degrees, clockwise, negative to turn anticlockwise.
+ * @return true if the command was queued, false if the queue was full.
+ */
+bool queue_angle(float speed, float angle)
+{
+    motion_command_t command = {.type = MOTION_ANGLE, .speed = speed, .amount = angle};
+    return queue_motion(&command);
+}
+
+/**
+ * @brief Queue a move along an arc, see move_arc().
+ *
+ * @param speed The speed at which the robot should move.
+ * @param radius The radius of the arc in cm.
+ * @param angle The angle to turn through in degrees, clockwise, negative to turn anticlockwise.
+ * @return true if the command was queued, false if the queue was full.
+ */
+bool queue_arc(float speed, float radius, float angle)
+{
+    motion_command_t command = {.type = MOTION_ARC, .speed = speed, .amount = angle, .radius = radius};
+    return queue_motion(&command);
+}
+
+/**
+ * @brief Queue a straight move at a speed for a time.
+ *
+ * @param speed The speed at which the robot should move, negative to move backward.
+ * @param duration_ms How long to move for in milliseconds, 0 to move until the next command is queued.
+ * @return true if the command was queued, false if the queue was full.
+ */
+bool queue_velocity(float speed, uint32_t duration_ms)
+{
+    motion_command_t command = {.type = MOTION_VELOCITY, .speed = speed, .duration_ms = duration_ms};
+    return queue_motion(&command);
+}
+
+/**
+ * @brief Start the movement of a command.
+ *
+ * @param command The command.
+ * @param now Current time from time_us_32().
+ */
+void start_motion(const motion_command_t *command, uint32_t now)
+{
+    motion_current = *command;
+    motion_active = true;
+    motion_start_time = now;
+
+    switch (command->type)
+    {
+    case MOTION_DISTANCE:
+        move_distance(command->speed, command->amount);
+        break;
+
+    case MOTION_ANGLE:
+        rotate_by(command->speed, command->amount);
+        break;
+
+    case MOTION_ARC:
+        move_arc(command->speed, command->radius, command->amount);
+        break;
+
+    case MOTION_VELOCITY:
+        if (command->speed < 0)
+        {
+            move_backward(-command->speed);
+        }
+        else
+        {
+            move_forward(command->speed);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Finish with the current command and report it.
+ *
+ * @param completed true if the command ran to its end, false if it was cut short.
+ */
+void end_motion(bool completed)
+{
+    motion_active = false;
+    handle_motion_complete(&motion_current, completed);
+}
+
+/**
+ * @brief End the current command once it has finished, and start the next one.
+ *
+ * @details
+ * Called from the main loop after every control step. The control loop stops the movement of a distance,
+ * angle or arc command at its end, while a velocity command is stopped here after its time. A velocity
+ * command without a time ends as soon as another command is waiting.
+ * Nothing is ended or started while the queue is held.
+ *
+ * @param now Current time from time_us_32().
+ */
+void update_motion_queue(uint32_t now)
+{
+    // The motors belong to whoever holds the queue
+    if (motion_queue_held)
+    {
+        return;
+    }
+
+    bool waiting = motion_queue_head != motion_queue_tail;
+
+    if (motion_active)
+    {
+        if (movement_direction == 'x')
+        {
+            end_motion(true);
+        }
+        else if (motion_current.type == MOTION_VELOCITY)
+        {
+            if (motion_current.duration_ms > 0 && now - motion_start_time >= motion_current.duration_ms * 1000)
+            {
+                stop_motors();
+                end_motion(true);
+            }
+            else if (motion_current.duration_ms == 0 && waiting)
+            {
+                // The next command takes over the motors
+                end_motion(true);
+            }
+        }
+    }
+
+    // Start the next command on the same step
+    if (!motion_active && waiting)
+    {
+        start_motion(&motion_queue[motion_queue_tail & MOTION_QUEUE_MASK], now);
+        motion_queue_tail++;
+    }
+}
+
+/**
+ * @brief Cut the current command short and drop the waiting ones.
+ *
+ * @details
+ * The motors are left running on the last setpoint, so the next command queued takes over from the movement
+ * without stopping. The caller must queue that command straight away, or call clear_motion_queue() instead
+ * if the robot is to stop.
+ */
+void preempt_motion()
+{
+    motion_queue_tail = motion_queue_head;
+
+    if (motion_active)
+    {
+        end_motion(false);
+    }
+}
+
+/**
+ * @brief Cut the current command short, drop the waiting ones and stop the robot.
+ */
+void clear_motion_queue()
+{
+    preempt_motion();
+    stop_motors();
+}
+
+/**
+ * @brief Hold the queue while something outside it drives the motors, or release it again.
+ *
+ * @details
+ * The current command is cut short when the queue is held, as its movement is replaced. Commands queued
+ * while the queue is held wait, and start once it is released.
+ *
+ * @param held true to hold the queue, false to release it.
+ */
+void hold_motion_queue(bool held)
+{
+    if (held && motion_active)
+    {
+        end_motion(false);
+    }
+    motion_queue_held = held;
+}
+
+#endif // MOTION_QUEUE_H
@@ -16,8 +16,14 @@
 #include <stdbool.h>
 #include "pico/time.h"
 #include <math.h>
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
 
 #include "magnetometer.h"
+#include "gpio_dispatch.h"
+#include "debounce.h"
+#include "fixed_point.h"
+#include "motion_profile.h"
 
 // Global variables for GPIO Pin
 uint8_t left_encoder_pin = 2; 
@@ -29,33 +35,125 @@ uint8_t input_2 = 13;
 uint8_t input_3 = 12;
 uint8_t input_4 = 11;
 
+/**
+ * @brief Velocity estimate of one wheel.
+ */
+typedef struct
+{
+    int count;              // Encoder count at the last edge used
+    uint32_t edge_time;     // Time of the last edge used
+    bool moving;            // Flag set while edge_time is recent enough to measure from
+    int32_t speed;          // Speed in 1/ENCODER_SPEED_SCALE ticks per second
+} encoder_velocity_t;
+
+/**
+ * @brief State of one PID loop, all in Q16.16 fixed point (see fixed_point.h).
+ */
+typedef struct
+{
+    q16_t kp;               // Proportional gain
+    q16_t ki;               // Integral gain, per second
+    q16_t kd;               // Derivative gain, in seconds
+    q16_t output_min;       // Lowest output
+    q16_t output_max;       // Highest output
+    q16_t integral;         // Integral of the error over time
+    q16_t previous_error;   // Error at the previous step
+    bool started;           // Flag set once previous_error holds an error
+} pid_loop_t;
+
+// Define the motor controller, in Q16.16 apart from the PWM wrap and the period
+#define PID_PWM_MAX 12500                       // PWM wrap, the highest level a motor can be driven at
+#define PID_CONTROL_PERIOD_MS 20                // Period of the control tick
+#define PID_WHEEL_FEEDFORWARD Q16(400.0)        // PWM level per tick per second of wheel speed, about 31 ticks/s at PID_PWM_MAX
+#define PID_CONTROL_PERIOD_S Q16(PID_CONTROL_PERIOD_MS / 1000.0) // dt of the first step of a movement
+#define PID_MAX_DT_S Q16(0.2)                   // Longest dt, so a held up step does not wind up the integrals
+#define PID_HEADING_TOLERANCE Q16(5.0)          // A pivot stops within this many degrees of its angle
+#define PID_TURN_GAIN Q16(0.5)                  // Pivot wheel speed in ticks per second per degree still to turn
+#define PID_TURN_MIN_SPEED Q16(4.0)             // Slowest pivot wheel speed in ticks per second, so the turn always finishes
+#define PID_TURN_BACKLASH Q16(30.0)             // A pivot that starts up to this many degrees the wrong way has not turned yet
+#define PID_POSITION_GAIN Q16(4.0)              // Extra wheel speed in ticks per second per tick the robot is behind its profile
+#define PID_COAST_TIME_S Q16(0.1)               // With the power cut, the robot rolls on for about this long at its speed
+#define PID_POSITION_TOLERANCE Q16(0.25)        // A movement to a distance stops within this many ticks of it
+
 // Function prototypes
 void move_forward(float speed);
 void move_backward(float speed);
 void turn_left(float speed, float angle);
 void turn_right(float speed, float angle);
+void move_distance(float speed, float distance);
+void rotate_by(float speed, float angle);
+void move_arc(float speed, float radius, float angle);
 void stop_motors();
+int32_t get_wheel_position(int count, uint32_t last_pulse_time, uint32_t period, uint32_t now);
+int32_t get_encoder_position(uint32_t now);
+void reset_wheel_velocity(encoder_velocity_t *velocity, int count);
+int32_t filter_encoder_speed(int32_t filtered_speed, int32_t raw_speed);
+void update_wheel_velocity(encoder_velocity_t *velocity, int count, uint32_t last_pulse_time, uint32_t period, uint32_t now);
+void update_encoder_speeds(uint32_t now);
+q16_t get_wheel_speed(const encoder_velocity_t *velocity);
+void retrieve_encoder_speed_cycles();
+int8_t get_hbridge_direction(uint forward_pin, uint backward_pin);
+int8_t get_tick_direction(int8_t counted_direction, int8_t driven_direction, uint32_t time_since_last_pulse);
+void handle_encoder_event(uint pin, uint32_t edge, uint32_t timestamp);
+void reset_pid_loop(pid_loop_t *loop);
+q16_t update_pid_loop(pid_loop_t *loop, q16_t error, q16_t feedforward, q16_t dt);
+q16_t wrap_heading_error(q16_t error);
+bool pid_control();
 void initialise_motors(uint8_t left_motor_pin1, uint8_t left_motor_pin2, uint8_t right_motor_pin1, uint8_t right_motor_pin2, uint8_t left_motor_pwm_pin, uint8_t right_motor_pwm_pin, uint8_t encoder_left_pin, uint8_t encoder_right_pin);
 
-float start_heading = 0.0;
-float current_heading = 0.0;
-float target_heading = 0.0;
-float set_heading = 0.0;
-volatile int left_encoder_count = 0;
-volatile int right_encoder_count = 0;
-double left_encoder_speed = 0.0;
-double right_encoder_speed = 0.0;
-
-volatile char movement_direction = 'x'; // w = forward, s = backward, a = left, d = right, x = stop
-
-float kp = 0.1;  // Proportional gain
-float ki = 0.01; // Integral gain
-float kd = 0.01; // Derivative gain
-float I = 0.0;   // Integral term
-float P = 0.0;   // Proportional term
-float D = 0.0;   // Derivative term
+q16_t start_heading = 0;     // Heading at the start of the movement in degrees
+q16_t current_heading = 0;   // Heading at the latest control step in degrees
+q16_t target_heading = 0;    // Heading to hold or turn to in degrees
+q16_t set_heading = 0;       // Angle of the current turn in degrees
+volatile int left_encoder_count = 0;          // Left encoder ticks since the movement started, either way
+volatile int right_encoder_count = 0;         // Right encoder ticks since the movement started, either way
+volatile int8_t left_encoder_direction = 1;   // Direction the left ticks are counted in, 1 forward, -1 backward
+volatile int8_t right_encoder_direction = 1;  // Direction the right ticks are counted in, 1 forward, -1 backward
+volatile int32_t left_encoder_displacement = 0;   // Net left ticks since start up, forward minus backward
+volatile int32_t right_encoder_displacement = 0;  // Net right ticks since start up, forward minus backward
+volatile uint32_t left_encoder_travelled = 0;     // Left ticks since start up either way
+volatile uint32_t right_encoder_travelled = 0;    // Right ticks since start up either way
+encoder_velocity_t left_encoder_velocity;     // Velocity estimate of the left wheel, read with get_wheel_speed()
+encoder_velocity_t right_encoder_velocity;    // Velocity estimate of the right wheel, read with get_wheel_speed()
+volatile uint32_t left_last_pulse_time = 0;  // Time of the last left encoder edge
+volatile uint32_t right_last_pulse_time = 0; // Time of the last right encoder edge
+volatile uint32_t left_encoder_period = 0;   // Time between the last two left encoder edges in microseconds
+volatile uint32_t right_encoder_period = 0;  // Time between the last two right encoder edges in microseconds
+
+volatile char movement_direction = 'x'; // w = forward, s = backward, a = left, d = right, f = follow line, c = IR calibration, x = stop
+
+debounce_t left_encoder_debounce;      // Debounce state of the left encoder pin
+debounce_t right_encoder_debounce;     // Debounce state of the right encoder pin
+
+q16_t movement_speed = 0;    // PWM level the current movement was started with
+bool movement_to_target = false; // Flag set while the movement stops on the encoders, see move_distance() and rotate_by()
+q16_t movement_curvature = 0;    // Half the wheel base over the radius of the arc driven, positive clockwise, 0 to hold the heading
+
+// Outer loop: heading error in degrees to a wheel speed difference in ticks per second
+pid_loop_t heading_pid = {.kp = Q16(0.3), .ki = Q16(0.1), .kd = Q16(0.02), .output_min = Q16(-8.0), .output_max = Q16(8.0)};
+// Inner loops: wheel speed error in ticks per second to a PWM level
+pid_loop_t left_speed_pid = {.kp = Q16(150.0), .ki = Q16(400.0), .kd = 0, .output_min = 0, .output_max = Q16(PID_PWM_MAX)};
+pid_loop_t right_speed_pid = {.kp = Q16(150.0), .ki = Q16(400.0), .kd = 0, .output_min = 0, .output_max = Q16(PID_PWM_MAX)};
+uint32_t pid_previous_time = 0;  // Time of the previous control step
+bool pid_running = false;        // Flag set once the current movement has had a control step
 
 #define SPEED 6250
+#define ENCODER_POSITION_SCALE 256 // Encoder positions are in 1/256 of an encoder tick
+#define ENCODER_SPEED_SCALE 256 // Filtered encoder speeds are in 1/256 tick per second
+#define ENCODER_SPEED_FILTER_SHIFT 1 // Each control step moves the filtered speed 1/2 of the way to the new window
+#define ENCODER_SPEED_TIMEOUT_US 500000 // No tick for this long means the wheel has stopped
+#define ENCODER_DEGREES_PER_TICK 4.6 // Turn of the robot per right encoder tick when pivoting
+#define ENCODER_TICKS_PER_REVOLUTION 20 // Encoder ticks per turn of a wheel
+#define ENCODER_DISTANCE_PER_TICK_CM (3.141592654 * 7.0 / ENCODER_TICKS_PER_REVOLUTION) // Distance a 7 cm wheel rolls per tick
+#define ENCODER_WHEEL_BASE_CM 14.0 // Track width, measured between the middles of the two tyres
+// Turn of a pivot per tick if the tyres did not slip, one wheel tick forward and one back over the wheel base
+#define ENCODER_PIVOT_GEOMETRY_DEGREES_PER_TICK (2.0 * ENCODER_DISTANCE_PER_TICK_CM / ENCODER_WHEEL_BASE_CM * 180.0 / 3.141592654)
+// Share of that turn the robot makes when pivoting on the spot, from the ENCODER_DEGREES_PER_TICK calibration, as the tyres scrub
+#define ENCODER_PIVOT_TURN_RATIO (ENCODER_DEGREES_PER_TICK / ENCODER_PIVOT_GEOMETRY_DEGREES_PER_TICK)
+#define ENCODER_PIVOT_TURN_RATIO_MIN 0.4 // Outside 0.4 to 1 the turn calibration and the wheel base disagree, measure both again
+#define ENCODER_REVERSAL_GAP_US 150000 // A wheel driven against its ticks has stopped and reversed after a gap this long
+#define ENCODER_PROFILE_CYCLES 0 // Set to 1 to compare the cycles of the encoder speed calculations at start up
+#define ENCODER_PROFILE_RUNS 1000 // Calls timed by retrieve_encoder_speed_cycles()
 #endif // MOTOR_H
 
 /**
@@ -70,25 +168,384 @@ void set_speed(float left_motor_speed, float right_motor_speed)
     pwm_set_gpio_level(motor_enable_pin_B, right_motor_speed);
 }
 
+/**
+ * @brief Function to get the position of one wheel in fractions of an encoder tick.
+ *
+ * @details
+ * The encoder only gives about 20 ticks per revolution, which is too coarse to measure a barcode bar.
+ * The position between two ticks is estimated from the time since the last tick and the time
+ * between the last two ticks, and is kept below one whole tick so it never runs ahead of the next tick.
+ *
+ * @param count Encoder count of the wheel.
+ * @param last_pulse_time Time of the last encoder edge of the wheel.
+ * @param period Time between the last two encoder edges of the wheel, 0 if unknown.
+ * @param now Time to get the position at.
+ * @return The position of the wheel in 1/ENCODER_POSITION_SCALE encoder ticks.
+ */
+int32_t get_wheel_position(int count, uint32_t last_pulse_time, uint32_t period, uint32_t now)
+{
+    int32_t position = count * ENCODER_POSITION_SCALE;
+
+    // Interpolate between ticks only when the wheel is known to be turning
+    if (period > 0)
+    {
+        uint32_t elapsed = now - last_pulse_time;
+
+        // A time before the last tick (a sample that is processed late) stays at the tick
+        if ((int32_t)elapsed < 0)
+        {
+            elapsed = 0;
+        }
+
+        if (elapsed >= period)
+        {
+            // Overdue tick, so the wheel is slowing down. Stay just short of the next tick
+            position += ENCODER_POSITION_SCALE - 1;
+        }
+        else
+        {
+            position += (elapsed * ENCODER_POSITION_SCALE) / period;
+        }
+    }
+
+    return position;
+}
+
+/**
+ * @brief Function to get the distance travelled by the robot in fractions of an encoder tick.
+ *
+ * @details
+ * The average of the left and right wheel positions. Safe to call from an interrupt.
+ *
+ * @param now Time to get the position at, from time_us_32().
+ * @return The position of the robot in 1/ENCODER_POSITION_SCALE encoder ticks.
+ */
+int32_t get_encoder_position(uint32_t now)
+{
+    int32_t left_position = get_wheel_position(left_encoder_count, left_last_pulse_time, left_encoder_period, now);
+    int32_t right_position = get_wheel_position(right_encoder_count, right_last_pulse_time, right_encoder_period, now);
+
+    return (left_position + right_position) / 2;
+}
+
+/**
+ * @brief Function to start the velocity estimate of a wheel from standstill.
+ *
+ * @param velocity Pointer to the velocity estimate of the wheel.
+ * @param count Current encoder count of the wheel.
+ */
+void reset_wheel_velocity(encoder_velocity_t *velocity, int count)
+{
+    velocity->count = count;
+    velocity->edge_time = 0;
+    velocity->moving = false;
+    velocity->speed = 0;
+}
+
+/**
+ * @brief Function to run one step of the first order low pass filter of a wheel speed.
+ *
+ * @param filtered_speed Filtered speed after the previous step.
+ * @param raw_speed Speed measured over the latest window.
+ * @return The new filtered speed, 1/2^ENCODER_SPEED_FILTER_SHIFT of the way to the raw speed.
+ */
+int32_t filter_encoder_speed(int32_t filtered_speed, int32_t raw_speed)
+{
+    return filtered_speed + ((raw_speed - filtered_speed) >> ENCODER_SPEED_FILTER_SHIFT);
+}
+
+/**
+ * @brief Function to update the velocity estimate of a wheel with the M/T method.
+ *
+ * @details
+ * Called once per control step with a copy of what the encoder interrupt recorded.
+ * 1) Ticks since the last step: the speed is the number of ticks over the exact time between the last
+ *    edge used before and the latest edge. Counting over the whole window smooths the speed at high speed,
+ *    and timing between edges instead of over the window keeps it exact at crawl speed.
+ * 2) No tick since the last step: the wheel cannot be turning faster than one tick over the time since
+ *    the last edge, so the speed is held at or below that bound and decays to zero as the wait goes on.
+ * 3) No tick for ENCODER_SPEED_TIMEOUT_US: the wheel has stopped and the speed is zero, which bounds how
+ *    long a stopped wheel can read as moving.
+ * From standstill the first edge only starts the measurement, the period of the first two edges gives the speed.
+ *
+ * @param velocity Pointer to the velocity estimate of the wheel.
+ * @param count Encoder count of the wheel.
+ * @param last_pulse_time Time of the last encoder edge of the wheel.
+ * @param period Time between the last two encoder edges of the wheel.
+ * @param now Current time from time_us_32().
+ */
+void update_wheel_velocity(encoder_velocity_t *velocity, int count, uint32_t last_pulse_time, uint32_t period, uint32_t now)
+{
+    int ticks = count - velocity->count;
+
+    // The counts were reset by a new movement, start again from standstill
+    if (ticks < 0)
+    {
+        reset_wheel_velocity(velocity, count);
+        return;
+    }
+
+    if (ticks > 0)
+    {
+        uint32_t elapsed = last_pulse_time - velocity->edge_time;
+
+        if (velocity->moving && elapsed > 0)
+        {
+            // Ticks over the time they took, in 64 bits as several ticks overflow 32 bits at this scale
+            int32_t speed = ((uint64_t)ticks * 1000000u * ENCODER_SPEED_SCALE) / elapsed;
+            velocity->speed = filter_encoder_speed(velocity->speed, speed);
+        }
+        else if (period > 0 && period < ENCODER_SPEED_TIMEOUT_US)
+        {
+            // Just started moving, the last two edges are both recent
+            velocity->speed = (1000000u * ENCODER_SPEED_SCALE) / period;
+        }
+
+        velocity->count = count;
+        velocity->edge_time = last_pulse_time;
+        velocity->moving = true;
+        return;
+    }
+
+    uint32_t waited = now - velocity->edge_time;
+    if (!velocity->moving || waited > ENCODER_SPEED_TIMEOUT_US)
+    {
+        // Stopped
+        velocity->moving = false;
+        velocity->speed = 0;
+    }
+    else if (waited > 0)
+    {
+        // Not faster than one tick over the time since the last edge
+        int32_t bound = (1000000u * ENCODER_SPEED_SCALE) / waited;
+        if (bound < velocity->speed)
+        {
+            velocity->speed = bound;
+        }
+    }
+}
+
+/**
+ * @brief Function to update the velocity estimates of both wheels.
+ *
+ * @details
+ * Called from thread context at the control rate, before the PID controller reads the speeds.
+ * The values recorded by the encoder interrupt are copied with interrupts disabled, so the
+ * count, the period and the time of a tick always belong together.
+ *
+ * @param now Current time from time_us_32().
+ */
+void update_encoder_speeds(uint32_t now)
+{
+    uint32_t interrupts = save_and_disable_interrupts();
+    int left_count = left_encoder_count;
+    uint32_t left_time = left_last_pulse_time;
+    uint32_t left_period = left_encoder_period;
+    int right_count = right_encoder_count;
+    uint32_t right_time = right_last_pulse_time;
+    uint32_t right_period = right_encoder_period;
+    restore_interrupts(interrupts);
+
+    update_wheel_velocity(&left_encoder_velocity, left_count, left_time, left_period, now);
+    update_wheel_velocity(&right_encoder_velocity, right_count, right_time, right_period, now);
+}
+
+/**
+ * @brief Function to get the speed of a wheel, the only way the controllers read wheel speeds.
+ *
+ * @param velocity Pointer to the velocity estimate of the wheel, left_encoder_velocity or right_encoder_velocity.
+ * @return The speed of the wheel in ticks per second, in Q16.16.
+ */
+q16_t get_wheel_speed(const encoder_velocity_t *velocity)
+{
+    return q16_saturate((int64_t)velocity->speed * Q16_ONE / ENCODER_SPEED_SCALE);
+}
+
+#if ENCODER_PROFILE_CYCLES
+/**
+ * @brief Function to print how many cycles the encoder speed calculations take.
+ *
+ * @details
+ * The Cortex-M0+ has no cycle counter, so SysTick is run from the processor clock and
+ * ENCODER_PROFILE_RUNS calls of each calculation are timed, loop included:
+ * 1) The double precision division the encoder interrupt used to do on every tick.
+ * 2) What the encoder interrupt does now, storing the integer period.
+ * 3) The fixed-point M/T velocity step, done once per wheel per control step.
+ */
+void retrieve_encoder_speed_cycles()
+{
+    volatile uint32_t period = 12345;   // Volatile so nothing is worked out at compile time
+    volatile double double_speed;
+    volatile uint32_t stored_period;
+    encoder_velocity_t velocity;
+    uint32_t start;
+
+    // Count down from the processor clock with no interrupt
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;
+
+    start = systick_hw->cvr;
+    for (int i = 0; i < ENCODER_PROFILE_RUNS; i++)
+    {
+        double_speed = 1000000.0 / period;
+    }
+    uint32_t double_cycles = (start - systick_hw->cvr) & 0x00FFFFFF;
+
+    start = systick_hw->cvr;
+    for (int i = 0; i < ENCODER_PROFILE_RUNS; i++)
+    {
+        stored_period = period;
+    }
+    uint32_t integer_cycles = (start - systick_hw->cvr) & 0x00FFFFFF;
+
+    // One tick per step, the slowest path
+    reset_wheel_velocity(&velocity, 0);
+    start = systick_hw->cvr;
+    for (int i = 0; i < ENCODER_PROFILE_RUNS; i++)
+    {
+        update_wheel_velocity(&velocity, i + 1, (i + 1) * period, period, (i + 1) * period);
+    }
+    uint32_t filter_cycles = (start - systick_hw->cvr) & 0x00FFFFFF;
+    (void)double_speed;
+    (void)stored_period;
+
+    printf("Encoder speed cycles per call: double in interrupt %u, integer in interrupt %u, fixed-point M/T step %u\n",
+           double_cycles / ENCODER_PROFILE_RUNS, integer_cycles / ENCODER_PROFILE_RUNS, filter_cycles / ENCODER_PROFILE_RUNS);
+}
+#endif
+
+/**
+ * @brief Function to get which way the H-bridge drives a motor.
+ *
+ * @param forward_pin The H-bridge input that drives the motor forward.
+ * @param backward_pin The H-bridge input that drives the motor backward.
+ * @return 1 if driven forward, -1 if driven backward, 0 if not driven.
+ */
+int8_t get_hbridge_direction(uint forward_pin, uint backward_pin)
+{
+    bool forward = gpio_get_out_level(forward_pin);
+    bool backward = gpio_get_out_level(backward_pin);
+
+    if (forward == backward)
+    {
+        return 0;
+    }
+
+    return forward ? 1 : -1;
+}
+
+/**
+ * @brief Function to get the direction of an encoder tick.
+ *
+ * @details
+ * The encoders have a single channel, so the direction follows the H-bridge, except while the wheel
+ * has not caught up with it yet:
+ * 1) Not driven (stopped motors), the wheel coasts on in the direction it was turning.
+ * 2) Driven the other way, the wheel first slows down and only reverses after passing through standstill.
+ *    Ticks keep their old direction until one arrives after a gap of ENCODER_REVERSAL_GAP_US.
+ *
+ * @param counted_direction Direction of the previous ticks of the wheel.
+ * @param driven_direction Direction from get_hbridge_direction().
+ * @param time_since_last_pulse Time since the previous tick of the wheel.
+ * @return The direction of this tick, 1 forward, -1 backward.
+ */
+int8_t get_tick_direction(int8_t counted_direction, int8_t driven_direction, uint32_t time_since_last_pulse)
+{
+    if (driven_direction != 0 && driven_direction != counted_direction && time_since_last_pulse > ENCODER_REVERSAL_GAP_US)
+    {
+        return driven_direction;
+    }
+
+    return counted_direction;
+}
+
+/**
+ * @brief Function to handle the edges of both wheel encoders.
+ *
+ * @details
+ * Called from the GPIO interrupt through gpio_dispatch.h. Every edge is debounced by its timestamp,
+ * and each accepted rising edge counts one tick and measures the time since the previous tick.
+ * Every tick also gets a direction from get_tick_direction() for the net displacement of the wheel,
+ * while the travelled ticks and the movement counts go up either way.
+ * Only integer counts and times are recorded here, the RP2040 has no FPU, so the speeds are
+ * worked out and filtered by update_encoder_speeds() at the control rate instead.
+ *
+ * @param pin The encoder pin.
+ * @param edge Mask of the edges seen on the pin.
+ * @param timestamp Time of the edge from time_us_32().
+ */
+void handle_encoder_event(uint pin, uint32_t edge, uint32_t timestamp)
+{
+    if (pin == left_encoder_pin)
+    {
+        // Check if it's an accepted rising edge, indicating a pulse
+        if (debounce_edge(&left_encoder_debounce, timestamp, gpio_edge_level(pin, edge)) && left_encoder_debounce.level)
+        {
+            uint32_t time_since_last_pulse = timestamp - left_last_pulse_time;
+            left_encoder_count++;
+
+            // The left motor runs forward with input_1 high and backward with input_2 high
+            left_encoder_direction = get_tick_direction(left_encoder_direction, get_hbridge_direction(input_1, input_2), time_since_last_pulse);
+            left_encoder_displacement += left_encoder_direction;
+            left_encoder_travelled++;
+
+            // Record the time between pulses, the speed is worked out at the control rate
+            if (time_since_last_pulse != 0)
+            {
+                left_encoder_period = time_since_last_pulse;
+            }
+
+            // Update the time of the last pulse
+            left_last_pulse_time = timestamp;
+        }
+    }
+    else if (pin == right_encoder_pin)
+    {
+        // Check if it's an accepted rising edge, indicating a pulse
+        if (debounce_edge(&right_encoder_debounce, timestamp, gpio_edge_level(pin, edge)) && right_encoder_debounce.level)
+        {
+            uint32_t time_since_last_pulse = timestamp - right_last_pulse_time;
+
+            // Increment the right encoder count for each rising edge
+            right_encoder_count++;
+
+            // The right motor runs forward with input_4 high and backward with input_3 high
+            right_encoder_direction = get_tick_direction(right_encoder_direction, get_hbridge_direction(input_4, input_3), time_since_last_pulse);
+            right_encoder_displacement += right_encoder_direction;
+            right_encoder_travelled++;
+
+            // Record the time between pulses, the speed is worked out at the control rate
+            if (time_since_last_pulse != 0)
+            {
+                right_encoder_period = time_since_last_pulse;
+            }
+
+            // Update the time of the last pulse
+            right_last_pulse_time = timestamp;
+        }
+    }
+}
+
 /**
  * @brief Function to calculate a new heading after a turn.
- * @param current_heading Current heading.
- * @param angle Angle of the turn.
+ * @param current_heading Current heading in degrees.
+ * @param angle Angle of the turn in degrees.
  * @param is_left_turn Boolean indicating if it's a left turn.
- * @return The new heading after the turn.
+ * @return The new heading after the turn in degrees.
  */
-float calculate_new_heading(float current_heading, float angle, bool is_left_turn)
+q16_t calculate_new_heading(q16_t current_heading, q16_t angle, bool is_left_turn)
 {
     // Check if it's a left turn
     if (!is_left_turn)
     {
         // Calculate the new heading after a right turn
-        float new_heading = current_heading + angle;
+        q16_t new_heading = q16_add(current_heading, angle);
 
         // Normalize the heading to be within [0, 360) degrees
-        if (new_heading > 360)
+        if (new_heading >= Q16(360))
         {
-            new_heading = new_heading - 360;
+            new_heading = new_heading - Q16(360);
         }
 
         // Return the new heading after a right turn
@@ -97,12 +554,12 @@ float calculate_new_heading(float current_heading, float angle, bool is_left_tur
     else
     {
         // Calculate the new heading after a left turn
-        float new_heading = current_heading - angle;
+        q16_t new_heading = q16_sub(current_heading, angle);
         
         // Normalize the heading to be within [0, 360) degrees
         if (new_heading < 0)
         {
-            new_heading = 360 + new_heading;
+            new_heading = Q16(360) + new_heading;
         }
         // Return the new heading after a left turn
         return new_heading;
@@ -110,227 +567,212 @@ float calculate_new_heading(float current_heading, float angle, bool is_left_tur
 }
 
 /**
- * @brief Function for PID control of motor movement.
- * @return True if the control is successful, false otherwise.
+ * @brief Function to clear the state of a PID loop.
+ * @param loop Pointer to the PID loop.
  */
-bool pid_control()
+void reset_pid_loop(pid_loop_t *loop)
 {
-    if (movement_direction == 'w')
-    {
-        // Get current heading
-        current_heading = get_heading();
-
-        // Calculate the error
-        float error = 0;
-        float left_wheel_speed = left_encoder_speed;
-        float right_wheel_speed = right_encoder_speed;
-        float wheel_speed_error = left_wheel_speed - right_wheel_speed;
+    loop->integral = 0;
+    loop->previous_error = 0;
+    loop->started = false;
+}
 
-        // Calculate the PID
-        P = kp * error;
-        I = I + ki * error;
-        D = kd * wheel_speed_error;
+/**
+ * @brief Function to run one step of a PID loop.
+ *
+ * @details
+ * The output is clamped to the range of the loop. To stop the integral winding up while the output
+ * is clamped, the error is only integrated when that does not push the output further past the limit.
+ * Everything is in Q16.16 and saturates, so a term too large for the format clamps the output
+ * instead of wrapping round to the other limit.
+ *
+ * @param loop Pointer to the PID loop.
+ * @param error Setpoint minus measurement.
+ * @param feedforward Output expected for the setpoint, the PID terms correct around it.
+ * @param dt Time since the previous step in seconds, more than 0.
+ * @return The clamped output.
+ */
+q16_t update_pid_loop(pid_loop_t *loop, q16_t error, q16_t feedforward, q16_t dt)
+{
+    // No derivative on the first step, there is no previous error to compare with
+    q16_t derivative = loop->started ? q16_div(q16_sub(error, loop->previous_error), dt) : 0;
+    loop->previous_error = error;
+    loop->started = true;
 
-        float PID = P + I + D;
+    q16_t integral = q16_add(loop->integral, q16_mul(error, dt));
+    q16_t output = q16_add(feedforward, q16_mul(loop->kp, error));
+    output = q16_add(output, q16_mul(loop->ki, integral));
+    output = q16_add(output, q16_mul(loop->kd, derivative));
 
-        // Calculate the new motor speeds
-        if (PID > 0)
-        {
-            // Turn left
-            float left_motor_speed = SPEED + PID;
-            float right_motor_speed = SPEED;
-            
-            // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
-        }
-        else if (PID < 0)
+    if (output > loop->output_max)
+    {
+        output = loop->output_max;
+        // Only integrate an error that brings the output back down
+        if (error < 0)
         {
-            // update pid to positive
-            PID = fabs(PID);
-            float left_motor_speed = SPEED;
-            float right_motor_speed = SPEED + PID;
-
-             // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
+            loop->integral = integral;
         }
-        else
+    }
+    else if (output < loop->output_min)
+    {
+        output = loop->output_min;
+        // Only integrate an error that brings the output back up
+        if (error > 0)
         {
-            // Maintain the same heading by moving straight
-            set_speed(SPEED, SPEED);
+            loop->integral = integral;
         }
-        
-        // Indicate successful PID control
-        return true;
     }
-    else if (movement_direction == 's')
+    else
     {
-        // Get current heading
-        current_heading = get_heading();
-
-        // Calculate the error
-        float error = 0;
-        float left_wheel_speed = left_encoder_speed;
-        float right_wheel_speed = right_encoder_speed;
-        float wheel_speed_error = left_wheel_speed - right_wheel_speed;
-
-        // Calculate the PID
-        P = kp * error;
-        I = I + ki * error;
-        D = kd * wheel_speed_error;
-
-        float PID = P + I + D;
-
-        // Print diagnostic information
-        printf("PID: %f\n", PID);
-        printf("Left wheel speed: %f\n", left_wheel_speed);
-        printf("Right wheel speed: %f\n", right_wheel_speed);
-        printf("heading: %f\n", current_heading);
-
-        // Calculate the new motor speeds
-        if (PID < 0)
-        {
-            // Turn left
-            float left_motor_speed = SPEED + PID;
-            float right_motor_speed = SPEED;
+        loop->integral = integral;
+    }
 
-            // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
-        }
-        else if (PID > 0)
-        {
-            // Change pid to positive and turn right
-            PID = fabs(PID);
-            float left_motor_speed = SPEED;
-            float right_motor_speed = SPEED + PID;
-            
-            // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
-        }
-        else
-        {
-            // Maintain the same heading
-            set_speed(SPEED, SPEED);
-        }
+    return output;
+}
+
+/**
+ * @brief Function to wrap a heading difference to the shortest way round.
+ * @param error Heading difference in degrees.
+ * @return The same difference within -180 to 180 degrees.
+ */
+q16_t wrap_heading_error(q16_t error)
+{
+    return q16_wrap(error, Q16(180));
+}
 
+/**
+ * @brief Function for PID control of motor movement.
+ *
+ * @details
+ * Called at the control rate. The motion profile of the movement (see motion_profile.h) gives the wheel
+ * speed of each step, ramping up from standstill and, for a turn, braking for its angle.
+ * Two cascaded loops then drive the motors:
+ * 1) The outer loop works on the heading from the magnetometer. Driving straight, the heading error
+ *    (wrapped the shortest way round) gives a wheel speed difference around the profile speed that steers
+ *    back to target_heading. Pivoting, the angle still to turn also limits the wheel speed near the end,
+ *    and the motors stop once it is within PID_HEADING_TOLERANCE or has been passed.
+ *    A movement to a distance or an angle (move_distance(), rotate_by()) is measured with the encoders
+ *    instead. The wheel speed is corrected by PID_POSITION_GAIN for how far the robot is behind the profile,
+ *    and the power is cut as soon as the robot would roll onto the target: the distance it rolls on is
+ *    modelled as its speed times PID_COAST_TIME_S, plus half a control period as the next step comes late.
+ * 2) The inner loops drive each wheel to its target speed, measured with get_wheel_speed(), with a
+ *    feedforward of PID_WHEEL_FEEDFORWARD per tick per second and the output clamped to the PWM wrap.
+ * dt is measured between steps, so a late tick does not change the gains.
+ * The controller runs in Q16.16 fixed point, as the Cortex-M0+ has no FPU.
+ *
+ * @return True if the control is successful, false otherwise.
+ */
+bool pid_control()
+{
+    // Only the movements started by move_forward(), move_backward(), turn_left() and turn_right() are controlled here
+    if (movement_direction != 'w' && movement_direction != 's' && movement_direction != 'a' && movement_direction != 'd')
+    {
         return true;
     }
-    else if (movement_direction == 'a')
+
+    // Time since the previous step, nominal on the first step of a movement and limited after a hold up
+    uint32_t now = time_us_32();
+    q16_t dt = pid_running ? q16_from_us(now - pid_previous_time) : PID_CONTROL_PERIOD_S;
+    if (dt <= 0 || dt > PID_MAX_DT_S)
     {
-        // Get current heading
-        current_heading = get_heading();
-
-        // Calculate the error
-        // float error = target_heading - current_heading;
-        float error = 0;
-        float left_wheel_speed = left_encoder_speed;
-        float right_wheel_speed = right_encoder_speed;
-        float wheel_speed_error = left_wheel_speed - right_wheel_speed;
-
-        // Calculate the PID
-        P = kp * error;
-        I = I + ki * error;
-        D = kd * wheel_speed_error;
-
-        float PID = P + I + D;
-
-        printf("PID: %f\n", PID);
-        printf("Left wheel speed: %f\n", left_wheel_speed);
-        printf("Right wheel speed: %f\n", right_wheel_speed);
-        printf("heading: %f\n", current_heading);
-        printf("target heading: %f\n", target_heading);
-
-        // Calculate the new motor speeds
-        if (PID > 0)
+        dt = PID_MAX_DT_S;
+    }
+    pid_previous_time = now;
+    pid_running = true;
+
+    current_heading = get_heading();
+
+    // Wheel speed in ticks per second along the profile of the movement
+    q16_t profile_speed = update_motion_profile(&motion_profile, dt);
+    q16_t left_target;
+    q16_t right_target;
+
+    if (movement_to_target)
+    {
+        // Distance covered by the wheels, between ticks as well. The wheels start anywhere between two ticks,
+        // so the first tick comes after half a tick on average
+        int32_t position = get_encoder_position(now) - ENCODER_POSITION_SCALE / 2;
+        q16_t travelled = q16_saturate((int64_t)(position > 0 ? position : 0) * Q16_ONE / ENCODER_POSITION_SCALE);
+        q16_t remaining = q16_sub(motion_profile.distance, travelled);
+
+        // Catch up with the profile when behind it, which also creeps on to the target once it has finished
+        profile_speed = q16_max(0, q16_add(profile_speed, q16_mul(PID_POSITION_GAIN, q16_sub(motion_profile.position, travelled))));
+
+        // Cut the power once the robot would roll onto the target. A few ticks a second are too slow for the
+        // encoder speed to follow the braking, so the wheels are taken to run at the speed they are driven at
+        q16_t rolling = q16_mul(profile_speed, q16_add(PID_COAST_TIME_S, dt / 2));
+        if (remaining <= q16_max(rolling, PID_POSITION_TOLERANCE))
         {
-            // Turn left
-            float left_motor_speed = SPEED + PID;
-            float right_motor_speed = SPEED;
-            
-            // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
+            stop_motors();
+            return true;
         }
-        else if (PID < 0)
+    }
+
+    if (movement_direction == 'w' || movement_direction == 's')
+    {
+        q16_t steer;
+        if (movement_curvature != 0)
         {
-            // change pid to positive
-            PID = fabs(PID);
-            float left_motor_speed = SPEED;
-            float right_motor_speed = SPEED + PID;
-            
-            // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
+            // Along an arc the heading keeps changing, so the wheels run at a fixed ratio instead
+            steer = q16_mul(profile_speed, movement_curvature);
         }
         else
         {
-            // Maintain the same heading
-            set_speed(SPEED, SPEED);
-        }
-
-        float heading_difference = fabs(current_heading - target_heading);
-        if (heading_difference < 20.0)
-        {
-            stop_motors();
+            // Positive error needs a turn to the right (clockwise), so the left wheel goes faster
+            q16_t heading_error = wrap_heading_error(q16_sub(target_heading, current_heading));
+            steer = update_pid_loop(&heading_pid, heading_error, 0, dt);
+
+            // Driving backward, a faster left wheel turns the robot the other way
+            if (movement_direction == 's')
+            {
+                steer = -steer;
+            }
         }
 
-        return true;
+        left_target = q16_add(profile_speed, steer);
+        right_target = q16_sub(profile_speed, steer);
     }
-    else if (movement_direction == 'd')
+    else if (movement_to_target)
     {
-        // Get current heading
-        current_heading = get_heading();
-
-        // Calculate the error
-        float error = 0;
-        float left_wheel_speed = left_encoder_speed;
-        float right_wheel_speed = right_encoder_speed;
-        float wheel_speed_error = left_wheel_speed - right_wheel_speed;
-
-        // Calculate the PID
-        P = kp * error;
-        I = I + ki * error;
-        D = kd * wheel_speed_error;
-
-        float PID = P + I + D;
-
-        printf("PID: %f\n", PID);
-        printf("Left wheel speed: %f\n", left_wheel_speed);
-        printf("Right wheel speed: %f\n", right_wheel_speed);
-        printf("heading: %f\n", current_heading);
-        printf("target heading: %f\n", target_heading);
-
-        // Calculate the new motor speeds
-        if (PID < 0)
-        {
-            // Turn left
-            float left_motor_speed = SPEED + PID;
-            float right_motor_speed = SPEED;
-            
-            // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
-        }
-        else if (PID > 0)
+        // Pivot on the encoders, both wheels at the profile speed
+        left_target = profile_speed;
+        right_target = profile_speed;
+    }
+    else
+    {
+        // Angle turned so far, a small turn the wrong way at the start counts as none
+        q16_t turned = wrap_heading_error(movement_direction == 'd' ? q16_sub(current_heading, start_heading) : q16_sub(start_heading, current_heading));
+        if (turned < -PID_TURN_BACKLASH)
         {
-            // Update PID value to positive
-            PID = fabs(PID);
-            float left_motor_speed = SPEED;
-            float right_motor_speed = SPEED + PID;
-            
-            // Set the new motor speeds
-            set_speed(left_motor_speed, right_motor_speed);
+            turned += Q16(360);
         }
-        else
+        q16_t remaining = q16_sub(set_heading, turned);
+
+        if (remaining < PID_HEADING_TOLERANCE)
         {
-            // Maintain the same heading
-            set_speed(SPEED, SPEED);
+            stop_motors();
+            return true;
         }
 
-        float heading_difference = fabs(current_heading - target_heading);
-        if (heading_difference < 5.0)
+        // Both wheels at the same speed, slowing down near the end of the turn
+        q16_t turn_speed = q16_min(profile_speed, q16_mul(PID_TURN_GAIN, remaining));
+        // The profile planned the angle from the encoders, keep turning slowly until the heading agrees
+        if (motion_profile.finished && turn_speed < PID_TURN_MIN_SPEED)
         {
-            stop_motors();
+            turn_speed = PID_TURN_MIN_SPEED;
         }
 
-        return true;
+        left_target = turn_speed;
+        right_target = turn_speed;
     }
+
+    // Inner loops, the H-bridge sets the direction so the wheel speeds are magnitudes
+    q16_t left_motor_speed = update_pid_loop(&left_speed_pid, q16_sub(left_target, get_wheel_speed(&left_encoder_velocity)),
+                                             q16_mul(left_target, PID_WHEEL_FEEDFORWARD), dt);
+    q16_t right_motor_speed = update_pid_loop(&right_speed_pid, q16_sub(right_target, get_wheel_speed(&right_encoder_velocity)),
+                                              q16_mul(right_target, PID_WHEEL_FEEDFORWARD), dt);
+    set_speed(q16_to_int(left_motor_speed), q16_to_int(right_motor_speed));
+
     return true;
 }
 
@@ -339,23 +781,33 @@ bool pid_control()
  */
 void reset_values()
 {
+    // The encoder interrupt also writes the counts and periods, keep it out so a tick cannot land half way through
+    uint32_t interrupts = save_and_disable_interrupts();
+
     // Reset the encoder counts
     left_encoder_count = 0;
     right_encoder_count = 0;
 
     // Reset the encoder speeds
-    left_encoder_speed = 0.0;
-    right_encoder_speed = 0.0;
+    reset_wheel_velocity(&left_encoder_velocity, 0);
+    reset_wheel_velocity(&right_encoder_velocity, 0);
+    left_encoder_period = 0;
+    right_encoder_period = 0;
+
+    restore_interrupts(interrupts);
 
-    // Reset the PID variables
-    I = 0.0;
-    P = 0.0;
-    D = 0.0;
+    // Reset the PID loops
+    reset_pid_loop(&heading_pid);
+    reset_pid_loop(&left_speed_pid);
+    reset_pid_loop(&right_speed_pid);
+    pid_running = false;
+    movement_to_target = false;
+    movement_curvature = 0;
 
     // Reset the heading variables
-    start_heading = 0.0;
-    current_heading = 0.0;
-    target_heading = 0.0;
+    start_heading = 0;
+    current_heading = 0;
+    target_heading = 0;
 }
 
 /**
@@ -366,6 +818,8 @@ void move_forward(float speed)
 {
     // Reset Values
     reset_values();
+    movement_speed = q16_from_float(speed);
+    start_motion_profile(&motion_profile, q16_div(movement_speed, PID_WHEEL_FEEDFORWARD), 0);
 
     // Set the GPIO pins to high
     gpio_put(input_1, 1);
@@ -373,7 +827,8 @@ void move_forward(float speed)
     gpio_put(input_3, 0);
     gpio_put(input_4, 1);
 
-    set_speed(speed, speed);
+    // Start from standstill, the control loop ramps the wheels up along the profile
+    set_speed(0, 0);
 
     // Set the PWM channels
     pwm_set_enabled(pwm_gpio_to_slice_num(motor_enable_pin_A), true);
@@ -393,6 +848,8 @@ void move_backward(float speed)
 {
     // Reset Values
     reset_values();
+    movement_speed = q16_from_float(speed);
+    start_motion_profile(&motion_profile, q16_div(movement_speed, PID_WHEEL_FEEDFORWARD), 0);
 
     // Set the GPIO pins to high
     gpio_put(input_1, 0);
@@ -400,7 +857,8 @@ void move_backward(float speed)
     gpio_put(input_3, 1);
     gpio_put(input_4, 0);
 
-    set_speed(speed, speed);
+    // Start from standstill, the control loop ramps the wheels up along the profile
+    set_speed(0, 0);
 
     pwm_set_enabled(pwm_gpio_to_slice_num(motor_enable_pin_A), true);
     pwm_set_enabled(pwm_gpio_to_slice_num(motor_enable_pin_B), true);
@@ -420,6 +878,10 @@ void turn_left(float speed, float angle)
 {
     // Reset Values
     reset_values();
+    movement_speed = q16_from_float(speed);
+    // Each wheel turns through the angle over ENCODER_DEGREES_PER_TICK ticks
+    start_motion_profile(&motion_profile, q16_div(movement_speed, PID_WHEEL_FEEDFORWARD),
+                         q16_div(q16_from_float(angle), Q16(ENCODER_DEGREES_PER_TICK)));
 
     // Set the GPIO pins to high
     gpio_put(input_1, 0);
@@ -427,7 +889,8 @@ void turn_left(float speed, float angle)
     gpio_put(input_3, 0);
     gpio_put(input_4, 1);
 
-    set_speed(speed, speed);
+    // Start from standstill, the control loop ramps the wheels up along the profile
+    set_speed(0, 0);
 
     // Set the PWM channels
     pwm_set_enabled(pwm_gpio_to_slice_num(motor_enable_pin_A), true);
@@ -435,8 +898,8 @@ void turn_left(float speed, float angle)
 
     // Get the current heading
     start_heading = get_heading();
-    target_heading = calculate_new_heading(start_heading, angle, true);
-    set_heading = angle;
+    target_heading = calculate_new_heading(start_heading, q16_from_float(angle), true);
+    set_heading = q16_from_float(angle);
     movement_direction = 'a';
 }
 
@@ -449,6 +912,10 @@ void turn_right(float speed, float angle)
 {
     // Reset Values
     reset_values();
+    movement_speed = q16_from_float(speed);
+    // Each wheel turns through the angle over ENCODER_DEGREES_PER_TICK ticks
+    start_motion_profile(&motion_profile, q16_div(movement_speed, PID_WHEEL_FEEDFORWARD),
+                         q16_div(q16_from_float(angle), Q16(ENCODER_DEGREES_PER_TICK)));
 
     // Set the GPIO pins to high
     gpio_put(input_1, 1);
@@ -456,7 +923,8 @@ void turn_right(float speed, float angle)
     gpio_put(input_3, 1);
     gpio_put(input_4, 0);
 
-    set_speed(speed, speed);
+    // Start from standstill, the control loop ramps the wheels up along the profile
+    set_speed(0, 0);
 
     // Set the PWM channels
     pwm_set_enabled(pwm_gpio_to_slice_num(motor_enable_pin_A), true);
@@ -464,11 +932,88 @@ void turn_right(float speed, float angle)
 
     // Get the current heading
     start_heading = get_heading();
-    target_heading = calculate_new_heading(start_heading, angle, false);
-    set_heading = angle;
+    target_heading = calculate_new_heading(start_heading, q16_from_float(angle), false);
+    set_heading = q16_from_float(angle);
     movement_direction = 'd';
 }
 
+/**
+ * @brief Function to drive straight for a distance and stop on it.
+ *
+ * @details
+ * The control loop measures the distance with the encoders and cuts the power early enough for the
+ * robot to roll onto the target, see pid_control().
+ *
+ * @param speed The speed at which the robot should move.
+ * @param distance The distance to move in cm, negative to move backward.
+ */
+void move_distance(float speed, float distance)
+{
+    if (distance < 0)
+    {
+        move_backward(speed);
+        distance = -distance;
+    }
+    else
+    {
+        move_forward(speed);
+    }
+
+    // Stop along a profile over the distance in wheel ticks, measured by the encoders
+    start_motion_profile(&motion_profile, motion_profile.max_speed, q16_from_float(distance / ENCODER_DISTANCE_PER_TICK_CM));
+    movement_to_target = true;
+}
+
+/**
+ * @brief Function to pivot by an angle and stop on it.
+ *
+ * @details
+ * Like move_distance(), the angle is measured with the encoders, each wheel turning through it over
+ * ENCODER_DEGREES_PER_TICK ticks, so the magnetometer does not end the turn.
+ *
+ * @param speed The speed at which the robot should turn.
+ * @param angle The angle to turn in degrees, clockwise, negative to turn anticlockwise.
+ */
+void rotate_by(float speed, float angle)
+{
+    if (angle < 0)
+    {
+        turn_left(speed, -angle);
+    }
+    else
+    {
+        turn_right(speed, angle);
+    }
+
+    // The control loop stops the turn on the encoders
+    movement_to_target = true;
+}
+
+/**
+ * @brief Function to drive forward along an arc and stop at its end.
+ *
+ * @details
+ * The centre of the robot travels the radius times the angle, stopped by the encoders like move_distance().
+ * The wheels run at a fixed ratio, the outer one faster by half the wheel base over the radius.
+ *
+ * @param speed The speed at which the robot should move.
+ * @param radius The radius of the arc in cm, at least half of ENCODER_WHEEL_BASE_CM.
+ * @param angle The angle to turn through in degrees, clockwise, negative to turn anticlockwise.
+ */
+void move_arc(float speed, float radius, float angle)
+{
+    // The inner wheel cannot run backward, so the tightest arc stops it
+    if (radius < ENCODER_WHEEL_BASE_CM / 2)
+    {
+        radius = ENCODER_WHEEL_BASE_CM / 2;
+    }
+
+    move_distance(speed, radius * fabsf(angle) * 3.141592654f / 180.0f);
+
+    // Turning clockwise, the left wheel is on the outside
+    movement_curvature = q16_from_float((angle < 0 ? -ENCODER_WHEEL_BASE_CM : ENCODER_WHEEL_BASE_CM) / 2 / radius);
+}
+
 /**
  * @brief Function to stop the motors.
  */
@@ -557,4 +1102,10 @@ void initialise_motors(uint8_t left_motor_pin1, uint8_t left_motor_pin2, uint8_t
 
     // initialize magnetometer
     initialise_magnetometer();
+
+    // Start debouncing the encoders from their current level and handle their edges
+    debounce_init(&left_encoder_debounce, DEBOUNCE_ENCODER_DEAD_TIME_US, gpio_get(left_encoder_pin), time_us_32());
+    debounce_init(&right_encoder_debounce, DEBOUNCE_ENCODER_DEAD_TIME_US, gpio_get(right_encoder_pin), time_us_32());
+    register_gpio_handler(left_encoder_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, handle_encoder_event);
+    register_gpio_handler(right_encoder_pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, handle_encoder_event);
 }
\ No newline at end of file
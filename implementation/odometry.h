@@ -0,0 +1,233 @@
+/**
+ * @file odometry.h
+ * @brief Header file for the differential drive odometry of the robot.
+ * @details
+ * A repeating timer integrates the pose (x, y, theta) of the robot from the encoder ticks of both wheels
+ * every ODOMETRY_PERIOD_MS, so mapping, navigation and telemetry always have the current position
+ * instead of working it out from the scan commands afterwards.
+ *
+ * Every period the distance of each wheel is the change of its net displacement (see left_encoder_displacement
+ * in motor.h, signed from the H-bridge) times ODOMETRY_DISTANCE_PER_TICK_CM. The robot
+ * moves the average of the two and turns by their difference over the wheel base. The move is taken as
+ * an arc of constant radius, so its chord is added along the heading half way through the turn,
+ * which is exact whatever the length of the period.
+ * The wheel base is the measured track width ENCODER_WHEEL_BASE_CM of motor.h. While the H-bridges drive
+ * the wheels opposite ways, and while the robot coasts to a stop after that, it pivots on the spot and the tyres
+ * scrub, so it turns less than the wheel base gives. The wheel distances are then scaled by ENCODER_PIVOT_TURN_RATIO,
+ * so a pivot turns by the ENCODER_DEGREES_PER_TICK calibration, the same as rotate_by() stops on.
+ * The pose is integrated in Q16.16 fixed point (see fixed_point.h), which keeps the timer interrupt
+ * off the software float library. Positions up to 327 m either way fit in the format.
+ *
+ * The pose is written by the timer interrupt only and protected by a sequence counter, so readers never
+ * take a lock or disable interrupts: get_odometry_pose() copies the pose and tries again if the timer
+ * wrote it in the meantime.
+ * x is along the heading the robot started with, y to its left, theta is anticlockwise in radians.
+ *
+ * @date November 21, 2023
+ */
+
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "fixed_point.h"
+
+// Define the geometry of the wheels, from the encoder calibration in motor.h
+#define ODOMETRY_DISTANCE_PER_TICK_CM Q16(ENCODER_DISTANCE_PER_TICK_CM)
+#define ODOMETRY_WHEEL_BASE_CM Q16(ENCODER_WHEEL_BASE_CM)
+#define ODOMETRY_PIVOT_DISTANCE_PER_TICK_CM Q16(ENCODER_DISTANCE_PER_TICK_CM * ENCODER_PIVOT_TURN_RATIO)
+
+// Define how often the pose is updated
+#define ODOMETRY_PERIOD_MS 20
+
+/**
+ * @brief Position and heading of the robot, in Q16.16.
+ */
+typedef struct
+{
+    q16_t x;                // Distance along the starting heading in cm
+    q16_t y;                // Distance to the left of the starting heading in cm
+    q16_t theta;            // Heading anticlockwise from the starting heading in radians, -pi to pi
+    q16_t distance;         // Total distance travelled by the centre of the robot in cm
+    uint32_t timestamp;     // Time of the update from time_us_32()
+} odometry_pose_t;
+
+odometry_pose_t odometry_pose;                  // Latest pose, only read through get_odometry_pose()
+volatile uint32_t odometry_sequence = 0;        // Odd while the pose is being written
+int32_t odometry_left_displacement = 0;         // Left net displacement at the last update
+int32_t odometry_right_displacement = 0;        // Right net displacement at the last update
+bool odometry_pivoting = false;                 // Flag set while the wheels were last driven opposite ways
+struct repeating_timer odometry_timer;          // Timer that updates the pose
+
+// Function prototypes
+q16_t wrap_odometry_angle(q16_t angle);
+void integrate_odometry(odometry_pose_t *pose, q16_t left_distance, q16_t right_distance);
+bool update_odometry(struct repeating_timer *t);
+void get_odometry_pose(odometry_pose_t *pose);
+void reset_odometry(q16_t x, q16_t y, q16_t theta);
+void initialise_odometry();
+void retrieve_odometry();
+
+/**
+ * @brief Wrap an angle to -pi to pi.
+ *
+ * @param angle The angle in radians.
+ * @return The same angle within -pi to pi.
+ */
+q16_t wrap_odometry_angle(q16_t angle)
+{
+    return q16_wrap(angle, Q16_PI);
+}
+
+/**
+ * @brief Move a pose by the distances travelled by the two wheels.
+ *
+ * @details
+ * The chord of the arc is the distance times sin(turn / 2) / (turn / 2). Dividing by a small turn
+ * would lose most of its bits, so the ratio comes from its series up to the 6th power instead,
+ * accurate to a step of Q16.16 for turns up to pi in one update.
+ *
+ * @param pose Pointer to the pose.
+ * @param left_distance Distance travelled by the left wheel in cm, negative backward.
+ * @param right_distance Distance travelled by the right wheel in cm, negative backward.
+ */
+void integrate_odometry(odometry_pose_t *pose, q16_t left_distance, q16_t right_distance)
+{
+    q16_t distance = q16_add(left_distance, right_distance) / 2;
+    q16_t turn = q16_div(q16_sub(right_distance, left_distance), ODOMETRY_WHEEL_BASE_CM);
+    q16_t half_turn = turn / 2;
+
+    // A constant arc ends up the chord away, along the heading half way through the turn
+    q16_t half_turn_squared = q16_mul(half_turn, half_turn);
+    q16_t chord_ratio = Q16(-1.0 / 5040.0);
+    chord_ratio = Q16(1.0 / 120.0) + q16_mul(half_turn_squared, chord_ratio);
+    chord_ratio = Q16(-1.0 / 6.0) + q16_mul(half_turn_squared, chord_ratio);
+    chord_ratio = Q16_ONE + q16_mul(half_turn_squared, chord_ratio);
+    q16_t chord = q16_mul(distance, chord_ratio);
+
+    q16_t heading = q16_add(pose->theta, half_turn);
+    pose->x = q16_add(pose->x, q16_mul(chord, q16_cos(heading)));
+    pose->y = q16_add(pose->y, q16_mul(chord, q16_sin(heading)));
+    pose->theta = wrap_odometry_angle(q16_add(pose->theta, turn));
+    pose->distance = q16_add(pose->distance, q16_abs(distance));
+}
+
+/**
+ * @brief Update the pose from the new encoder ticks.
+ *
+ * @details
+ * Called by a repeating timer every ODOMETRY_PERIOD_MS. The timer runs at the same priority as the
+ * encoder interrupt, so the two counts are read together. The sequence counter is odd while the pose
+ * is written, so a reader interrupted by this update sees that its copy is torn.
+ *
+ * @param t A pointer to the repeating timer structure.
+ * @return true to keep the timer running.
+ */
+bool update_odometry(struct repeating_timer *t)
+{
+    // Signed ticks since the last update
+    int32_t left_displacement = left_encoder_displacement;
+    int32_t right_displacement = right_encoder_displacement;
+    int32_t left_ticks = left_displacement - odometry_left_displacement;
+    int32_t right_ticks = right_displacement - odometry_right_displacement;
+    odometry_left_displacement = left_displacement;
+    odometry_right_displacement = right_displacement;
+
+    // The robot keeps pivoting as it coasts, until the H-bridges drive the wheels again
+    int8_t left_driven = get_hbridge_direction(input_1, input_2);
+    int8_t right_driven = get_hbridge_direction(input_4, input_3);
+    if (left_driven != 0 || right_driven != 0)
+    {
+        odometry_pivoting = left_driven == -right_driven;
+    }
+
+    // Pivoting on the spot turns the robot by the turn calibration, not the full wheel geometry
+    q16_t distance_per_tick = ODOMETRY_DISTANCE_PER_TICK_CM;
+    if (odometry_pivoting)
+    {
+        distance_per_tick = ODOMETRY_PIVOT_DISTANCE_PER_TICK_CM;
+    }
+
+    odometry_sequence++;
+    __dmb();
+    integrate_odometry(&odometry_pose, q16_mul(q16_from_int(left_ticks), distance_per_tick),
+                       q16_mul(q16_from_int(right_ticks), distance_per_tick));
+    odometry_pose.timestamp = time_us_32();
+    __dmb();
+    odometry_sequence++;
+
+    return true;
+}
+
+/**
+ * @brief Get a consistent copy of the latest pose without taking a lock.
+ *
+ * @param pose Pointer to where the pose is copied.
+ */
+void get_odometry_pose(odometry_pose_t *pose)
+{
+    uint32_t sequence;
+
+    do
+    {
+        // Wait for a write in progress to finish, then copy and check nothing was written meanwhile
+        do
+        {
+            sequence = odometry_sequence;
+        } while (sequence & 1);
+        __dmb();
+        *pose = odometry_pose;
+        __dmb();
+    } while (sequence != odometry_sequence);
+}
+
+/**
+ * @brief Set the pose, for example when the robot is placed at a known position.
+ *
+ * @param x Distance along the starting heading in cm, in Q16.16.
+ * @param y Distance to the left of the starting heading in cm, in Q16.16.
+ * @param theta Heading in radians, in Q16.16.
+ */
+void reset_odometry(q16_t x, q16_t y, q16_t theta)
+{
+    // The timer is the only other writer, keep it out while the pose is set
+    uint32_t interrupts = save_and_disable_interrupts();
+    odometry_sequence++;
+    odometry_pose.x = x;
+    odometry_pose.y = y;
+    odometry_pose.theta = wrap_odometry_angle(theta);
+    odometry_pose.distance = 0;
+    odometry_pose.timestamp = time_us_32();
+    odometry_sequence++;
+    restore_interrupts(interrupts);
+}
+
+/**
+ * @brief Start the odometry at the origin and update it every ODOMETRY_PERIOD_MS.
+ */
+void initialise_odometry()
+{
+    odometry_left_displacement = left_encoder_displacement;
+    odometry_right_displacement = right_encoder_displacement;
+    reset_odometry(0, 0, 0);
+
+    // Negative period, so the updates start at a fixed rate however long they take
+    add_repeating_timer_ms(-ODOMETRY_PERIOD_MS, update_odometry, NULL, &odometry_timer);
+}
+
+/**
+ * @brief Function to print the pose of the robot.
+ */
+void retrieve_odometry()
+{
+    odometry_pose_t pose;
+    get_odometry_pose(&pose);
+
+    printf("Pose: x %.1f cm, y %.1f cm, heading %.1f deg, travelled %.1f cm\n",
+           q16_to_float(pose.x), q16_to_float(pose.y), q16_to_float(q16_to_degrees(pose.theta)), q16_to_float(pose.distance));
+    printf("Encoder ticks: left net %ld of %lu, right net %ld of %lu\n", (long)left_encoder_displacement,
+           (unsigned long)left_encoder_travelled, (long)right_encoder_displacement, (unsigned long)right_encoder_travelled);
+}
+
+#endif // ODOMETRY_H
@@ -0,0 +1,415 @@
+/**
+ * @file barcode_scan.h
+ * @brief Header file for simulating barcode scans and replaying them through the barcode pipeline.
+ * @details
+ * A scan is made up in centimetres and then driven over at a changing speed:
+ * 1) The message is laid out as Code 39 elements between '*' delimiters, with a white quiet zone either side.
+ *    Optional glitches add a short pulse of the other colour inside random elements.
+ * 2) The robot drives over it with a speed that ramps from start_speed to end_speed and wobbles around the ramp.
+ *    Every barcode boundary gives a sensor edge, shifted by up to jitter_us, and every encoder slot of either wheel
+ *    gives a rising and a falling edge, so the recorded stream is what the GPIO interrupt would see.
+ * 3) replay_barcode_scan() feeds the stream through gpio_dispatch_callback() at the recorded times and runs
+ *    process_barcode_edges() every millisecond like the main loop, so the whole pipeline from the interrupt
+ *    to the decoder is exercised.
+ * The test that includes this file must include motor.h, motion_queue.h and infrared.h first.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef BARCODE_SCAN_H
+#define BARCODE_SCAN_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shims.h"
+#include "test.h"
+
+// Pins the scans are replayed on, as in main.c
+#define SCAN_LEFT_MOTOR_PIN1 14
+#define SCAN_LEFT_MOTOR_PIN2 13
+#define SCAN_RIGHT_MOTOR_PIN1 12
+#define SCAN_RIGHT_MOTOR_PIN2 11
+#define SCAN_LEFT_MOTOR_PWM_PIN 15
+#define SCAN_RIGHT_MOTOR_PWM_PIN 10
+#define SCAN_ENCODER_LEFT_PIN 2
+#define SCAN_ENCODER_RIGHT_PIN 3
+#define SCAN_LEFT_LINE_SENSOR_PIN 6
+#define SCAN_RIGHT_LINE_SENSOR_PIN 7
+#define SCAN_BARCODE_SENSOR_PIN 8
+
+#define SCAN_MAX_BOUNDARIES 1024        // Colour changes along a barcode
+#define SCAN_MAX_EVENTS 4096            // Edges of a recorded scan
+#define SCAN_QUIET_ZONE_NARROW 10       // White either side of the barcode in narrow elements, the Code 39 minimum
+#define SCAN_STEP_US 5                  // Time step of the simulated drive
+#define SCAN_MAIN_LOOP_US 1000          // Time between calls to process_barcode_edges()
+#define SCAN_SETTLE_US 200000           // Time the main loop runs on after the last edge
+
+/**
+ * @brief How a barcode is printed and driven over.
+ */
+typedef struct
+{
+    double narrow_cm;       // Width of a narrow element
+    double wide_ratio;      // Width of a wide element over a narrow one
+    double start_speed;     // Speed at the start of the scan in cm/s
+    double end_speed;       // Speed at the end of the scan in cm/s, the speed ramps with distance
+    double wobble;          // Fraction of the speed it swings by around the ramp
+    double wobble_period_s; // Time of one swing
+    double jitter_us;       // Largest random shift of a barcode edge
+    bool reverse;           // Drive over the barcode from its end
+    int glitches;           // Number of short pulses added inside random elements
+    double glitch_cm;       // Width of an added pulse
+} barcode_scan_t;
+
+/**
+ * @brief A recorded GPIO edge.
+ */
+typedef struct
+{
+    uint32_t timestamp; // Time of the edge
+    uint8_t pin;        // Pin the edge is on
+    bool level;         // Level after the edge
+} scan_event_t;
+
+/**
+ * @brief What came out of a replayed scan.
+ */
+typedef enum
+{
+    SCAN_MISSED,    // No barcode was read
+    SCAN_REPORTED,  // The barcode was reported to the TCP client
+    SCAN_VOTED,     // The barcode was read with a low confidence and is waiting for another pass
+} scan_result_t;
+
+scan_event_t scan_events[SCAN_MAX_EVENTS];  // Edges of the latest scan
+int scan_event_count = 0;                   // Number of edges in scan_events
+uint64_t scan_clock_us = 1000000;           // Time the next scan starts at, scans follow each other
+char scan_tcp_event[128] = "";              // Last event sent to the TCP client
+
+// Function prototypes
+double get_scan_random(double low, double high);
+void make_scan_message(char *message);
+int layout_barcode(const char *message, const barcode_scan_t *scan, double boundaries[SCAN_MAX_BOUNDARIES], double *length);
+void add_scan_event(uint64_t timestamp, uint8_t pin, bool level);
+int compare_scan_events(const void *a, const void *b);
+int record_barcode_scan(const char *message, const barcode_scan_t *scan);
+void run_scan_main_loop(uint64_t until);
+void replay_barcode_scan();
+void start_barcode_scans();
+void reset_barcode_scan();
+scan_result_t get_scan_result(char *message);
+
+/**
+ * @brief Capture the events sent to the TCP client instead of sending them.
+ */
+bool send_tcp_event(const char *event)
+{
+    strncpy(scan_tcp_event, event, sizeof(scan_tcp_event) - 1);
+    return true;
+}
+
+/**
+ * @brief Ignore the motion commands that end, the scans do not drive the motors.
+ */
+void handle_motion_complete(const motion_command_t *command, bool completed)
+{
+}
+
+/**
+ * @brief Get a random number from get_test_random().
+ *
+ * @param low Lowest value.
+ * @param high Highest value.
+ * @return A value from low to high.
+ */
+double get_scan_random(double low, double high)
+{
+    return low + (high - low) * get_test_random() / (double)0x7FFFFFFF;
+}
+
+/**
+ * @brief Make up a random message of 1 to 6 data characters.
+ *
+ * @param message Buffer of BARCODE_MESSAGE_SIZE + 1 characters the message is written to.
+ */
+void make_scan_message(char *message)
+{
+    int length = 1 + get_test_random() % 6;
+
+    for (int i = 0; i < length; i++)
+    {
+        message[i] = CODE39_CHARACTERS[get_test_random() % CODE39_CHECK_MODULUS];
+    }
+    message[length] = '\0';
+}
+
+/**
+ * @brief Lay out a barcode as the positions where its colour changes.
+ *
+ * @details
+ * The colour is white before the first boundary and changes at every boundary, so the even boundaries
+ * start a bar. Glitches add two boundaries inside a random element.
+ *
+ * @param message Characters between the '*' delimiters.
+ * @param scan How the barcode is printed.
+ * @param boundaries Array the positions are stored in, from the start of the quiet zone, in the order they are driven over.
+ * @param length Pointer to where the length including both quiet zones is stored.
+ * @return The number of boundaries.
+ */
+int layout_barcode(const char *message, const barcode_scan_t *scan, double boundaries[SCAN_MAX_BOUNDARIES], double *length)
+{
+    char symbols[BARCODE_MESSAGE_SIZE + 3];
+    double widths[SCAN_MAX_BOUNDARIES];
+    int element_count = 0;
+
+    snprintf(symbols, sizeof(symbols), "*%s*", message);
+
+    // Every symbol is 9 elements, with a narrow white gap before the next symbol
+    for (int s = 0; symbols[s] != '\0'; s++)
+    {
+        uint16_t key = 0;
+        for (int k = 0; k < CODE39_KEY_COUNT; k++)
+        {
+            if (code39_table[k] == symbols[s])
+            {
+                key = k;
+            }
+        }
+
+        if (s > 0)
+        {
+            widths[element_count++] = scan->narrow_cm;
+        }
+        for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+        {
+            bool wide = (key >> (CODE39_ELEMENTS_PER_SYMBOL - 1 - i)) & 1;
+            widths[element_count++] = wide ? scan->narrow_cm * scan->wide_ratio : scan->narrow_cm;
+        }
+    }
+
+    // Driving from the end sees the elements in the opposite order
+    if (scan->reverse)
+    {
+        for (int i = 0; i < element_count / 2; i++)
+        {
+            double width = widths[i];
+            widths[i] = widths[element_count - 1 - i];
+            widths[element_count - 1 - i] = width;
+        }
+    }
+
+    int count = 0;
+    double position = SCAN_QUIET_ZONE_NARROW * scan->narrow_cm;
+    for (int i = 0; i < element_count; i++)
+    {
+        boundaries[count++] = position;
+        position += widths[i];
+    }
+    boundaries[count++] = position;
+    *length = position + SCAN_QUIET_ZONE_NARROW * scan->narrow_cm;
+
+    // Add a pulse of the other colour in the middle part of random elements
+    for (int g = 0; g < scan->glitches; g++)
+    {
+        int element = get_test_random() % element_count;
+        double centre = boundaries[element] + widths[element] * get_scan_random(0.3, 0.7);
+
+        // Keep the boundaries in order by inserting both at their place
+        int index = element + 1;
+        while (index < count && boundaries[index] < centre)
+        {
+            index++;
+        }
+        memmove(&boundaries[index + 2], &boundaries[index], (count - index) * sizeof(double));
+        boundaries[index] = centre - scan->glitch_cm / 2;
+        boundaries[index + 1] = centre + scan->glitch_cm / 2;
+        count += 2;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Add an edge to the recorded scan.
+ *
+ * @param timestamp Time of the edge.
+ * @param pin Pin the edge is on.
+ * @param level Level after the edge.
+ */
+void add_scan_event(uint64_t timestamp, uint8_t pin, bool level)
+{
+    if (scan_event_count < SCAN_MAX_EVENTS)
+    {
+        scan_events[scan_event_count].timestamp = (uint32_t)timestamp;
+        scan_events[scan_event_count].pin = pin;
+        scan_events[scan_event_count].level = level;
+        scan_event_count++;
+    }
+}
+
+/**
+ * @brief Order recorded edges by time, for qsort().
+ */
+int compare_scan_events(const void *a, const void *b)
+{
+    const scan_event_t *event_a = a;
+    const scan_event_t *event_b = b;
+
+    return (int32_t)(event_a->timestamp - event_b->timestamp);
+}
+
+/**
+ * @brief Drive over a barcode and record the barcode sensor and encoder edges.
+ *
+ * @param message Characters between the '*' delimiters.
+ * @param scan How the barcode is printed and driven over.
+ * @return The number of edges recorded in scan_events.
+ */
+int record_barcode_scan(const char *message, const barcode_scan_t *scan)
+{
+    double boundaries[SCAN_MAX_BOUNDARIES];
+    double length;
+    int boundary_count = layout_barcode(message, scan, boundaries, &length);
+    int next_boundary = 0;
+
+    // The wheels are at a random point between encoder slots, every slot is a rising and a falling edge
+    double half_tick = ENCODER_DISTANCE_PER_TICK_CM / 2;
+    double wheel_offsets[2] = {get_scan_random(0, 2 * half_tick), get_scan_random(0, 2 * half_tick)};
+    int wheel_halves[2] = {0, 0};
+    uint8_t wheel_pins[2] = {SCAN_ENCODER_LEFT_PIN, SCAN_ENCODER_RIGHT_PIN};
+
+    scan_event_count = 0;
+    double position = 0;
+    double time_s = 0;
+    while (position < length)
+    {
+        // Speed ramps along the barcode and wobbles around the ramp
+        double ramp = scan->start_speed + (scan->end_speed - scan->start_speed) * position / length;
+        double wobble = scan->wobble_period_s > 0 ? scan->wobble * sin(2 * M_PI * time_s / scan->wobble_period_s) : 0;
+        position += ramp * (1 + wobble) * SCAN_STEP_US * 1e-6;
+        time_s += SCAN_STEP_US * 1e-6;
+        uint64_t now = scan_clock_us + (uint64_t)(time_s * 1e6);
+
+        while (next_boundary < boundary_count && position >= boundaries[next_boundary])
+        {
+            double jitter = get_scan_random(-scan->jitter_us, scan->jitter_us);
+            add_scan_event(now + jitter, SCAN_BARCODE_SENSOR_PIN, (next_boundary % 2) == 0);
+            next_boundary++;
+        }
+
+        for (int w = 0; w < 2; w++)
+        {
+            while (position + wheel_offsets[w] >= (wheel_halves[w] + 1) * half_tick)
+            {
+                wheel_halves[w]++;
+                add_scan_event(now, wheel_pins[w], (wheel_halves[w] % 2) == 1);
+            }
+        }
+    }
+
+    // Jitter can move a barcode edge past an encoder edge
+    qsort(scan_events, scan_event_count, sizeof(scan_event_t), compare_scan_events);
+    scan_clock_us += (uint64_t)(time_s * 1e6) + SCAN_SETTLE_US;
+
+    return scan_event_count;
+}
+
+/**
+ * @brief Run the main loop work for the barcode up to a time.
+ *
+ * @param until Time to run up to.
+ */
+void run_scan_main_loop(uint64_t until)
+{
+    static uint64_t next_run = 0;
+
+    if (next_run < shim_time_us)
+    {
+        next_run = shim_time_us;
+    }
+    while (next_run <= until)
+    {
+        shim_time_us = next_run;
+        process_barcode_edges();
+        next_run += SCAN_MAIN_LOOP_US;
+    }
+}
+
+/**
+ * @brief Replay the recorded scan through the GPIO interrupt and the main loop.
+ */
+void replay_barcode_scan()
+{
+    for (int i = 0; i < scan_event_count; i++)
+    {
+        // The recorded times are 32 bit like time_us_32(), so they wrap around during long runs
+        uint64_t timestamp = shim_time_us + (int32_t)(scan_events[i].timestamp - (uint32_t)shim_time_us);
+
+        run_scan_main_loop(timestamp);
+        shim_time_us = timestamp;
+        gpio_dispatch_callback(scan_events[i].pin, scan_events[i].level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+    }
+    run_scan_main_loop(shim_time_us + SCAN_SETTLE_US);
+}
+
+/**
+ * @brief Set up the motors, encoders and barcode sensor for scans, driving forward.
+ */
+void start_barcode_scans()
+{
+    shim_time_us = scan_clock_us - SCAN_SETTLE_US;
+    initialise_motors(SCAN_LEFT_MOTOR_PIN1, SCAN_LEFT_MOTOR_PIN2, SCAN_RIGHT_MOTOR_PIN1, SCAN_RIGHT_MOTOR_PIN2,
+                      SCAN_LEFT_MOTOR_PWM_PIN, SCAN_RIGHT_MOTOR_PWM_PIN, SCAN_ENCODER_LEFT_PIN, SCAN_ENCODER_RIGHT_PIN);
+    initialise_infrared(SCAN_LEFT_LINE_SENSOR_PIN, SCAN_RIGHT_LINE_SENSOR_PIN, SCAN_BARCODE_SENSOR_PIN);
+    enable_barcode_interrupt();
+
+    // The H-bridge drives both wheels forward, so every encoder tick counts forward
+    gpio_put(SCAN_LEFT_MOTOR_PIN1, 1);
+    gpio_put(SCAN_RIGHT_MOTOR_PIN2, 1);
+    movement_direction = 'w';
+    toggleBarcode = true;
+}
+
+/**
+ * @brief Forget everything the decoder read, so the next scan starts clean.
+ */
+void reset_barcode_scan()
+{
+    reset_barcode_decoder();
+    barcode_window_count = 0;
+    barcode_window_index = 0;
+    barcode_edge_pending = false;
+    barcode_filtered_is_black = false;
+    barcode_candidate_count = 0;
+    barcode_rescan_count = 0;
+    barcode_rescan_requested = false;
+    decoded_characters[0] = '\0';
+    scan_tcp_event[0] = '\0';
+}
+
+/**
+ * @brief Find out what the decoder made of the last scan.
+ *
+ * @param message Buffer of BARCODE_MESSAGE_SIZE + 1 characters the barcode read is copied into, empty if none.
+ * @return Whether the barcode was reported, is waiting for a vote or was not read.
+ */
+scan_result_t get_scan_result(char *message)
+{
+    message[0] = '\0';
+
+    if (scan_tcp_event[0] != '\0')
+    {
+        strcpy(message, decoded_characters);
+        return SCAN_REPORTED;
+    }
+    if (barcode_candidate_count > 0)
+    {
+        strcpy(message, barcode_candidates[barcode_candidate_count - 1].message);
+        return SCAN_VOTED;
+    }
+
+    return SCAN_MISSED;
+}
+
+#endif // BARCODE_SCAN_H
@@ -0,0 +1,217 @@
+/**
+ * @file robot_sim.h
+ * @brief Header file for simulating the wheels and the pose of the robot around the motor code.
+ * @details
+ * The simulation stands in for the motors, the wheels and the floor, so the control code in motor.h
+ * can be run against it unchanged:
+ * 1) Each wheel is driven by its H-bridge pins and its PWM level (see shim_pwm_output()). Its speed follows
+ *    the PWM level above a dead band, scaled by a gain of its own, with a first order lag. Without power
+ *    the wheel coasts to a stop.
+ * 2) Every half encoder tick of either wheel is an edge replayed through gpio_dispatch_callback() at its time,
+ *    so the encoder interrupt, the debouncing and the speed estimates all run.
+ * 3) The true pose of the robot is integrated from the wheel speeds with the measured wheel base,
+ *    for the tests to compare the firmware against. While the H-bridges drive the wheels opposite ways,
+ *    and while it coasts after that, the robot pivots and its tyres scrub, so it only makes
+ *    ENCODER_PIVOT_TURN_RATIO of that turn, as the turn calibration says.
+ * The test that includes this file must include motor.h first.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef ROBOT_SIM_H
+#define ROBOT_SIM_H
+
+#include <math.h>
+#include "shims.h"
+#include "test.h"
+
+// Pins of the motors and encoders, as in main.c
+#define ROBOT_LEFT_MOTOR_PIN1 14
+#define ROBOT_LEFT_MOTOR_PIN2 13
+#define ROBOT_RIGHT_MOTOR_PIN1 11
+#define ROBOT_RIGHT_MOTOR_PIN2 12
+#define ROBOT_LEFT_MOTOR_PWM_PIN 15
+#define ROBOT_RIGHT_MOTOR_PWM_PIN 10
+#define ROBOT_ENCODER_LEFT_PIN 2
+#define ROBOT_ENCODER_RIGHT_PIN 3
+
+#define ROBOT_SIM_STEP_US 100           // Time step of the simulation
+#define ROBOT_SIM_DEAD_BAND 300         // PWM level below which a wheel does not turn
+#define ROBOT_SIM_LAG_S 0.1             // Time constant of a driven wheel
+#define ROBOT_SIM_STOP_SPEED 0.3        // Wheel speed in ticks per second below which a coasting wheel stops
+
+/**
+ * @brief A simulated wheel.
+ */
+typedef struct
+{
+    double gain;            // Speed of the wheel over the speed PID_WHEEL_FEEDFORWARD expects
+    double angle;           // Turn of the wheel in encoder ticks, negative backward
+    double speed;           // Speed of the wheel in encoder ticks per second, negative backward
+    long half_ticks;        // Half ticks the encoder edges have been replayed for
+    uint8_t forward_pin;    // H-bridge pin that drives the wheel forward
+    uint8_t backward_pin;   // H-bridge pin that drives the wheel backward
+    uint8_t pwm_pin;        // PWM pin of the wheel
+    uint8_t encoder_pin;    // Encoder pin of the wheel
+} robot_wheel_t;
+
+robot_wheel_t robot_left_wheel;     // Left wheel
+robot_wheel_t robot_right_wheel;    // Right wheel
+double robot_coast_s = 0.1;         // Time constant of a wheel coasting without power
+double robot_x = 0;                 // True distance along the starting heading in cm
+double robot_y = 0;                 // True distance to the left of the starting heading in cm
+double robot_theta = 0;             // True heading anticlockwise in radians
+bool robot_pivoting = false;        // Flag set while the wheels were last driven opposite ways
+
+// Function prototypes
+void start_robot_sim(double left_gain, double right_gain);
+void place_robot(double x, double y, double theta);
+void step_robot_wheel(robot_wheel_t *wheel, double dt);
+void step_robot_sim();
+bool is_robot_still();
+void run_robot_sim(uint64_t duration_us, bool (*control)(void));
+
+/**
+ * @brief Set up the motors and encoders, and start the wheels at random points between encoder slots.
+ *
+ * @param left_gain Speed of the left wheel over the speed PID_WHEEL_FEEDFORWARD expects.
+ * @param right_gain Speed of the right wheel over the speed PID_WHEEL_FEEDFORWARD expects.
+ */
+void start_robot_sim(double left_gain, double right_gain)
+{
+    initialise_motors(ROBOT_LEFT_MOTOR_PIN1, ROBOT_LEFT_MOTOR_PIN2, ROBOT_RIGHT_MOTOR_PIN1, ROBOT_RIGHT_MOTOR_PIN2,
+                      ROBOT_LEFT_MOTOR_PWM_PIN, ROBOT_RIGHT_MOTOR_PWM_PIN, ROBOT_ENCODER_LEFT_PIN, ROBOT_ENCODER_RIGHT_PIN);
+
+    robot_left_wheel = (robot_wheel_t){left_gain, 0, 0, 0, ROBOT_LEFT_MOTOR_PIN1, ROBOT_LEFT_MOTOR_PIN2,
+                                       ROBOT_LEFT_MOTOR_PWM_PIN, ROBOT_ENCODER_LEFT_PIN};
+    robot_right_wheel = (robot_wheel_t){right_gain, 0, 0, 0, ROBOT_RIGHT_MOTOR_PIN2, ROBOT_RIGHT_MOTOR_PIN1,
+                                        ROBOT_RIGHT_MOTOR_PWM_PIN, ROBOT_ENCODER_RIGHT_PIN};
+    robot_left_wheel.angle = (get_test_random() % 1000) / 1000.0;
+    robot_right_wheel.angle = (get_test_random() % 1000) / 1000.0;
+    robot_left_wheel.half_ticks = (long)floor(robot_left_wheel.angle * 2);
+    robot_right_wheel.half_ticks = (long)floor(robot_right_wheel.angle * 2);
+    robot_pivoting = false;
+    place_robot(0, 0, 0);
+}
+
+/**
+ * @brief Put the robot at a pose.
+ *
+ * @param x Distance along the starting heading in cm.
+ * @param y Distance to the left of the starting heading in cm.
+ * @param theta Heading anticlockwise in radians.
+ */
+void place_robot(double x, double y, double theta)
+{
+    robot_x = x;
+    robot_y = y;
+    robot_theta = theta;
+}
+
+/**
+ * @brief Move a wheel on by one step and replay its encoder edges.
+ *
+ * @param wheel The wheel.
+ * @param dt Length of the step in seconds.
+ */
+void step_robot_wheel(robot_wheel_t *wheel, double dt)
+{
+    int direction = gpio_get_out_level(wheel->forward_pin) - gpio_get_out_level(wheel->backward_pin);
+    uint16_t level = shim_pwm_output(wheel->pwm_pin);
+
+    if (direction != 0 && level > 0)
+    {
+        // Driven towards the speed the PWM level gives
+        double target = direction * wheel->gain * fmax(0, level - ROBOT_SIM_DEAD_BAND) / q16_to_float(PID_WHEEL_FEEDFORWARD);
+        wheel->speed += (target - wheel->speed) * dt / ROBOT_SIM_LAG_S;
+    }
+    else
+    {
+        // Coasting to a stop
+        wheel->speed -= wheel->speed * dt / robot_coast_s;
+        if (fabs(wheel->speed) < ROBOT_SIM_STOP_SPEED)
+        {
+            wheel->speed = 0;
+        }
+    }
+    wheel->angle += wheel->speed * dt;
+
+    // Every slot edge is an encoder edge, whichever way the wheel turns
+    long half_ticks = (long)floor(wheel->angle * 2);
+    while (wheel->half_ticks != half_ticks)
+    {
+        wheel->half_ticks += half_ticks > wheel->half_ticks ? 1 : -1;
+        bool level_after = (wheel->half_ticks & 1) != 0;
+        gpio_dispatch_callback(wheel->encoder_pin, level_after ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+    }
+}
+
+/**
+ * @brief Move the simulation on by ROBOT_SIM_STEP_US.
+ */
+void step_robot_sim()
+{
+    double dt = ROBOT_SIM_STEP_US * 1e-6;
+
+    shim_advance_us(ROBOT_SIM_STEP_US);
+    step_robot_wheel(&robot_left_wheel, dt);
+    step_robot_wheel(&robot_right_wheel, dt);
+
+    // A pivot lasts from the wheels being driven opposite ways until they are driven again
+    int left_driven = gpio_get_out_level(robot_left_wheel.forward_pin) - gpio_get_out_level(robot_left_wheel.backward_pin);
+    int right_driven = gpio_get_out_level(robot_right_wheel.forward_pin) - gpio_get_out_level(robot_right_wheel.backward_pin);
+    if (left_driven != 0 || right_driven != 0)
+    {
+        robot_pivoting = left_driven == -right_driven;
+    }
+
+    // The centre moves at the average wheel speed and turns by the difference over the wheel base
+    double left = robot_left_wheel.speed * ENCODER_DISTANCE_PER_TICK_CM * dt;
+    double right = robot_right_wheel.speed * ENCODER_DISTANCE_PER_TICK_CM * dt;
+    if (robot_pivoting)
+    {
+        left *= ENCODER_PIVOT_TURN_RATIO;
+        right *= ENCODER_PIVOT_TURN_RATIO;
+    }
+    double turn = (right - left) / ENCODER_WHEEL_BASE_CM;
+    robot_x += (left + right) / 2 * cos(robot_theta + turn / 2);
+    robot_y += (left + right) / 2 * sin(robot_theta + turn / 2);
+    robot_theta += turn;
+}
+
+/**
+ * @brief Check whether both wheels have stopped.
+ *
+ * @return true if neither wheel turns.
+ */
+bool is_robot_still()
+{
+    return robot_left_wheel.speed == 0 && robot_right_wheel.speed == 0;
+}
+
+/**
+ * @brief Run the simulation with a control step every PID_CONTROL_PERIOD_MS, like the control tick of main.c.
+ *
+ * @param duration_us Longest time to run for.
+ * @param control Control step, returns false to end the run.
+ */
+void run_robot_sim(uint64_t duration_us, bool (*control)(void))
+{
+    uint64_t end = shim_time_us + duration_us;
+    uint64_t next_control = shim_time_us + PID_CONTROL_PERIOD_MS * 1000;
+
+    while (shim_time_us < end)
+    {
+        step_robot_sim();
+        if (shim_time_us >= next_control)
+        {
+            next_control += PID_CONTROL_PERIOD_MS * 1000;
+            if (!control())
+            {
+                return;
+            }
+        }
+    }
+}
+
+#endif // ROBOT_SIM_H
@@ -0,0 +1,21 @@
+/**
+ * @file flash.h
+ * @brief Host shim of hardware/flash.h.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_HARDWARE_FLASH_H
+#define SHIM_HARDWARE_FLASH_H
+
+#include "pico/stdlib.h"
+
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#define XIP_BASE 0x10000000
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif // SHIM_HARDWARE_FLASH_H
@@ -0,0 +1,15 @@
+/**
+ * @file gpio.h
+ * @brief Host shim of hardware/gpio.h.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_HARDWARE_GPIO_H
+#define SHIM_HARDWARE_GPIO_H
+
+#include "pico/stdlib.h"
+
+bool gpio_get_out_level(uint gpio);
+
+#endif // SHIM_HARDWARE_GPIO_H
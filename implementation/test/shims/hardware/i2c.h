@@ -0,0 +1,20 @@
+/**
+ * @file i2c.h
+ * @brief Host shim of hardware/i2c.h, reads return shim_i2c_data.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_HARDWARE_I2C_H
+#define SHIM_HARDWARE_I2C_H
+
+#include "pico/stdlib.h"
+
+typedef struct i2c_inst i2c_inst_t;
+extern i2c_inst_t *i2c0;
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate);
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+
+#endif // SHIM_HARDWARE_I2C_H
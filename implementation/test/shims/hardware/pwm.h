@@ -0,0 +1,26 @@
+/**
+ * @file pwm.h
+ * @brief Host shim of hardware/pwm.h.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_HARDWARE_PWM_H
+#define SHIM_HARDWARE_PWM_H
+
+#include "pico/stdlib.h"
+
+enum pwm_chan
+{
+    PWM_CHAN_A = 0,
+    PWM_CHAN_B = 1,
+};
+
+uint pwm_gpio_to_slice_num(uint gpio);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+void pwm_set_enabled(uint slice_num, bool enabled);
+void pwm_set_clkdiv(uint slice_num, float divider);
+void pwm_set_wrap(uint slice_num, uint16_t wrap);
+
+#endif // SHIM_HARDWARE_PWM_H
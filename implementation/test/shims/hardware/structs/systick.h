@@ -0,0 +1,22 @@
+/**
+ * @file systick.h
+ * @brief Host shim of hardware/structs/systick.h.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_HARDWARE_STRUCTS_SYSTICK_H
+#define SHIM_HARDWARE_STRUCTS_SYSTICK_H
+
+#include <stdint.h>
+
+typedef struct
+{
+    volatile uint32_t csr;
+    volatile uint32_t rvr;
+    volatile uint32_t cvr;
+    volatile uint32_t calib;
+} systick_hw_t;
+extern systick_hw_t *systick_hw;
+
+#endif // SHIM_HARDWARE_STRUCTS_SYSTICK_H
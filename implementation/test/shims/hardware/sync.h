@@ -0,0 +1,27 @@
+/**
+ * @file sync.h
+ * @brief Host shim of hardware/sync.h, the tests run single threaded so there is nothing to lock.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_HARDWARE_SYNC_H
+#define SHIM_HARDWARE_SYNC_H
+
+#include "pico/stdlib.h"
+
+static inline void __dmb(void)
+{
+}
+
+static inline uint32_t save_and_disable_interrupts(void)
+{
+    return 0;
+}
+
+static inline void restore_interrupts(uint32_t status)
+{
+    (void)status;
+}
+
+#endif // SHIM_HARDWARE_SYNC_H
@@ -0,0 +1,13 @@
+/**
+ * @file timer.h
+ * @brief Host shim of hardware/timer.h, the time functions are declared in pico/stdlib.h.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_HARDWARE_TIMER_H
+#define SHIM_HARDWARE_TIMER_H
+
+#include "pico/stdlib.h"
+
+#endif // SHIM_HARDWARE_TIMER_H
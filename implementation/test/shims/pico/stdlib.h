@@ -0,0 +1,71 @@
+/**
+ * @file stdlib.h
+ * @brief Host shim of the parts of pico/stdlib.h used by the firmware headers.
+ * @details
+ * Only declarations live here, shims.c implements them so the tests can control time, GPIO levels and PWM.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_PICO_STDLIB_H
+#define SHIM_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+
+// GPIO
+#define GPIO_IN 0
+#define GPIO_OUT 1
+#define GPIO_FUNC_I2C 3
+#define GPIO_FUNC_PWM 4
+#define GPIO_IRQ_EDGE_FALL 0x4u
+#define GPIO_IRQ_EDGE_RISE 0x8u
+#define IO_IRQ_BANK0 13
+#define PICO_DEFAULT_I2C_SDA_PIN 4
+#define PICO_DEFAULT_I2C_SCL_PIN 5
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t events);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_pull_up(uint gpio);
+void gpio_set_function(uint gpio, int function);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback);
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled);
+void gpio_set_irq_callback(gpio_irq_callback_t callback);
+void irq_set_enabled(uint irq, bool enabled);
+
+// Time
+typedef uint64_t absolute_time_t;
+
+struct repeating_timer
+{
+    int64_t delay_us;
+};
+typedef bool (*repeating_timer_callback_t)(struct repeating_timer *t);
+
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+absolute_time_t get_absolute_time(void);
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to);
+uint64_t to_us_since_boot(absolute_time_t t);
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out);
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out);
+bool cancel_repeating_timer(struct repeating_timer *timer);
+
+static inline void tight_loop_contents(void)
+{
+}
+
+// Standard IO
+void stdio_init_all(void);
+
+#endif // SHIM_PICO_STDLIB_H
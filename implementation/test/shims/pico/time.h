@@ -0,0 +1,13 @@
+/**
+ * @file time.h
+ * @brief Host shim of pico/time.h, the time functions are declared in pico/stdlib.h.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIM_PICO_TIME_H
+#define SHIM_PICO_TIME_H
+
+#include "pico/stdlib.h"
+
+#endif // SHIM_PICO_TIME_H
@@ -0,0 +1,307 @@
+/**
+ * @file shims.c
+ * @brief Host implementation of the Pico SDK functions used by the firmware headers, see shims.h.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "shims.h"
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+#include "hardware/i2c.h"
+#include "hardware/adc.h"
+#include "hardware/flash.h"
+#include "hardware/structs/systick.h"
+
+uint64_t shim_time_us = 0;
+bool shim_gpio_level[SHIM_GPIO_COUNT];
+uint16_t shim_pwm_level[SHIM_GPIO_COUNT];
+bool shim_pwm_enabled[SHIM_PWM_SLICE_COUNT];
+uint8_t shim_i2c_data[SHIM_I2C_DATA_SIZE] = {0, 1, 0, 0, 0, 0}; // Field along x only, a heading of 0 degrees
+dma_channel_hw_t shim_dma_hw[SHIM_DMA_CHANNEL_COUNT];
+uint32_t shim_flash_erases = 0;
+
+static int shim_dma_channels_claimed = 0;
+static adc_hw_t shim_adc_hw;
+static systick_hw_t shim_systick_hw;
+
+adc_hw_t *adc_hw = &shim_adc_hw;
+systick_hw_t *systick_hw = &shim_systick_hw;
+i2c_inst_t *i2c0 = NULL;
+
+/**
+ * @brief Move the time on.
+ *
+ * @param us Microseconds to add to shim_time_us.
+ */
+void shim_advance_us(uint64_t us)
+{
+    shim_time_us += us;
+}
+
+/**
+ * @brief Get the PWM level a pin drives.
+ *
+ * @param gpio The GPIO pin.
+ * @return The level set for the pin, or 0 if its slice is disabled.
+ */
+uint16_t shim_pwm_output(uint gpio)
+{
+    return shim_pwm_enabled[pwm_gpio_to_slice_num(gpio)] ? shim_pwm_level[gpio] : 0;
+}
+
+// Time
+uint32_t time_us_32(void)
+{
+    return (uint32_t)shim_time_us;
+}
+
+uint64_t time_us_64(void)
+{
+    return shim_time_us;
+}
+
+void sleep_ms(uint32_t ms)
+{
+    shim_advance_us((uint64_t)ms * 1000);
+}
+
+void sleep_us(uint64_t us)
+{
+    shim_advance_us(us);
+}
+
+absolute_time_t get_absolute_time(void)
+{
+    return shim_time_us;
+}
+
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+{
+    return (int64_t)(to - from);
+}
+
+uint64_t to_us_since_boot(absolute_time_t t)
+{
+    return t;
+}
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out)
+{
+    out->delay_us = (int64_t)delay_ms * 1000;
+    return true;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out)
+{
+    out->delay_us = delay_us;
+    return true;
+}
+
+bool cancel_repeating_timer(struct repeating_timer *timer)
+{
+    return true;
+}
+
+// GPIO
+void gpio_init(uint gpio)
+{
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    shim_gpio_level[gpio] = value;
+}
+
+bool gpio_get(uint gpio)
+{
+    return shim_gpio_level[gpio];
+}
+
+bool gpio_get_out_level(uint gpio)
+{
+    return shim_gpio_level[gpio];
+}
+
+void gpio_pull_up(uint gpio)
+{
+}
+
+void gpio_set_function(uint gpio, int function)
+{
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback)
+{
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled)
+{
+}
+
+void gpio_set_irq_callback(gpio_irq_callback_t callback)
+{
+}
+
+void irq_set_enabled(uint irq, bool enabled)
+{
+}
+
+// PWM
+uint pwm_gpio_to_slice_num(uint gpio)
+{
+    return (gpio >> 1) & (SHIM_PWM_SLICE_COUNT - 1);
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level)
+{
+    shim_pwm_level[gpio] = level;
+}
+
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level)
+{
+    shim_pwm_level[slice_num * 2 + chan] = level;
+}
+
+void pwm_set_enabled(uint slice_num, bool enabled)
+{
+    shim_pwm_enabled[slice_num] = enabled;
+}
+
+void pwm_set_clkdiv(uint slice_num, float divider)
+{
+}
+
+void pwm_set_wrap(uint slice_num, uint16_t wrap)
+{
+}
+
+// I2C
+uint i2c_init(i2c_inst_t *i2c, uint baudrate)
+{
+    return baudrate;
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop)
+{
+    return len;
+}
+
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] = shim_i2c_data[i % SHIM_I2C_DATA_SIZE];
+    }
+    return len;
+}
+
+// ADC
+void adc_init(void)
+{
+}
+
+void adc_gpio_init(uint gpio)
+{
+}
+
+void adc_select_input(uint input)
+{
+}
+
+void adc_set_round_robin(uint input_mask)
+{
+}
+
+uint16_t adc_read(void)
+{
+    return 0;
+}
+
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift)
+{
+}
+
+void adc_set_clkdiv(float clkdiv)
+{
+}
+
+void adc_run(bool run)
+{
+}
+
+void adc_fifo_drain(void)
+{
+}
+
+// DMA
+int dma_claim_unused_channel(bool required)
+{
+    return shim_dma_channels_claimed++;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    dma_channel_config config = {0};
+    return config;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+}
+
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits)
+{
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    shim_dma_hw[channel].transfer_count = transfer_count;
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel)
+{
+    return &shim_dma_hw[channel];
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+    return shim_dma_hw[channel].transfer_count != 0;
+}
+
+void dma_channel_abort(uint channel)
+{
+}
+
+// Flash
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    shim_flash_erases++;
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+}
+
+// Standard IO
+void stdio_init_all(void)
+{
+}
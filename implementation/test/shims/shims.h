@@ -0,0 +1,41 @@
+/**
+ * @file shims.h
+ * @brief Header file for the state behind the host shims of the Pico SDK.
+ * @details
+ * The firmware headers are compiled unchanged for the host tests. Instead of hardware, the shim functions
+ * read and write the variables below, so a test can set the time, feed GPIO levels and watch the motor outputs:
+ * 1) time_us_32() and time_us_64() return shim_time_us, which only moves when the test moves it.
+ * 2) gpio_put() and gpio_get() use shim_gpio_level.
+ * 3) pwm_set_gpio_level() stores the level of every pin, and shim_pwm_output() gives the level a pin drives,
+ *    0 while its slice is disabled.
+ * 4) i2c_read_blocking() copies shim_i2c_data, so the magnetometer reads a fixed field.
+ * 5) Every DMA channel is a dma_channel_hw_t the test can count down, and is busy while its count is not 0.
+ * Repeating timers are never run, the test calls the callbacks itself.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef SHIMS_H
+#define SHIMS_H
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+
+#define SHIM_GPIO_COUNT 30
+#define SHIM_PWM_SLICE_COUNT 8
+#define SHIM_DMA_CHANNEL_COUNT 12
+#define SHIM_I2C_DATA_SIZE 6
+
+extern uint64_t shim_time_us;                               // Current time in microseconds
+extern bool shim_gpio_level[SHIM_GPIO_COUNT];               // Level of every GPIO pin
+extern uint16_t shim_pwm_level[SHIM_GPIO_COUNT];            // PWM level set for every GPIO pin
+extern bool shim_pwm_enabled[SHIM_PWM_SLICE_COUNT];         // Flag set for every enabled PWM slice
+extern uint8_t shim_i2c_data[SHIM_I2C_DATA_SIZE];           // Bytes returned by every I2C read
+extern dma_channel_hw_t shim_dma_hw[SHIM_DMA_CHANNEL_COUNT];// Registers of every DMA channel
+extern uint32_t shim_flash_erases;                          // Number of flash sector erases
+
+// Function prototypes
+void shim_advance_us(uint64_t us);
+uint16_t shim_pwm_output(uint gpio);
+
+#endif // SHIMS_H
@@ -0,0 +1,73 @@
+/**
+ * @file test.h
+ * @brief Header file for the checks shared by the host tests.
+ * @details
+ * Every test is a small program that runs its checks with CHECK() and returns finish_tests(),
+ * so ctest sees a failure as a non-zero exit code. Measurements are printed along the way.
+ *
+ * @date November 26, 2023
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Count a failed check and print where it was, the test carries on with the next check
+#define CHECK(condition)                                                               \
+    do                                                                                 \
+    {                                                                                  \
+        test_checks++;                                                                 \
+        if (!(condition))                                                              \
+        {                                                                              \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition);                \
+            test_failures++;                                                           \
+        }                                                                              \
+    } while (0)
+
+int test_checks = 0;    // Number of checks run
+int test_failures = 0;  // Number of checks that failed
+
+// Function prototypes
+double get_test_seconds();
+uint32_t get_test_random();
+int finish_tests(const char *name);
+
+/**
+ * @brief Get the processor time used so far, for benchmarks.
+ *
+ * @return The processor time in seconds.
+ */
+double get_test_seconds()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/**
+ * @brief Get a pseudo random number, the same sequence on every run so the results repeat.
+ *
+ * @return A random number from 0 to 2^31 - 1.
+ */
+uint32_t get_test_random()
+{
+    static uint32_t state = 12345;
+
+    state = state * 1103515245 + 12345;
+    return (state >> 1) & 0x7FFFFFFF;
+}
+
+/**
+ * @brief Print the result of the checks.
+ *
+ * @param name Name of the test.
+ * @return 0 if every check passed, 1 otherwise.
+ */
+int finish_tests(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif // TEST_H
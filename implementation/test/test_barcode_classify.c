@@ -0,0 +1,88 @@
+/**
+ * @file test_barcode_classify.c
+ * @brief Host test of the per-symbol narrow/wide classification at changing speeds.
+ * @details
+ * Barcodes are driven over at speeds that ramp and wobble, with random jitter on every edge, and replayed
+ * through the interrupt, the edge buffer and the decoder (see barcode_scan.h). The widths are measured in time,
+ * so a speed change within a barcode stretches some symbols more than others, and only a classifier that
+ * splits every symbol by its own widths reads them. The decode success rate of every case is printed,
+ * and a scan counts as read when the right characters were reported or are waiting for a vote.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "motion_queue.h"
+#include "infrared.h"
+#include "barcode_scan.h"
+
+#define SCANS_PER_CASE 100
+
+/**
+ * @brief A speed profile and the success rate it must reach.
+ */
+typedef struct
+{
+    const char *name;       // Description printed with the result
+    barcode_scan_t scan;    // How the barcode is driven over
+    double min_rate;        // Lowest acceptable success rate
+} classify_case_t;
+
+static const classify_case_t classify_cases[] = {
+    {"constant 10 cm/s", {1.5, 3.0, 10, 10, 0, 0, 0}, 1.0},
+    {"constant 40 cm/s", {1.5, 3.0, 40, 40, 0, 0, 0}, 1.0},
+    {"accelerate 10 to 40 cm/s", {1.5, 3.0, 10, 40, 0, 0, 0}, 1.0},
+    {"brake 40 to 10 cm/s", {1.5, 3.0, 40, 10, 0, 0, 0}, 1.0},
+    {"wobble 20% around 20 cm/s", {1.5, 3.0, 20, 20, 0.2, 0.25, 0}, 0.95},
+    {"accelerate with 1 ms jitter", {1.5, 3.0, 10, 30, 0, 0, 1000}, 0.95},
+    {"wobble 20% with 2 ms jitter", {1.5, 3.0, 15, 25, 0.2, 0.3, 2000}, 0.9},
+    {"narrow ratio 2.5, 1 ms jitter", {1.5, 2.5, 15, 25, 0, 0, 1000}, 0.9},
+};
+
+int main()
+{
+    start_barcode_scans();
+
+    // Measure the elements in time, so the speed changes reach the classifier
+    barcode_width_from_encoder = false;
+
+    for (int c = 0; c < sizeof(classify_cases) / sizeof(classify_cases[0]); c++)
+    {
+        const classify_case_t *test_case = &classify_cases[c];
+        int read = 0;
+        int misread = 0;
+
+        for (int s = 0; s < SCANS_PER_CASE; s++)
+        {
+            char message[BARCODE_MESSAGE_SIZE + 1];
+            char result[BARCODE_MESSAGE_SIZE + 1];
+            barcode_scan_t scan = test_case->scan;
+
+            make_scan_message(message);
+            scan.reverse = (s % 2) == 1;
+            reset_barcode_scan();
+            record_barcode_scan(message, &scan);
+            replay_barcode_scan();
+
+            if (get_scan_result(result) != SCAN_MISSED)
+            {
+                if (strcmp(result, message) == 0)
+                {
+                    read++;
+                }
+                else
+                {
+                    misread++;
+                }
+            }
+        }
+
+        double rate = (double)read / SCANS_PER_CASE;
+        printf("%-32s read %3d%%, misread %d\n", test_case->name, (int)(rate * 100 + 0.5), misread);
+        CHECK(rate >= test_case->min_rate);
+        CHECK(misread == 0);
+    }
+
+    return finish_tests("test_barcode_classify");
+}
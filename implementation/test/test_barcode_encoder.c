@@ -0,0 +1,103 @@
+/**
+ * @file test_barcode_encoder.c
+ * @brief Host test of the barcode widths measured by distance from the encoders.
+ * @details
+ * Recorded streams of barcode and encoder edges are replayed through the interrupt, the edge buffer and
+ * the decoder (see barcode_scan.h), once with the widths measured by the encoder position at every edge and
+ * once with the widths measured in time. The scans run at cruise speed and through hard speed changes,
+ * where a barcode measured in time stretches within a single symbol. The read rate of both is printed,
+ * and the encoder widths must read every scan.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "motion_queue.h"
+#include "infrared.h"
+#include "barcode_scan.h"
+
+#define SCANS_PER_CASE 100
+
+/**
+ * @brief A speed profile and the success rate the encoder widths must reach.
+ */
+typedef struct
+{
+    const char *name;       // Description printed with the result
+    barcode_scan_t scan;    // How the barcode is driven over
+    double min_rate;        // Lowest acceptable success rate with the encoder widths
+} encoder_case_t;
+
+static const encoder_case_t encoder_cases[] = {
+    {"cruise 30 cm/s", {1.5, 3.0, 30, 30, 0, 0, 0}, 1.0},
+    {"cruise 60 cm/s", {1.5, 3.0, 60, 60, 0, 0, 0}, 1.0},
+    {"accelerate 5 to 60 cm/s", {1.5, 3.0, 5, 60, 0, 0, 0}, 1.0},
+    {"brake 60 to 5 cm/s", {1.5, 3.0, 60, 5, 0, 0, 0}, 1.0},
+    {"wobble 50% around 40 cm/s", {1.5, 3.0, 40, 40, 0.5, 0.2, 0}, 1.0},
+    {"near stop every 0.5 s at 30 cm/s", {1.5, 3.0, 30, 30, 0.9, 0.5, 0}, 1.0},
+};
+
+/**
+ * @brief Replay scans of random messages and count the ones read right.
+ *
+ * @param scan How the barcode is driven over.
+ * @param misread Pointer to where the number of wrong reads is stored.
+ * @return The fraction of the scans read right.
+ */
+double run_encoder_case(const barcode_scan_t *scan, int *misread)
+{
+    int read = 0;
+
+    *misread = 0;
+    for (int s = 0; s < SCANS_PER_CASE; s++)
+    {
+        char message[BARCODE_MESSAGE_SIZE + 1];
+        char result[BARCODE_MESSAGE_SIZE + 1];
+        barcode_scan_t pass = *scan;
+
+        make_scan_message(message);
+        pass.reverse = (s % 2) == 1;
+        reset_barcode_scan();
+        record_barcode_scan(message, &pass);
+        replay_barcode_scan();
+
+        if (get_scan_result(result) != SCAN_MISSED)
+        {
+            if (strcmp(result, message) == 0)
+            {
+                read++;
+            }
+            else
+            {
+                (*misread)++;
+            }
+        }
+    }
+
+    return (double)read / SCANS_PER_CASE;
+}
+
+int main()
+{
+    start_barcode_scans();
+
+    for (int c = 0; c < sizeof(encoder_cases) / sizeof(encoder_cases[0]); c++)
+    {
+        const encoder_case_t *test_case = &encoder_cases[c];
+        int encoder_misread;
+        int time_misread;
+
+        barcode_width_from_encoder = true;
+        double encoder_rate = run_encoder_case(&test_case->scan, &encoder_misread);
+        barcode_width_from_encoder = false;
+        double time_rate = run_encoder_case(&test_case->scan, &time_misread);
+
+        printf("%-34s encoder read %3d%%, misread %d; time read %3d%%, misread %d\n", test_case->name,
+               (int)(encoder_rate * 100 + 0.5), encoder_misread, (int)(time_rate * 100 + 0.5), time_misread);
+        CHECK(encoder_rate >= test_case->min_rate);
+        CHECK(encoder_misread == 0);
+    }
+
+    return finish_tests("test_barcode_encoder");
+}
@@ -0,0 +1,196 @@
+/**
+ * @file test_barcode_voting.c
+ * @brief Host test of the glitch filter, the confidence scores and the multi-pass voting of barcode reads.
+ * @details
+ * Scans with injected glitches are replayed through the interrupt, the edge buffer and the decoder
+ * (see barcode_scan.h):
+ * 1) Glitches narrower than the glitch width are merged by the glitch filter, and the scans read as if
+ *    the glitches were not there. The same scans are also replayed with the filter off for comparison.
+ * 2) Glitches wider than the glitch width reach the decoder. They must never be reported as a wrong barcode.
+ * 3) A faded print with a wide to narrow ratio of 1.8 decodes with a low confidence. The first pass must not
+ *    be reported but start the re-scan manoeuvre, and the pass back over the barcode must report it.
+ * The outcome of every case is printed.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "motion_queue.h"
+#include "infrared.h"
+#include "barcode_scan.h"
+
+#define SCANS_PER_CASE 100
+
+/**
+ * @brief Outcomes of the scans of a case.
+ */
+typedef struct
+{
+    int read;       // Scans reported with the right characters
+    int voted;      // Scans waiting for another pass
+    int missed;     // Scans that read nothing
+    int misread;    // Scans reported with the wrong characters
+} voting_result_t;
+
+/**
+ * @brief Replay single passes over random messages and count the outcomes.
+ *
+ * @param scan How the barcode is printed and driven over.
+ * @return The outcomes of the scans.
+ */
+voting_result_t run_single_passes(const barcode_scan_t *scan)
+{
+    voting_result_t result = {0};
+
+    for (int s = 0; s < SCANS_PER_CASE; s++)
+    {
+        char message[BARCODE_MESSAGE_SIZE + 1];
+        char read[BARCODE_MESSAGE_SIZE + 1];
+        barcode_scan_t pass = *scan;
+
+        make_scan_message(message);
+        pass.reverse = (s % 2) == 1;
+        reset_barcode_scan();
+        record_barcode_scan(message, &pass);
+        replay_barcode_scan();
+
+        switch (get_scan_result(read))
+        {
+        case SCAN_REPORTED:
+            if (strcmp(read, message) == 0)
+            {
+                result.read++;
+            }
+            else
+            {
+                result.misread++;
+            }
+            break;
+        case SCAN_VOTED:
+            result.voted++;
+            break;
+        default:
+            result.missed++;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Print the outcomes of a case.
+ *
+ * @param name Description of the case.
+ * @param result The outcomes of its scans.
+ */
+void print_voting_result(const char *name, voting_result_t result)
+{
+    printf("%-36s read %3d, voted %3d, missed %3d, misread %d\n", name, result.read, result.voted,
+           result.missed, result.misread);
+}
+
+/**
+ * @brief Check that a low confidence pass starts the re-scan manoeuvre: back up, then drive forward again.
+ *
+ * @return true if the two motion commands of the re-scan were queued.
+ */
+bool rescan_was_queued()
+{
+    if (motion_queue_head - motion_queue_tail != 2)
+    {
+        return false;
+    }
+
+    const motion_command_t *backup = &motion_queue[motion_queue_tail & MOTION_QUEUE_MASK];
+    const motion_command_t *again = &motion_queue[(motion_queue_tail + 1) & MOTION_QUEUE_MASK];
+    return backup->type == MOTION_VELOCITY && backup->speed < 0 && backup->duration_ms == BARCODE_RESCAN_BACKUP_MS &&
+           again->type == MOTION_VELOCITY && again->speed > 0 && again->duration_ms == 0;
+}
+
+int main()
+{
+    start_barcode_scans();
+
+    // Glitches narrower than the narrowest real element (0.15 cm against about 0.27 cm)
+    barcode_scan_t narrow_glitches = {1.5, 3.0, 20, 20, 0, 0, 0, false, 3, 0.15};
+    voting_result_t filtered = run_single_passes(&narrow_glitches);
+    print_voting_result("3 glitches of 0.15 cm, filter on", filtered);
+    printf("  glitches merged by the filter %lu\n", (unsigned long)barcode_glitches_rejected);
+    CHECK(filtered.read == SCANS_PER_CASE);
+    CHECK(barcode_glitches_rejected >= 3 * SCANS_PER_CASE);
+
+    barcode_glitch_filter_enabled = false;
+    voting_result_t unfiltered = run_single_passes(&narrow_glitches);
+    print_voting_result("3 glitches of 0.15 cm, filter off", unfiltered);
+    CHECK(unfiltered.misread == 0);
+    barcode_glitch_filter_enabled = true;
+
+    // Glitches as wide as a narrow element's third get past the filter and break the symbol they are in
+    barcode_scan_t wide_glitches = {1.5, 3.0, 20, 20, 0, 0, 0, false, 1, 0.5};
+    voting_result_t broken = run_single_passes(&wide_glitches);
+    print_voting_result("1 glitch of 0.5 cm", broken);
+    CHECK(broken.misread == 0);
+
+    // A faded print only reaches the accept confidence with a second pass, which must end within TIMEOUT_MICROSECONDS
+    barcode_scan_t faded = {1.5, 1.8, 40, 40, 0, 0, 0};
+    int first_voted = 0;
+    int rescans_queued = 0;
+    int second_read = 0;
+    int misread = 0;
+    for (int s = 0; s < SCANS_PER_CASE; s++)
+    {
+        char message[BARCODE_MESSAGE_SIZE + 1];
+        char read[BARCODE_MESSAGE_SIZE + 1];
+
+        make_scan_message(message);
+        reset_barcode_scan();
+
+        // First pass, forward over the barcode
+        faded.reverse = false;
+        record_barcode_scan(message, &faded);
+        replay_barcode_scan();
+        scan_result_t first = get_scan_result(read);
+        if (first == SCAN_VOTED && strcmp(read, message) == 0)
+        {
+            first_voted++;
+        }
+        else if (first == SCAN_REPORTED)
+        {
+            misread++;
+        }
+
+        // The main loop starts the re-scan, which backs up over the barcode
+        update_barcode_rescan();
+        if (rescan_was_queued())
+        {
+            rescans_queued++;
+        }
+        preempt_motion();
+
+        // Second pass, from the other end
+        faded.reverse = true;
+        record_barcode_scan(message, &faded);
+        replay_barcode_scan();
+        if (get_scan_result(read) == SCAN_REPORTED)
+        {
+            if (strcmp(read, message) == 0 && decoded_confidence >= BARCODE_CONFIDENCE_ACCEPT)
+            {
+                second_read++;
+            }
+            else
+            {
+                misread++;
+            }
+        }
+    }
+    printf("%-36s voted %3d, re-scans %3d, read after re-scan %3d, misread %d\n", "faded print, ratio 1.8",
+           first_voted, rescans_queued, second_read, misread);
+    CHECK(first_voted == SCANS_PER_CASE);
+    CHECK(rescans_queued == SCANS_PER_CASE);
+    CHECK(second_read == SCANS_PER_CASE);
+    CHECK(misread == 0);
+
+    return finish_tests("test_barcode_voting");
+}
@@ -0,0 +1,224 @@
+/**
+ * @file test_code39.c
+ * @brief Host test and benchmark of the Code 39 lookup table.
+ * @details
+ * 1) Every symbol in code39_table is checked against its character, in both read directions,
+ *    and every other key is checked to be invalid.
+ * 2) The mod 43 check character is checked on a known message.
+ * 3) Symbols per second are measured for the packed-key lookup and for the string path it replaced,
+ *    which built a "1"/"0" module string with strcat() and searched it with a chain of strstr() calls.
+ *    The benchmark runs on the host, so only the ratio between the two paths says anything about the RP2040.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "test.h"
+#include "code39.h"
+
+#define BENCHMARK_SYMBOLS 2000000   // Symbols decoded by each path
+#define SYMBOL_COUNT 44             // 43 data characters and the '*' delimiter
+
+// Characters of every symbol, in the order of the string path
+static const char symbol_characters[] = CODE39_CHARACTERS "*";
+
+uint16_t symbol_keys[SYMBOL_COUNT];         // Key of every symbol
+char symbol_patterns[SYMBOL_COUNT][16];     // Module string of every symbol, 15 modules
+volatile char benchmark_sink;               // Keeps the decoded characters from being optimised away
+
+/**
+ * @brief Unpack a key into the narrow/wide flags of its elements.
+ *
+ * @param key The 9 bit key.
+ * @param wide Array of 9 flags that is filled in.
+ */
+void unpack_key(uint16_t key, bool wide[CODE39_ELEMENTS_PER_SYMBOL])
+{
+    for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+    {
+        wide[i] = (key >> (CODE39_ELEMENTS_PER_SYMBOL - 1 - i)) & 1;
+    }
+}
+
+/**
+ * @brief Decode a symbol the way the old decoder did, through a module string and strstr().
+ *
+ * @param wide Array of 9 flags, true for a wide element.
+ * @return The decoded character, or CODE39_INVALID if no pattern matched.
+ */
+char decode_with_strings(const bool wide[CODE39_ELEMENTS_PER_SYMBOL])
+{
+    char modules[32] = "";
+
+    // Bars are 1s and spaces 0s, a wide element is three modules
+    for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+    {
+        bool is_bar = (i % 2) == 0;
+        strcat(modules, wide[i] ? (is_bar ? "111" : "000") : (is_bar ? "1" : "0"));
+    }
+
+    for (int i = 0; i < SYMBOL_COUNT; i++)
+    {
+        if (strstr(modules, symbol_patterns[i]) != NULL)
+        {
+            return symbol_characters[i];
+        }
+    }
+
+    return CODE39_INVALID;
+}
+
+/**
+ * @brief Decode a symbol through the packed key and code39_table.
+ *
+ * @param wide Array of 9 flags, true for a wide element.
+ * @return The decoded character, or CODE39_INVALID if the key is not a Code 39 symbol.
+ */
+char decode_with_table(const bool wide[CODE39_ELEMENTS_PER_SYMBOL])
+{
+    return code39_lookup(code39_pack_key(wide));
+}
+
+/**
+ * @brief Find the key and module string of every symbol from code39_table.
+ */
+void build_symbols()
+{
+    for (int i = 0; i < SYMBOL_COUNT; i++)
+    {
+        symbol_keys[i] = 0xFFFF;
+        for (int key = 0; key < CODE39_KEY_COUNT; key++)
+        {
+            if (code39_table[key] == symbol_characters[i])
+            {
+                symbol_keys[i] = key;
+            }
+        }
+
+        bool wide[CODE39_ELEMENTS_PER_SYMBOL];
+        unpack_key(symbol_keys[i], wide);
+        symbol_patterns[i][0] = '\0';
+        for (int j = 0; j < CODE39_ELEMENTS_PER_SYMBOL; j++)
+        {
+            bool is_bar = (j % 2) == 0;
+            strcat(symbol_patterns[i], wide[j] ? (is_bar ? "111" : "000") : (is_bar ? "1" : "0"));
+        }
+    }
+}
+
+/**
+ * @brief Check every key of the table.
+ */
+void test_table()
+{
+    int valid_keys = 0;
+
+    for (int key = 0; key < CODE39_KEY_COUNT; key++)
+    {
+        bool wide[CODE39_ELEMENTS_PER_SYMBOL];
+        int wide_count = 0;
+
+        unpack_key(key, wide);
+        for (int i = 0; i < CODE39_ELEMENTS_PER_SYMBOL; i++)
+        {
+            wide_count += wide[i];
+        }
+
+        // Only keys with exactly 3 wide elements can be symbols, and packing gives the key back
+        CHECK(code39_pack_key(wide) == key);
+        if (code39_lookup(key) != CODE39_INVALID)
+        {
+            CHECK(wide_count == CODE39_WIDE_ELEMENTS);
+            valid_keys++;
+        }
+    }
+    CHECK(valid_keys == SYMBOL_COUNT);
+
+    for (int i = 0; i < SYMBOL_COUNT; i++)
+    {
+        bool wide[CODE39_ELEMENTS_PER_SYMBOL];
+
+        CHECK(symbol_keys[i] != 0xFFFF);
+        unpack_key(symbol_keys[i], wide);
+        CHECK(decode_with_table(wide) == symbol_characters[i]);
+        CHECK(decode_with_strings(wide) == symbol_characters[i]);
+        CHECK(code39_lookup_direction(code39_reverse_key(symbol_keys[i]), true) == symbol_characters[i]);
+        CHECK(code39_reverse_key(code39_reverse_key(symbol_keys[i])) == symbol_keys[i]);
+    }
+
+    CHECK(code39_lookup(CODE39_KEY_START_STOP) == CODE39_START_STOP);
+    CHECK(code39_reverse_key(CODE39_KEY_START_STOP) == CODE39_KEY_START_STOP_REVERSED);
+}
+
+/**
+ * @brief Check the width classification and the mod 43 check character.
+ */
+void test_classify_and_check()
+{
+    // 'A' is 100001001, with wide elements of 3 and narrow elements of 1
+    uint32_t widths[CODE39_ELEMENTS_PER_SYMBOL] = {3, 1, 1, 1, 1, 3, 1, 1, 3};
+    bool wide[CODE39_ELEMENTS_PER_SYMBOL];
+    uint8_t confidence = 0;
+
+    CHECK(code39_classify_widths(widths, wide, &confidence));
+    CHECK(code39_lookup(code39_pack_key(wide)) == 'A');
+    CHECK(confidence == CODE39_MAX_CONFIDENCE);
+
+    // A wide element barely wider than the narrow ones is not a clean split
+    widths[0] = 1;
+    widths[5] = 1;
+    CHECK(!code39_classify_widths(widths, wide, &confidence));
+
+    // "CODE39" has the check character 'W'
+    CHECK(code39_verify_check_character("CODE39W", 7));
+    CHECK(!code39_verify_check_character("CODE39X", 7));
+    CHECK(!code39_verify_check_character("W", 1));
+}
+
+/**
+ * @brief Measure symbols per second for both decoding paths.
+ */
+void benchmark_paths()
+{
+    static bool wide[SYMBOL_COUNT][CODE39_ELEMENTS_PER_SYMBOL];
+    static uint8_t order[BENCHMARK_SYMBOLS];
+
+    for (int i = 0; i < SYMBOL_COUNT; i++)
+    {
+        unpack_key(symbol_keys[i], wide[i]);
+    }
+    for (int i = 0; i < BENCHMARK_SYMBOLS; i++)
+    {
+        order[i] = get_test_random() % SYMBOL_COUNT;
+    }
+
+    double start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_SYMBOLS; i++)
+    {
+        benchmark_sink = decode_with_strings(wide[order[i]]);
+    }
+    double string_seconds = get_test_seconds() - start;
+
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_SYMBOLS; i++)
+    {
+        benchmark_sink = decode_with_table(wide[order[i]]);
+    }
+    double table_seconds = get_test_seconds() - start;
+
+    printf("strcat/strstr path: %.0f symbols/s\n", BENCHMARK_SYMBOLS / string_seconds);
+    printf("lookup table path:  %.0f symbols/s (%.1f times faster)\n", BENCHMARK_SYMBOLS / table_seconds,
+           string_seconds / table_seconds);
+
+    CHECK(table_seconds < string_seconds);
+}
+
+int main()
+{
+    build_symbols();
+    test_table();
+    test_classify_and_check();
+    benchmark_paths();
+
+    return finish_tests("test_code39");
+}
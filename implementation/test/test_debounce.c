@@ -0,0 +1,225 @@
+/**
+ * @file test_debounce.c
+ * @brief Host test of the timestamp based debouncing of the encoder and line sensor pins.
+ * @details
+ * Edge trains are made up for a wheel turning at speeds up to well beyond the top speed of the robot,
+ * with a burst of contact bounces after every real edge, and replayed through the GPIO interrupt:
+ * 1) Every encoder tick must be counted once, and the period between ticks must be the real one.
+ *    The ticks the old 200 ms cooldown would have counted are printed next to them.
+ * 2) The line sensors chatter for a few milliseconds at every black/white boundary, and every boundary
+ *    must give exactly one event with the right colour.
+ * 3) A burst that ends on the other level inside the dead-time must be accepted by debounce_settle(),
+ *    and settle_line_sensors() must post the settled colour, with EVENT_BOTH_LINES_BLACK when both are black.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "motion_queue.h"
+#include "infrared.h"
+#include "barcode_scan.h"
+
+#define TICKS_PER_SPEED 200
+#define OLD_COOLDOWN_US 200000          // Time the old interrupt handler disabled the pin for after every edge
+#define ENCODER_BOUNCE_US 300           // Encoder contacts bounce for up to this long after an edge
+#define LINE_CHATTER_US 4000            // Line sensors chatter for up to this long at a boundary
+
+static const double encoder_speeds[] = {5, 20, 50, 100, 200, 400};
+
+/**
+ * @brief Replay a real edge followed by a burst of bounces, the pin always ends on the new level.
+ *
+ * @param pin The pin.
+ * @param timestamp Time of the real edge.
+ * @param level Level after the real edge.
+ * @param bounce_us Longest time the bounces go on for.
+ * @return The number of edges replayed.
+ */
+int replay_bouncing_edge(uint8_t pin, uint64_t timestamp, bool level, uint32_t bounce_us)
+{
+    int bounces = get_test_random() % 5;
+    uint64_t time = timestamp;
+
+    shim_time_us = time;
+    gpio_dispatch_callback(pin, level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+    for (int i = 0; i < bounces; i++)
+    {
+        // Back to the old level and again to the new one
+        time += 1 + get_test_random() % (bounce_us / (2 * bounces));
+        shim_time_us = time;
+        gpio_dispatch_callback(pin, level ? GPIO_IRQ_EDGE_FALL : GPIO_IRQ_EDGE_RISE);
+        time += 1 + get_test_random() % (bounce_us / (2 * bounces));
+        shim_time_us = time;
+        gpio_dispatch_callback(pin, level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+    }
+
+    return 1 + 2 * bounces;
+}
+
+/**
+ * @brief Replay a single edge of a line sensor.
+ *
+ * @param pin The pin.
+ * @param timestamp Time of the edge.
+ * @param level Level after the edge.
+ */
+void replay_line_edge(uint8_t pin, uint64_t timestamp, bool level)
+{
+    shim_time_us = timestamp;
+    gpio_dispatch_callback(pin, level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+}
+
+/**
+ * @brief Take all the events out of the queue.
+ *
+ * @return A mask with bit 1 << type set for every type of event taken.
+ */
+uint32_t pop_event_mask()
+{
+    event_t event;
+    uint32_t mask = 0;
+
+    while (pop_event(&event))
+    {
+        mask |= 1u << event.type;
+    }
+
+    return mask;
+}
+
+/**
+ * @brief Count the rising edges the old handler saw, it disabled the pin for OLD_COOLDOWN_US after every edge.
+ *
+ * @param half_period_us Time between the real edges.
+ * @param ticks Number of real ticks.
+ * @return The number of ticks counted.
+ */
+int count_old_cooldown_ticks(double half_period_us, int ticks)
+{
+    double enabled_at = 0;
+    int counted = 0;
+
+    for (int edge = 0; edge < 2 * ticks; edge++)
+    {
+        double time = edge * half_period_us;
+        if (time >= enabled_at)
+        {
+            counted += (edge % 2) == 0;
+            enabled_at = time + OLD_COOLDOWN_US;
+        }
+    }
+
+    return counted;
+}
+
+int main()
+{
+    start_barcode_scans();
+
+    // Encoder ticks at increasing wheel speeds, every edge followed by bounces
+    for (int s = 0; s < sizeof(encoder_speeds) / sizeof(encoder_speeds[0]); s++)
+    {
+        double half_period_us = ENCODER_DISTANCE_PER_TICK_CM / encoder_speeds[s] * 1e6 / 2;
+        int start_count = left_encoder_count;
+        uint32_t rejected_before = left_encoder_debounce.rejected_edges;
+        uint64_t start = shim_time_us + 1000000;
+        int edges = 0;
+
+        for (int tick = 0; tick < TICKS_PER_SPEED; tick++)
+        {
+            edges += replay_bouncing_edge(SCAN_ENCODER_LEFT_PIN, start + (uint64_t)(2 * tick * half_period_us), true, ENCODER_BOUNCE_US);
+            edges += replay_bouncing_edge(SCAN_ENCODER_LEFT_PIN, start + (uint64_t)((2 * tick + 1) * half_period_us), false, ENCODER_BOUNCE_US);
+        }
+
+        int counted = left_encoder_count - start_count;
+        double period_error = fabs(left_encoder_period - 2 * half_period_us);
+        printf("%3.0f cm/s: %d ticks, %d edges, counted %d, %lu bounces ignored, period error %.1f us, old cooldown counted %d\n",
+               encoder_speeds[s], TICKS_PER_SPEED, edges, counted, (unsigned long)(left_encoder_debounce.rejected_edges - rejected_before),
+               period_error, count_old_cooldown_ticks(half_period_us, TICKS_PER_SPEED));
+        CHECK(counted == TICKS_PER_SPEED);
+        CHECK(period_error <= 1);
+    }
+
+    // Line sensor boundaries 2 cm apart at 30 cm/s, with chatter at every boundary
+    event_t event;
+    while (pop_event(&event))
+    {
+        // Drop the events from before
+    }
+    int boundaries = 0;
+    int events = 0;
+    int wrong_colour = 0;
+    uint64_t start = shim_time_us + 1000000;
+    bool black = false;
+    for (int b = 0; b < 100; b++)
+    {
+        black = !black;
+        replay_bouncing_edge(SCAN_LEFT_LINE_SENSOR_PIN, start + b * 66667, black, LINE_CHATTER_US);
+        boundaries++;
+
+        // The main loop runs after the chatter and takes the events
+        shim_time_us += DEBOUNCE_LINE_SENSOR_DEAD_TIME_US;
+        settle_line_sensors();
+        while (pop_event(&event))
+        {
+            if (event.type == EVENT_LEFT_LINE_BLACK || event.type == EVENT_LEFT_LINE_WHITE)
+            {
+                events++;
+                wrong_colour += (event.type == EVENT_LEFT_LINE_BLACK) != black;
+            }
+        }
+        wrong_colour += is_left_line_black != black;
+    }
+    printf("line sensor: %d boundaries, %d events, %d with the wrong colour\n", boundaries, events, wrong_colour);
+    CHECK(events == boundaries);
+    CHECK(wrong_colour == 0);
+
+    // Chatter that ends on black inside the dead-time, with the right sensor already on black
+    start = shim_time_us + 1000000;
+    replay_line_edge(SCAN_RIGHT_LINE_SENSOR_PIN, start, true);
+    replay_line_edge(SCAN_LEFT_LINE_SENSOR_PIN, start + 10000, true);
+    replay_line_edge(SCAN_LEFT_LINE_SENSOR_PIN, start + 20000, false);
+    replay_line_edge(SCAN_LEFT_LINE_SENSOR_PIN, start + 21000, true);
+    CHECK(pop_event_mask() == (1u << EVENT_RIGHT_LINE_BLACK | 1u << EVENT_LEFT_LINE_BLACK | 1u << EVENT_BOTH_LINES_BLACK | 1u << EVENT_LEFT_LINE_WHITE));
+    CHECK(!is_left_line_black);
+    shim_time_us = start + 20000 + DEBOUNCE_LINE_SENSOR_DEAD_TIME_US - 1;
+    settle_line_sensors();
+    CHECK(pop_event_mask() == 0);
+    shim_time_us = start + 20000 + DEBOUNCE_LINE_SENSOR_DEAD_TIME_US;
+    settle_line_sensors();
+    CHECK(is_left_line_black);
+    CHECK(pop_event_mask() == (1u << EVENT_LEFT_LINE_BLACK | 1u << EVENT_BOTH_LINES_BLACK));
+
+    // Chatter of the right sensor that ends on white inside the dead-time
+    replay_line_edge(SCAN_RIGHT_LINE_SENSOR_PIN, start + 40000, false);
+    replay_line_edge(SCAN_RIGHT_LINE_SENSOR_PIN, start + 50000, true);
+    replay_line_edge(SCAN_RIGHT_LINE_SENSOR_PIN, start + 51000, false);
+    pop_event_mask();
+    CHECK(is_right_line_black);
+    shim_time_us = start + 50000 + DEBOUNCE_LINE_SENSOR_DEAD_TIME_US;
+    settle_line_sensors();
+    CHECK(!is_right_line_black);
+    CHECK(pop_event_mask() == 1u << EVENT_RIGHT_LINE_WHITE);
+    settle_line_sensors();
+    CHECK(pop_event_mask() == 0);
+
+    // A burst that ends on the other level inside the dead-time is accepted once the dead-time is over
+    debounce_t debounce;
+    debounce_init(&debounce, 500, false, 0);
+    CHECK(debounce_edge(&debounce, 1000, true));
+    CHECK(!debounce_edge(&debounce, 1100, false));
+    CHECK(!debounce_settle(&debounce, 1400));
+    CHECK(debounce_settle(&debounce, 1500));
+    CHECK(!debounce.level);
+
+    // A change hidden in the dead-time is a full pulse, the edge back after it is accepted
+    debounce_init(&debounce, 500, false, 0);
+    CHECK(debounce_edge(&debounce, 1000, true));
+    CHECK(!debounce_edge(&debounce, 1200, false));
+    CHECK(!debounce_edge(&debounce, 1300, true));
+    CHECK(!debounce_edge(&debounce, 1600, true));
+    CHECK(debounce.accepted_edges == 1);
+
+    return finish_tests("test_debounce");
+}
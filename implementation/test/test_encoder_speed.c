@@ -0,0 +1,235 @@
+/**
+ * @file test_encoder_speed.c
+ * @brief Host test of the accuracy and the cost of the encoder speed estimate.
+ * @details
+ * 1) A wheel turns at constant speeds, ramps and stops. Its encoder slots are not evenly spaced: every edge
+ *    is off its nominal place by up to SLOT_SPACING_ERROR of a tick, the same every turn, as on a printed disc.
+ *    The edges go through the encoder interrupt, and every PID_CONTROL_PERIOD_MS update_encoder_speeds() runs
+ *    like the control tick. Its M/T estimate, filtered at the control rate, is compared with the true speed,
+ *    next to the speed over the last period alone that the interrupt used to work out in double precision.
+ * 2) The calculations are timed on the host: the old double division per tick, the integer store the
+ *    interrupt does now, and the fixed-point M/T step per control step. These are host nanoseconds only,
+ *    where the division runs on an FPU. The cycles on the RP2040 are not measured here: set
+ *    ENCODER_PROFILE_CYCLES to 1 in motor.h to time them with SysTick on the robot.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "robot_sim.h"
+
+#define SLOT_SPACING_ERROR 0.05         // Largest error of the place of an encoder edge in ticks
+#define SPEED_STEP_US 10                // Time step of the wheel
+#define SPEED_SETTLE_US 500000          // Time the estimate may take to settle before it is compared
+#define BENCHMARK_RUNS 10000000
+
+/**
+ * @brief A speed profile of the wheel.
+ */
+typedef struct
+{
+    const char *name;       // Description printed with the result
+    double start_speed;     // Speed at the start in ticks per second
+    double end_speed;       // Speed at the end in ticks per second
+    uint32_t duration_us;   // Time the speed ramps from start_speed to end_speed over
+    double max_rms;         // Largest acceptable RMS error of the filtered speed, relative to the top speed
+    bool beats_last_period; // Flag set if the filtered speed must be closer than the last period alone
+} speed_case_t;
+
+// Along a ramp the filter lags, and at crawl speed consecutive periods share a slot error with opposite signs,
+// so averaging them gains little. The filter is only required to beat the last period at cruising speeds
+static const speed_case_t speed_cases[] = {
+    {"constant 4 ticks/s", 4, 4, 5000000, 0.05, false},
+    {"constant 8 ticks/s", 8, 8, 5000000, 0.05, false},
+    {"constant 15 ticks/s", 15, 15, 5000000, 0.05, true},
+    {"constant 30 ticks/s", 30, 30, 5000000, 0.05, true},
+    {"ramp 5 to 30 ticks/s", 5, 30, 2000000, 0.10, false},
+    {"ramp 30 to 5 ticks/s", 30, 5, 2000000, 0.10, false},
+};
+
+double slot_offsets[2 * ENCODER_TICKS_PER_REVOLUTION]; // Error of the place of every edge of a turn in ticks
+double wheel_angle = 0;                 // Turn of the wheel in ticks
+long wheel_half_ticks = 0;              // Edges the wheel has passed
+
+// Function prototypes
+void step_encoder_wheel(double speed);
+void run_speed_case(const speed_case_t *speed_case);
+void test_stop();
+void benchmark_encoder_speed();
+
+/**
+ * @brief Turn the wheel on by SPEED_STEP_US and replay the edges it passes.
+ *
+ * @param speed Speed of the wheel in ticks per second.
+ */
+void step_encoder_wheel(double speed)
+{
+    shim_advance_us(SPEED_STEP_US);
+    wheel_angle += speed * SPEED_STEP_US * 1e-6;
+
+    // Next edge, off its nominal place by the error of its slot
+    long next = wheel_half_ticks + 1;
+    while (wheel_angle >= next / 2.0 + slot_offsets[next % (2 * ENCODER_TICKS_PER_REVOLUTION)])
+    {
+        wheel_half_ticks = next;
+        gpio_dispatch_callback(ROBOT_ENCODER_LEFT_PIN, (next & 1) ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+        next++;
+    }
+}
+
+/**
+ * @brief Turn the wheel along a profile and compare the speed estimates with the true speed.
+ *
+ * @param speed_case The profile.
+ */
+void run_speed_case(const speed_case_t *speed_case)
+{
+    start_robot_sim(1, 1);
+    gpio_put(ROBOT_LEFT_MOTOR_PIN1, 1);
+    wheel_angle = 0;
+    wheel_half_ticks = 0;
+
+    double filtered_squares = 0;
+    double filtered_max = 0;
+    double raw_squares = 0;
+    double raw_max = 0;
+    int count = 0;
+    uint64_t start = shim_time_us;
+    uint64_t next_control = start + PID_CONTROL_PERIOD_MS * 1000;
+    double top_speed = fmax(speed_case->start_speed, speed_case->end_speed);
+
+    // Settle at the start speed, then follow the ramp
+    while (shim_time_us < start + SPEED_SETTLE_US + speed_case->duration_us)
+    {
+        double ramp = shim_time_us < start + SPEED_SETTLE_US ? 0 : (shim_time_us - start - SPEED_SETTLE_US) / (double)speed_case->duration_us;
+        double speed = speed_case->start_speed + (speed_case->end_speed - speed_case->start_speed) * ramp;
+        step_encoder_wheel(speed);
+
+        if (shim_time_us >= next_control)
+        {
+            next_control += PID_CONTROL_PERIOD_MS * 1000;
+            update_encoder_speeds(time_us_32());
+
+            if (shim_time_us >= start + SPEED_SETTLE_US)
+            {
+                // The old estimate, the last period alone
+                double raw = left_encoder_period > 0 ? 1000000.0 / left_encoder_period : 0;
+                double filtered = q16_to_float(get_wheel_speed(&left_encoder_velocity));
+
+                filtered_squares += (filtered - speed) * (filtered - speed);
+                filtered_max = fmax(filtered_max, fabs(filtered - speed));
+                raw_squares += (raw - speed) * (raw - speed);
+                raw_max = fmax(raw_max, fabs(raw - speed));
+                count++;
+            }
+        }
+    }
+
+    double filtered_rms = sqrt(filtered_squares / count);
+    double raw_rms = sqrt(raw_squares / count);
+    printf("%-24s filtered M/T error RMS %5.2f max %5.2f ticks/s, last period error RMS %5.2f max %5.2f ticks/s\n",
+           speed_case->name, filtered_rms, filtered_max, raw_rms, raw_max);
+
+    CHECK(filtered_rms <= speed_case->max_rms * top_speed);
+    CHECK(!speed_case->beats_last_period || filtered_rms < raw_rms);
+}
+
+/**
+ * @brief Stop the wheel suddenly, the estimate must fall to zero within ENCODER_SPEED_TIMEOUT_US.
+ */
+void test_stop()
+{
+    start_robot_sim(1, 1);
+    gpio_put(ROBOT_LEFT_MOTOR_PIN1, 1);
+    wheel_angle = 0;
+    wheel_half_ticks = 0;
+
+    uint64_t next_control = shim_time_us + PID_CONTROL_PERIOD_MS * 1000;
+    uint64_t stop_time = shim_time_us + 2000000;
+    uint64_t zero_time = 0;
+    double speed_at_stop = 0;
+
+    while (shim_time_us < stop_time + 2 * ENCODER_SPEED_TIMEOUT_US)
+    {
+        step_encoder_wheel(shim_time_us < stop_time ? 15 : 0);
+
+        if (shim_time_us >= next_control)
+        {
+            next_control += PID_CONTROL_PERIOD_MS * 1000;
+            update_encoder_speeds(time_us_32());
+
+            double filtered = q16_to_float(get_wheel_speed(&left_encoder_velocity));
+            if (shim_time_us < stop_time)
+            {
+                speed_at_stop = filtered;
+            }
+            else if (filtered == 0 && zero_time == 0)
+            {
+                zero_time = shim_time_us;
+            }
+        }
+    }
+
+    printf("Stop from 15 ticks/s: read %.2f ticks/s before, zero %.0f ms after\n", speed_at_stop, (zero_time - stop_time) / 1000.0);
+    CHECK(zero_time != 0);
+    CHECK(zero_time - stop_time <= ENCODER_SPEED_TIMEOUT_US + PID_CONTROL_PERIOD_MS * 1000);
+}
+
+/**
+ * @brief Time the speed calculations on the host.
+ */
+void benchmark_encoder_speed()
+{
+    volatile uint32_t period = 12345;   // Volatile so nothing is worked out at compile time
+    volatile double double_speed;
+    volatile uint32_t stored_period;
+    encoder_velocity_t velocity;
+
+    double start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        double_speed = 1000000.0 / period;
+    }
+    double double_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        stored_period = period;
+    }
+    double integer_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    // One tick per step, the slowest path
+    reset_wheel_velocity(&velocity, 0);
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        update_wheel_velocity(&velocity, i + 1, (i + 1) * period, period, (i + 1) * period);
+    }
+    double filter_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+    (void)double_speed;
+    (void)stored_period;
+
+    printf("Host ns per call: double division in interrupt %.2f, integer store in interrupt %.2f, fixed-point M/T step %.2f\n",
+           double_ns, integer_ns, filter_ns);
+    printf("RP2040 cycles: not measured here, set ENCODER_PROFILE_CYCLES to 1 to time them on the robot\n");
+}
+
+int main()
+{
+    // Edges up to SLOT_SPACING_ERROR of a tick off their place
+    for (int i = 0; i < 2 * ENCODER_TICKS_PER_REVOLUTION; i++)
+    {
+        slot_offsets[i] = SLOT_SPACING_ERROR * ((get_test_random() % 2001) / 1000.0 - 1);
+    }
+
+    for (size_t i = 0; i < sizeof(speed_cases) / sizeof(speed_cases[0]); i++)
+    {
+        run_speed_case(&speed_cases[i]);
+    }
+    test_stop();
+    benchmark_encoder_speed();
+
+    return finish_tests("test_encoder_speed");
+}
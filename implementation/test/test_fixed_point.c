@@ -0,0 +1,310 @@
+/**
+ * @file test_fixed_point.c
+ * @brief Host test of the accuracy and the speed of the Q16.16 fixed-point layer against floating point.
+ * @details
+ * 1) Saturation: sums, products and quotients too large for the format, and the division by zero,
+ *    must clamp to Q16_MAX or Q16_MIN instead of wrapping.
+ * 2) Accuracy against double precision: products and quotients of random values, sin and cos over
+ *    several turns, atan2 over the whole int16 range of the magnetometer, square roots and angle wrapping.
+ *    The largest error of each is printed.
+ * 3) A wheel speed PID loop is run in fixed point and in float on the same random errors, and the outputs compared.
+ * 4) The fixed-point and float versions of sin, atan2 and the PID step are timed on the host.
+ *    The host has an FPU, so this says nothing about the Cortex-M0+, where every float operation
+ *    is a library call. The cycles on the RP2040 are not measured here.
+ *
+ * @date November 26, 2023
+ */
+
+#include <math.h>
+#include "test.h"
+#include "motor.h"
+
+#define RANDOM_PAIRS 1000000
+#define BENCHMARK_RUNS 10000000
+#define Q16_STEP (1.0 / 65536.0)
+#define Q16_TO_DOUBLE(x) ((x) / 65536.0)   // q16_to_float() keeps only 24 bits, too few to see a step of a large value
+
+/**
+ * @brief A PID loop in float, as the controller was before the fixed-point layer.
+ */
+typedef struct
+{
+    float kp;               // Proportional gain
+    float ki;               // Integral gain, per second
+    float kd;               // Derivative gain, in seconds
+    float output_min;       // Lowest output
+    float output_max;       // Highest output
+    float integral;         // Integral of the error over time
+    float previous_error;   // Error at the previous step
+    bool started;           // Flag set once previous_error holds a real error
+} float_pid_loop_t;
+
+volatile q16_t fixed_sink;      // Results of the benchmarks, volatile so the loops are not optimised away
+volatile float float_sink;
+
+// Function prototypes
+double get_random_value(double range);
+float update_float_pid_loop(float_pid_loop_t *loop, float error, float feedforward, float dt);
+void test_saturation();
+void test_arithmetic_accuracy();
+void test_trigonometry_accuracy();
+void test_pid_accuracy();
+void benchmark_fixed_point();
+
+/**
+ * @brief Get a random value from get_test_random().
+ *
+ * @param range Largest magnitude.
+ * @return A value from -range to range.
+ */
+double get_random_value(double range)
+{
+    return range * (get_test_random() / 1073741823.5 - 1);
+}
+
+/**
+ * @brief Run one step of a float PID loop, the same steps as update_pid_loop().
+ *
+ * @param loop Pointer to the PID loop.
+ * @param error Setpoint minus measurement.
+ * @param feedforward Output expected for the setpoint.
+ * @param dt Time since the previous step in seconds.
+ * @return The clamped output.
+ */
+float update_float_pid_loop(float_pid_loop_t *loop, float error, float feedforward, float dt)
+{
+    float derivative = loop->started ? (error - loop->previous_error) / dt : 0;
+    loop->previous_error = error;
+    loop->started = true;
+
+    float integral = loop->integral + error * dt;
+    float output = feedforward + loop->kp * error + loop->ki * integral + loop->kd * derivative;
+
+    if (output > loop->output_max)
+    {
+        output = loop->output_max;
+        if (error < 0)
+        {
+            loop->integral = integral;
+        }
+    }
+    else if (output < loop->output_min)
+    {
+        output = loop->output_min;
+        if (error > 0)
+        {
+            loop->integral = integral;
+        }
+    }
+    else
+    {
+        loop->integral = integral;
+    }
+
+    return output;
+}
+
+/**
+ * @brief Check that overflows saturate.
+ */
+void test_saturation()
+{
+    CHECK(q16_add(Q16_MAX, Q16_ONE) == Q16_MAX);
+    CHECK(q16_add(Q16_MIN, -Q16_ONE) == Q16_MIN);
+    CHECK(q16_sub(Q16_MIN, Q16_ONE) == Q16_MIN);
+    CHECK(q16_sub(Q16_MAX, -Q16_ONE) == Q16_MAX);
+    CHECK(q16_mul(Q16(30000), Q16(30000)) == Q16_MAX);
+    CHECK(q16_mul(Q16(30000), Q16(-30000)) == Q16_MIN);
+    CHECK(q16_div(Q16(30000), Q16(0.001)) == Q16_MAX);
+    CHECK(q16_div(Q16(-30000), Q16(0.001)) == Q16_MIN);
+    CHECK(q16_div(Q16(1), 0) == Q16_MAX);
+    CHECK(q16_div(Q16(-1), 0) == Q16_MIN);
+    CHECK(q16_abs(Q16_MIN) == Q16_MAX);
+    CHECK(q16_from_int(40000) == Q16_MAX);
+    CHECK(q16_from_int(-40000) == Q16_MIN);
+    CHECK(q16_from_float(1e9f) == Q16_MAX);
+    CHECK(q16_from_float(-1e9f) == Q16_MIN);
+}
+
+/**
+ * @brief Compare products, quotients, square roots and wrapping with double precision.
+ */
+void test_arithmetic_accuracy()
+{
+    double mul_error = 0;
+    double div_error = 0;
+    double sqrt_error = 0;
+    double wrap_error = 0;
+
+    for (int i = 0; i < RANDOM_PAIRS; i++)
+    {
+        // Operands whose results fit in the format
+        q16_t a = q16_from_float(get_random_value(150));
+        q16_t b = q16_from_float(get_random_value(150));
+        double exact = Q16_TO_DOUBLE(a) * Q16_TO_DOUBLE(b);
+        mul_error = fmax(mul_error, fabs(Q16_TO_DOUBLE(q16_mul(a, b)) - exact));
+
+        if (b != 0 && fabs(Q16_TO_DOUBLE(a) / Q16_TO_DOUBLE(b)) < 30000)
+        {
+            exact = Q16_TO_DOUBLE(a) / Q16_TO_DOUBLE(b);
+            div_error = fmax(div_error, fabs(Q16_TO_DOUBLE(q16_div(a, b)) - exact));
+        }
+
+        q16_t value = q16_from_float(fabs(get_random_value(30000)));
+        sqrt_error = fmax(sqrt_error, fabs(Q16_TO_DOUBLE(q16_sqrt(value)) - sqrt(Q16_TO_DOUBLE(value))));
+
+        // Wrapping is exact, the difference is whole turns
+        q16_t heading = q16_from_float(get_random_value(3000));
+        double wrapped = Q16_TO_DOUBLE(q16_wrap(heading, Q16(180)));
+        double turns = (Q16_TO_DOUBLE(heading) - wrapped) / 360;
+        wrap_error = fmax(wrap_error, fabs(turns - round(turns)) * 360);
+        CHECK(wrapped >= -180 && wrapped < 180);
+    }
+
+    printf("mul max error %.2e, div max error %.2e, sqrt max error %.2e, wrap max error %.2e (step %.2e)\n",
+           mul_error, div_error, sqrt_error, wrap_error, Q16_STEP);
+    CHECK(mul_error <= Q16_STEP / 2 + 1e-12);
+    CHECK(div_error <= Q16_STEP / 2 + 1e-12);
+    CHECK(sqrt_error <= Q16_STEP);
+    CHECK(wrap_error <= 1e-9);
+}
+
+/**
+ * @brief Compare sin, cos and atan2 with double precision.
+ *
+ * @details
+ * Q16_PI is short of pi by 0.4 of a step, so every turn an angle is wrapped by adds almost a step of error
+ * on top of the series. The error is measured within one turn and over three turns either way.
+ */
+void test_trigonometry_accuracy()
+{
+    double sin_error = 0;
+    double cos_error = 0;
+    double turns_error = 0;
+    double atan2_error = 0;
+
+    // Exact Q16.16 angles
+    for (q16_t angle = Q16(-20); angle < Q16(20); angle += 47)
+    {
+        double exact = Q16_TO_DOUBLE(angle);
+        double sin_difference = fabs(Q16_TO_DOUBLE(q16_sin(angle)) - sin(exact));
+        double cos_difference = fabs(Q16_TO_DOUBLE(q16_cos(angle)) - cos(exact));
+
+        if (angle >= -Q16_PI && angle < Q16_PI)
+        {
+            sin_error = fmax(sin_error, sin_difference);
+            cos_error = fmax(cos_error, cos_difference);
+        }
+        turns_error = fmax(turns_error, fmax(sin_difference, cos_difference));
+    }
+
+    // Raw magnetometer values, as get_heading() passes them
+    for (int y = -32768; y < 32768; y += 97)
+    {
+        for (int x = -32768; x < 32768; x += 89)
+        {
+            double fixed = q16_to_float(q16_to_degrees(q16_atan2(q16_from_int(y), q16_from_int(x))));
+            double error = fabs(fixed - atan2(y, x) * 180 / M_PI);
+            atan2_error = fmax(atan2_error, error > 180 ? 360 - error : error);
+        }
+    }
+
+    printf("sin max error %.2e, cos max error %.2e within a turn, %.2e over three turns, atan2 max error %.4f deg\n",
+           sin_error, cos_error, turns_error, atan2_error);
+    CHECK(sin_error <= Q16_STEP);
+    CHECK(cos_error <= 2 * Q16_STEP);
+    CHECK(turns_error <= 4 * Q16_STEP);
+    CHECK(atan2_error <= 0.01);
+}
+
+/**
+ * @brief Run a wheel speed loop in fixed point and in float on the same errors and compare the outputs.
+ */
+void test_pid_accuracy()
+{
+    pid_loop_t fixed_loop = left_speed_pid;
+    float_pid_loop_t float_loop = {150.0f, 400.0f, 0, 0, PID_PWM_MAX, 0, 0, false};
+    double output_error = 0;
+
+    reset_pid_loop(&fixed_loop);
+    for (int i = 0; i < 100000; i++)
+    {
+        // Speed errors of a few ticks a second around a cruising setpoint, with a jittering control period
+        float error = get_random_value(3);
+        float target = 15 + get_random_value(5);
+        float dt = PID_CONTROL_PERIOD_MS / 1000.0f + get_random_value(0.002);
+
+        q16_t fixed = update_pid_loop(&fixed_loop, q16_from_float(error), q16_mul(q16_from_float(target), PID_WHEEL_FEEDFORWARD),
+                                      q16_from_float(dt));
+        float reference = update_float_pid_loop(&float_loop, error, target * 400.0f, dt);
+        output_error = fmax(output_error, fabs(q16_to_float(fixed) - reference));
+    }
+
+    printf("Wheel speed PID: fixed point output within %.3f PWM levels of float over 100000 steps\n", output_error);
+    CHECK(output_error <= 2.0);
+}
+
+/**
+ * @brief Time the fixed-point and float versions on the host.
+ */
+void benchmark_fixed_point()
+{
+    double start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        fixed_sink = q16_sin(i * 37);
+    }
+    double fixed_sin_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        float_sink = sinf(i * 37 / 65536.0f);
+    }
+    double float_sin_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        fixed_sink = q16_atan2(q16_from_int(i & 0xFFFF), q16_from_int(1000 + (i >> 8)));
+    }
+    double fixed_atan2_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        float_sink = atan2f(i & 0xFFFF, 1000 + (i >> 8));
+    }
+    double float_atan2_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    pid_loop_t fixed_loop = left_speed_pid;
+    float_pid_loop_t float_loop = {150.0f, 400.0f, 0, 0, PID_PWM_MAX, 0, 0, false};
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        fixed_sink = update_pid_loop(&fixed_loop, (i & 0x3FFFF) - 0x20000, Q16(6000), PID_CONTROL_PERIOD_S);
+    }
+    double fixed_pid_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    start = get_test_seconds();
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        float_sink = update_float_pid_loop(&float_loop, ((i & 0x3FFFF) - 0x20000) / 65536.0f, 6000.0f, PID_CONTROL_PERIOD_MS / 1000.0f);
+    }
+    double float_pid_ns = (get_test_seconds() - start) * 1e9 / BENCHMARK_RUNS;
+
+    printf("Host ns per call, fixed / float: sin %.1f / %.1f, atan2 %.1f / %.1f, PID step %.1f / %.1f\n",
+           fixed_sin_ns, float_sin_ns, fixed_atan2_ns, float_atan2_ns, fixed_pid_ns, float_pid_ns);
+    printf("RP2040 cycles: not measured here, the host does float in hardware and the Cortex-M0+ does not\n");
+}
+
+int main()
+{
+    test_saturation();
+    test_arithmetic_accuracy();
+    test_trigonometry_accuracy();
+    test_pid_accuracy();
+    benchmark_fixed_point();
+
+    return finish_tests("test_fixed_point");
+}
@@ -0,0 +1,302 @@
+/**
+ * @file test_ir_adc.c
+ * @brief Host test of the ADC thresholding stage that reads barcodes from the analog IR sensor output.
+ * @details
+ * 1) A noisy trace is run through threshold_ir_adc_sample() with and without the hysteresis band,
+ *    and the number of made up edges is printed.
+ * 2) Barcodes are driven over while an analog sensor model fills the DMA ring buffer like the free running ADC:
+ *    the sensor sees the average colour under its spot, between a white and a black level, with Gaussian noise.
+ *    The left and right line channels are interleaved round robin, and the DMA transfer count is counted down
+ *    so get_ir_adc_samples_written() sees the DMA progress. process_ir_adc_samples() runs every
+ *    IR_ADC_PROCESS_INTERVAL_MS like its timer, the encoder edges go through the GPIO interrupt, and
+ *    the main loop decodes the edges (see barcode_scan.h). The read rate and the edges of every case are printed.
+ * 3) The timer is held up for longer than the ring buffer, and the lost samples must be counted.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+
+// Read the barcode from the analog sensor output
+#define BARCODE_USE_ADC 1
+
+#include "motor.h"
+#include "motion_queue.h"
+#include "infrared.h"
+#include "ir_adc.h"
+#include "barcode_scan.h"
+
+#define SCANS_PER_CASE 50
+#define ADC_WHITE_LEVEL 400             // Sample on white paper
+#define ADC_LINE_LEVEL 500              // Samples of both line sensors
+#define ADC_SPOT_CM 0.4                 // Width of the spot the sensor averages over
+#define ADC_MAX_SAMPLE 4095             // Largest 12 bit sample
+
+/**
+ * @brief How the analog sensor sees a barcode.
+ */
+typedef struct
+{
+    const char *name;       // Description printed with the result
+    barcode_scan_t scan;    // How the barcode is printed and driven over
+    uint16_t black_level;   // Sample on a black bar
+    double noise;           // Standard deviation of the noise on every sample
+    double min_rate;        // Lowest acceptable success rate
+} adc_case_t;
+
+static const adc_case_t adc_cases[] = {
+    {"20 cm/s, noise 50", {1.5, 3.0, 20, 20}, 2400, 50, 1.0},
+    {"60 cm/s, noise 50", {1.5, 3.0, 60, 60}, 2400, 50, 1.0},
+    {"accelerate 10 to 60 cm/s, noise 100", {1.5, 3.0, 10, 60}, 2400, 100, 1.0},
+    {"narrow 1 cm at 40 cm/s, noise 100", {1.0, 3.0, 40, 40}, 2400, 100, 1.0},
+    {"40 cm/s, noise 150", {1.5, 3.0, 40, 40}, 2400, 150, 0.95},
+    {"low contrast, 30 cm/s, noise 80", {1.5, 3.0, 30, 30}, 1600, 80, 0.95},
+};
+
+/**
+ * @brief Get a normally distributed random number, from the Box-Muller transform.
+ *
+ * @return A random number with a mean of 0 and a standard deviation of 1.
+ */
+double get_normal_random()
+{
+    double u1 = (get_test_random() + 1.0) / 2147483649.0;
+    double u2 = get_test_random() / 2147483648.0;
+
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/**
+ * @brief Clamp a simulated sample to the range of the ADC.
+ *
+ * @param value The simulated sample.
+ * @return The sample the ADC gives.
+ */
+uint16_t clamp_adc_sample(double value)
+{
+    if (value < 0)
+    {
+        return 0;
+    }
+    if (value > ADC_MAX_SAMPLE)
+    {
+        return ADC_MAX_SAMPLE;
+    }
+    return (uint16_t)value;
+}
+
+/**
+ * @brief Get the fraction of the sensor spot that is on black.
+ *
+ * @param boundaries Positions where the colour changes, the even ones start a bar.
+ * @param count Number of boundaries.
+ * @param position Position of the centre of the spot.
+ * @return The fraction from 0 (all white) to 1 (all black).
+ */
+double get_spot_black_fraction(const double *boundaries, int count, double position)
+{
+    double left = position - ADC_SPOT_CM / 2;
+    double right = position + ADC_SPOT_CM / 2;
+    double black = 0;
+
+    for (int i = 0; i + 1 < count; i += 2)
+    {
+        double start = boundaries[i] > left ? boundaries[i] : left;
+        double stop = boundaries[i + 1] < right ? boundaries[i + 1] : right;
+        if (stop > start)
+        {
+            black += stop - start;
+        }
+    }
+
+    return black / ADC_SPOT_CM;
+}
+
+/**
+ * @brief Let the DMA write one round robin of samples, as the free running ADC would.
+ *
+ * @param barcode_sample Sample of the barcode sensor.
+ */
+void write_adc_samples(uint16_t barcode_sample)
+{
+    dma_channel_hw_t *dma = dma_channel_hw_addr(ir_adc_dma_channel);
+    uint16_t samples[IR_ADC_CHANNEL_COUNT];
+
+    samples[IR_ADC_CHANNEL] = barcode_sample;
+    samples[IR_ADC_LEFT_LINE_CHANNEL] = ADC_LINE_LEVEL;
+    samples[IR_ADC_RIGHT_LINE_CHANNEL] = ADC_LINE_LEVEL;
+    for (int i = 0; i < IR_ADC_CHANNEL_COUNT; i++)
+    {
+        ir_adc_buffer[get_ir_adc_samples_written() & IR_ADC_BUFFER_MASK] = samples[i];
+        dma->transfer_count--;
+    }
+}
+
+/**
+ * @brief Drive over a barcode while the ADC samples it, with the timer and the main loop running.
+ *
+ * @param message Characters between the '*' delimiters.
+ * @param test_case How the sensor sees the barcode.
+ * @param pass How the barcode is printed and driven over.
+ */
+void run_adc_scan(const char *message, const adc_case_t *test_case, const barcode_scan_t *pass)
+{
+    double boundaries[SCAN_MAX_BOUNDARIES];
+    double length;
+    int boundary_count = layout_barcode(message, pass, boundaries, &length);
+
+    double half_tick = ENCODER_DISTANCE_PER_TICK_CM / 2;
+    double wheel_offsets[2] = {get_scan_random(0, 2 * half_tick), get_scan_random(0, 2 * half_tick)};
+    int wheel_halves[2] = {0, 0};
+    uint8_t wheel_pins[2] = {SCAN_ENCODER_LEFT_PIN, SCAN_ENCODER_RIGHT_PIN};
+
+    uint64_t next_process = shim_time_us + IR_ADC_PROCESS_INTERVAL_MS * 1000;
+    uint64_t end = 0;
+    double position = 0;
+
+    while (end == 0 || shim_time_us < end)
+    {
+        // Samples are taken every IR_ADC_SAMPLE_PERIOD_US from the start of the DMA run, the time never runs on without them
+        uint32_t sample_time = ir_adc_start_time + (get_ir_adc_samples_written() / IR_ADC_CHANNEL_COUNT) * IR_ADC_SAMPLE_PERIOD_US;
+        shim_time_us += (int32_t)(sample_time - (uint32_t)shim_time_us);
+
+        // Speed ramps along the barcode
+        double speed = pass->start_speed + (pass->end_speed - pass->start_speed) * position / length;
+        if (position < length)
+        {
+            position += speed * IR_ADC_SAMPLE_PERIOD_US * 1e-6;
+        }
+        else if (end == 0)
+        {
+            end = shim_time_us + SCAN_SETTLE_US;
+        }
+
+        // Encoder edges of both wheels while moving
+        for (int w = 0; w < 2 && position < length; w++)
+        {
+            while (position + wheel_offsets[w] >= (wheel_halves[w] + 1) * half_tick)
+            {
+                wheel_halves[w]++;
+                gpio_dispatch_callback(wheel_pins[w], (wheel_halves[w] % 2) == 1 ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+            }
+        }
+
+        double black = get_spot_black_fraction(boundaries, boundary_count, position);
+        double level = ADC_WHITE_LEVEL + (test_case->black_level - ADC_WHITE_LEVEL) * black;
+        write_adc_samples(clamp_adc_sample(level + test_case->noise * get_normal_random()));
+
+        // The timer and the main loop
+        if (shim_time_us >= next_process)
+        {
+            process_ir_adc_samples(&ir_adc_timer);
+            next_process += IR_ADC_PROCESS_INTERVAL_MS * 1000;
+        }
+        run_scan_main_loop(shim_time_us);
+    }
+}
+
+/**
+ * @brief Count the edges the hysteresis threshold makes from a slow ramp with noise.
+ *
+ * @param noise Standard deviation of the noise.
+ * @return The number of colour changes, 2 without noise.
+ */
+int count_ramp_edges(double noise)
+{
+    bool is_black = false;
+    int edges = 0;
+
+    // White to black and back, 2000 samples per slope
+    for (int i = 0; i < 4000; i++)
+    {
+        double ramp = i < 2000 ? i / 2000.0 : (4000 - i) / 2000.0;
+        double level = ADC_WHITE_LEVEL + (2400 - ADC_WHITE_LEVEL) * ramp;
+        if (threshold_ir_adc_sample(clamp_adc_sample(level + noise * get_normal_random()), &is_black))
+        {
+            edges++;
+        }
+    }
+
+    return edges;
+}
+
+int main()
+{
+    start_barcode_scans();
+    initialise_ir_adc();
+
+    // Hysteresis against a single threshold on a slow ramp
+    for (int noise = 50; noise <= 100; noise += 50)
+    {
+        int hysteresis_edges = count_ramp_edges(noise);
+        ir_adc_threshold_high = (IR_ADC_THRESHOLD_HIGH + IR_ADC_THRESHOLD_LOW) / 2;
+        ir_adc_threshold_low = ir_adc_threshold_high;
+        int single_edges = count_ramp_edges(noise);
+        ir_adc_threshold_high = IR_ADC_THRESHOLD_HIGH;
+        ir_adc_threshold_low = IR_ADC_THRESHOLD_LOW;
+        printf("slow ramp with noise %d: %d edges with hysteresis, %d with a single threshold\n", noise, hysteresis_edges,
+               single_edges);
+        CHECK(hysteresis_edges < single_edges);
+        CHECK(noise > 50 || hysteresis_edges == 2);
+    }
+
+    // Barcodes through the DMA ring, the thresholding and the decoder
+    for (int c = 0; c < sizeof(adc_cases) / sizeof(adc_cases[0]); c++)
+    {
+        const adc_case_t *test_case = &adc_cases[c];
+        int read = 0;
+        int misread = 0;
+        int boundaries = 0;
+        uint32_t edges_before = barcode_edge_head;
+        uint32_t overruns_before = ir_adc_overruns;
+
+        for (int s = 0; s < SCANS_PER_CASE; s++)
+        {
+            char message[BARCODE_MESSAGE_SIZE + 1];
+            char result[BARCODE_MESSAGE_SIZE + 1];
+            double positions[SCAN_MAX_BOUNDARIES];
+            double length;
+            barcode_scan_t pass = test_case->scan;
+
+            make_scan_message(message);
+            pass.reverse = (s % 2) == 1;
+            boundaries += layout_barcode(message, &pass, positions, &length);
+            reset_barcode_scan();
+            run_adc_scan(message, test_case, &pass);
+
+            if (get_scan_result(result) != SCAN_MISSED)
+            {
+                if (strcmp(result, message) == 0)
+                {
+                    read++;
+                }
+                else
+                {
+                    misread++;
+                }
+            }
+        }
+
+        double rate = (double)read / SCANS_PER_CASE;
+        printf("%-38s read %3d%%, misread %d, edges %lu for %d boundaries\n", test_case->name, (int)(rate * 100 + 0.5),
+               misread, (unsigned long)(barcode_edge_head - edges_before), boundaries);
+        CHECK(rate >= test_case->min_rate);
+        CHECK(misread == 0);
+        CHECK(ir_adc_overruns == overruns_before);
+    }
+
+    // Hold the timer up for longer than the ring buffer, the oldest samples are lost and counted
+    process_ir_adc_samples(&ir_adc_timer);
+    uint32_t overruns_before = ir_adc_overruns;
+    for (int i = 0; i < IR_ADC_BUFFER_SIZE / IR_ADC_CHANNEL_COUNT + 100; i++)
+    {
+        write_adc_samples(ADC_WHITE_LEVEL);
+    }
+    process_ir_adc_samples(&ir_adc_timer);
+    printf("timer held up for %d samples: %lu lost\n", (IR_ADC_BUFFER_SIZE / IR_ADC_CHANNEL_COUNT + 100) * IR_ADC_CHANNEL_COUNT,
+           (unsigned long)(ir_adc_overruns - overruns_before));
+    CHECK(ir_adc_overruns - overruns_before == (IR_ADC_BUFFER_SIZE / IR_ADC_CHANNEL_COUNT + 100) * IR_ADC_CHANNEL_COUNT - IR_ADC_BUFFER_SIZE);
+    CHECK(ir_adc_left_line_value == ADC_LINE_LEVEL && ir_adc_right_line_value == ADC_LINE_LEVEL);
+
+    return finish_tests("test_ir_adc");
+}
@@ -0,0 +1,315 @@
+/**
+ * @file test_line_follow.c
+ * @brief Host simulation of line following on a curved track.
+ * @details
+ * The robot of robot_sim.h follows a track of black tape with straights, S-curves and a U-turn:
+ * 1) The track is a dense polyline. Each line sensor sits ahead of the wheels on either side of the tape
+ *    and sees the share of its spot that is over the tape, between the white and black ADC levels, with
+ *    Gaussian noise. Before every control step, the values are written to ir_adc_left_line_value and
+ *    ir_adc_right_line_value as process_ir_adc_samples() would average them when LINE_USE_ADC is set.
+ *    Otherwise, the default, they go through the comparator of the sensor board at the middle of the levels
+ *    to is_left_line_black and is_right_line_black, as the digital outputs would be debounced.
+ *    The test is built both ways, see CMakeLists.txt.
+ * 2) Every PID_CONTROL_PERIOD_MS the encoder speeds are updated and line_follow_control() runs, like
+ *    the control tick of main.c while the robot follows the line.
+ * 3) The distance of the point between the sensors from the tape is the tracking error. The average speed
+ *    and the RMS and largest errors of every case are printed, and the robot must reach the end of the
+ *    track without losing the tape.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "motion_queue.h"
+#include "infrared.h"
+#include "ir_adc.h"
+#include "line_follow.h"
+#include "robot_sim.h"
+
+#define TRACK_MAX_POINTS 4000
+#define TRACK_STEP_CM 0.5               // Distance between the points of the track
+#define TRACK_TAPE_CM 1.8               // Width of the tape
+#define LINE_SENSOR_AHEAD_CM 8.0        // Distance of the line sensors ahead of the wheels
+#define LINE_SENSOR_SIDE_CM 1.5         // Distance of each line sensor from the middle of the robot
+#define LINE_SENSOR_SPOT_CM 0.8         // Width of the spot a line sensor averages over
+#define LINE_SENSOR_NOISE 40            // Standard deviation of the noise on a line sensor value
+#define LINE_LOST_CM 5.0                // The tape is lost once it is this far from the sensors
+#define TRACK_TIMEOUT_US 120000000      // Longest time a case may take
+#define LINE_COMPARATOR_LEVEL ((LINE_ADC_WHITE + LINE_ADC_BLACK) / 2) // Digital output is high above this ADC value
+
+/**
+ * @brief A track and how the robot drives it.
+ */
+typedef struct
+{
+    const char *name;       // Description printed with the result
+    double radius;          // Radius of the curves in cm
+    double left_gain;       // Gain of the left wheel, see robot_wheel_t
+    double right_gain;      // Gain of the right wheel
+    double max_rms_cm;      // Largest acceptable RMS error with the analog outputs
+    double max_digital_rms_cm; // Largest acceptable RMS error with the digital outputs
+} line_case_t;
+
+// The digital outputs only tell the robot which sensor is on the tape, so it weaves more between them
+static const line_case_t line_cases[] = {
+    {"wide curves", 100, 1.0, 1.0, 0.6, 1.0},
+    {"medium curves", 50, 1.0, 1.0, 0.6, 1.0},
+    {"tight curves", 30, 1.0, 1.0, 0.8, 1.1},
+    {"medium curves, weak left wheel", 50, 0.85, 1.0, 0.6, 1.0},
+    {"medium curves, weak right wheel", 50, 1.0, 0.85, 0.6, 1.0},
+};
+
+double track_x[TRACK_MAX_POINTS];   // Points of the track
+double track_y[TRACK_MAX_POINTS];
+int track_points = 0;               // Number of points of the track
+double track_heading = 0;           // Heading at the end of the track so far
+int track_index = 0;                // Point of the track the sensors were last nearest to
+
+double line_error_sum = 0;          // Sum of the squared errors
+double line_error_max = 0;          // Largest error
+int line_error_count = 0;           // Number of errors summed
+bool line_lost = false;             // Flag set once the tape is lost
+
+// Function prototypes
+void add_track_straight(double length);
+void add_track_arc(double radius, double angle);
+void make_track(double radius);
+double get_track_distance(double x, double y, int from, int to, int *nearest);
+uint16_t get_line_sensor_value(double x, double y);
+double get_gaussian_noise(double deviation);
+bool line_control_step();
+void run_line_case(const line_case_t *line_case);
+
+/**
+ * @brief Stand in for the TCP server of wifi.h, the events of the barcode decoder are not used here.
+ *
+ * @param event The event.
+ * @return true, as if it was sent.
+ */
+bool send_tcp_event(const char *event)
+{
+    return true;
+}
+
+/**
+ * @brief Stand in for the handler of main.c, no movements are queued here.
+ *
+ * @param command The command that ended.
+ * @param completed Whether it finished.
+ */
+void handle_motion_complete(const motion_command_t *command, bool completed)
+{
+}
+
+/**
+ * @brief Add a straight to the end of the track.
+ *
+ * @param length Length of the straight in cm.
+ */
+void add_track_straight(double length)
+{
+    for (double s = TRACK_STEP_CM; s <= length && track_points < TRACK_MAX_POINTS; s += TRACK_STEP_CM)
+    {
+        track_x[track_points] = track_x[track_points - 1] + TRACK_STEP_CM * cos(track_heading);
+        track_y[track_points] = track_y[track_points - 1] + TRACK_STEP_CM * sin(track_heading);
+        track_points++;
+    }
+}
+
+/**
+ * @brief Add a curve to the end of the track.
+ *
+ * @param radius Radius of the curve in cm.
+ * @param angle Angle of the curve in radians, positive to the left.
+ */
+void add_track_arc(double radius, double angle)
+{
+    double turn = (angle > 0 ? 1 : -1) * TRACK_STEP_CM / radius;
+
+    for (double s = TRACK_STEP_CM; s <= radius * fabs(angle) && track_points < TRACK_MAX_POINTS; s += TRACK_STEP_CM)
+    {
+        track_heading += turn / 2;
+        track_x[track_points] = track_x[track_points - 1] + TRACK_STEP_CM * cos(track_heading);
+        track_y[track_points] = track_y[track_points - 1] + TRACK_STEP_CM * sin(track_heading);
+        track_heading += turn / 2;
+        track_points++;
+    }
+}
+
+/**
+ * @brief Lay out the track: a straight, an S-curve, a U-turn and a straight, starting under the sensors.
+ *
+ * @param radius Radius of the curves in cm.
+ */
+void make_track(double radius)
+{
+    track_x[0] = LINE_SENSOR_AHEAD_CM - 10;
+    track_y[0] = 0;
+    track_points = 1;
+    track_heading = 0;
+    track_index = 0;
+
+    add_track_straight(40);
+    add_track_arc(radius, M_PI / 2);
+    add_track_arc(radius, -M_PI / 2);
+    add_track_straight(20);
+    add_track_arc(radius, -M_PI);
+    add_track_straight(60);
+}
+
+/**
+ * @brief Get the distance of a point from part of the track.
+ *
+ * @param x Point along the starting heading in cm.
+ * @param y Point to the left of the starting heading in cm.
+ * @param from First point of the part.
+ * @param to Last point of the part.
+ * @param nearest Set to the point of the part nearest to the point.
+ * @return The distance in cm.
+ */
+double get_track_distance(double x, double y, int from, int to, int *nearest)
+{
+    double best = 1e9;
+
+    from = from < 0 ? 0 : from;
+    to = to > track_points - 1 ? track_points - 1 : to;
+    for (int i = from; i < to; i++)
+    {
+        // Distance from the segment to the next point
+        double dx = track_x[i + 1] - track_x[i];
+        double dy = track_y[i + 1] - track_y[i];
+        double t = ((x - track_x[i]) * dx + (y - track_y[i]) * dy) / (dx * dx + dy * dy);
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        double distance = hypot(x - track_x[i] - t * dx, y - track_y[i] - t * dy);
+        if (distance < best)
+        {
+            best = distance;
+            *nearest = i;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Get the ADC value of a line sensor from the share of its spot over the tape.
+ *
+ * @param x Position of the sensor along the starting heading in cm.
+ * @param y Position of the sensor to the left of the starting heading in cm.
+ * @return The ADC value with noise.
+ */
+uint16_t get_line_sensor_value(double x, double y)
+{
+    int nearest;
+    double distance = get_track_distance(x, y, track_index - 40, track_index + 40, &nearest);
+
+    // Overlap of the spot with the tape
+    double low = fmax(distance - LINE_SENSOR_SPOT_CM / 2, -TRACK_TAPE_CM / 2);
+    double high = fmin(distance + LINE_SENSOR_SPOT_CM / 2, TRACK_TAPE_CM / 2);
+    double black = fmax(0, high - low) / LINE_SENSOR_SPOT_CM;
+
+    double value = LINE_ADC_WHITE + (LINE_ADC_BLACK - LINE_ADC_WHITE) * black + get_gaussian_noise(LINE_SENSOR_NOISE);
+    return value < 0 ? 0 : (value > 4095 ? 4095 : (uint16_t)value);
+}
+
+/**
+ * @brief Get Gaussian noise with the Box-Muller transform.
+ *
+ * @param deviation Standard deviation of the noise.
+ * @return The noise.
+ */
+double get_gaussian_noise(double deviation)
+{
+    double u1 = (get_test_random() + 1.0) / 2147483649.0;
+    double u2 = get_test_random() / 2147483648.0;
+
+    return deviation * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/**
+ * @brief Read the line sensors, run the control tick of main.c and measure the tracking error.
+ *
+ * @return false once the robot reaches the end of the track or loses the tape.
+ */
+bool line_control_step()
+{
+    // Sensors ahead of the wheels, the left one on the left of the robot
+    double ahead_x = robot_x + LINE_SENSOR_AHEAD_CM * cos(robot_theta);
+    double ahead_y = robot_y + LINE_SENSOR_AHEAD_CM * sin(robot_theta);
+    double side_x = -LINE_SENSOR_SIDE_CM * sin(robot_theta);
+    double side_y = LINE_SENSOR_SIDE_CM * cos(robot_theta);
+
+    uint16_t left_value = get_line_sensor_value(ahead_x + side_x, ahead_y + side_y);
+    uint16_t right_value = get_line_sensor_value(ahead_x - side_x, ahead_y - side_y);
+#if LINE_USE_ADC
+    ir_adc_left_line_value = left_value;
+    ir_adc_right_line_value = right_value;
+#else
+    is_left_line_black = left_value > LINE_COMPARATOR_LEVEL;
+    is_right_line_black = right_value > LINE_COMPARATOR_LEVEL;
+#endif
+
+    uint32_t now = time_us_32();
+    update_encoder_speeds(now);
+    line_follow_control(now);
+
+    // Error of the point between the sensors, searched near the last point so the U-turn is not cut short
+    double error = get_track_distance(ahead_x, ahead_y, track_index - 40, track_index + 40, &track_index);
+    line_error_sum += error * error;
+    line_error_max = fmax(line_error_max, error);
+    line_error_count++;
+    if (error > LINE_LOST_CM)
+    {
+        line_lost = true;
+        return false;
+    }
+
+    return track_index < track_points - 2;
+}
+
+/**
+ * @brief Follow the track of a case and print the result.
+ *
+ * @param line_case The case.
+ */
+void run_line_case(const line_case_t *line_case)
+{
+    make_track(line_case->radius);
+    start_robot_sim(line_case->left_gain, line_case->right_gain);
+    ir_adc_left_line_value = LINE_ADC_WHITE;
+    ir_adc_right_line_value = LINE_ADC_WHITE;
+    is_left_line_black = false;
+    is_right_line_black = false;
+    line_error_sum = 0;
+    line_error_max = 0;
+    line_error_count = 0;
+    line_lost = false;
+
+    uint64_t start_time = shim_time_us;
+    start_line_following();
+    run_robot_sim(TRACK_TIMEOUT_US, line_control_step);
+    stop_line_following();
+
+    double seconds = (shim_time_us - start_time) / 1e6;
+    double length = (track_points - 1) * TRACK_STEP_CM;
+    double rms = sqrt(line_error_sum / (line_error_count > 0 ? line_error_count : 1));
+    bool finished = !line_lost && track_index >= track_points - 2;
+
+    printf("%-32s %5.1f cm track in %5.1f s, %5.1f cm/s, error RMS %.2f cm max %.2f cm%s\n",
+           line_case->name, length, seconds, length / seconds, rms, line_error_max,
+           line_lost ? ", tape lost" : (finished ? "" : ", not finished"));
+
+    CHECK(finished);
+    CHECK(rms <= (LINE_USE_ADC ? line_case->max_rms_cm : line_case->max_digital_rms_cm));
+}
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(line_cases) / sizeof(line_cases[0]); i++)
+    {
+        run_line_case(&line_cases[i]);
+    }
+
+    return finish_tests(LINE_USE_ADC ? "test_line_follow_adc" : "test_line_follow");
+}
@@ -0,0 +1,258 @@
+/**
+ * @file test_motion_stop.c
+ * @brief Host simulation of the final errors of move_distance() and rotate_by().
+ * @details
+ * Each trial drives the robot of robot_sim.h a distance or turns it by an angle, and measures where it comes to rest:
+ * 1) The wheels of every trial get a random gain of PLANT_GAIN_MIN to PLANT_GAIN_MAX, and the robot a random
+ *    coasting time constant of COAST_MIN_S to COAST_MAX_S, around the PID_COAST_TIME_S the stop is planned with.
+ * 2) With the predictive stop, the movement is started with move_distance() or rotate_by() and the control tick
+ *    of main.c runs every PID_CONTROL_PERIOD_MS, so pid_control() cuts the power before the target.
+ * 3) With the old stop at the count, the robot drives with move_forward() or turn_left()/turn_right() and the power
+ *    is cut as soon as the average encoder count of the two wheels reaches the target, as the encoder interrupt
+ *    used to do.
+ * The error is the true distance of the centre of the robot, or the true turn, once both wheels have stopped,
+ * minus the target. The mean, standard deviation and largest error of every move are printed for both.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "robot_sim.h"
+
+#define TRIALS_PER_MOVE 40
+#define PLANT_GAIN_MIN 0.8
+#define PLANT_GAIN_MAX 1.05
+#define COAST_MIN_S 0.07
+#define COAST_MAX_S 0.13
+#define MOVE_TIMEOUT_US 30000000        // Longest time a move may take
+
+/**
+ * @brief A move and the errors allowed with the predictive stop.
+ */
+typedef struct
+{
+    const char *name;       // Description printed with the result
+    bool rotate;            // true to turn by amount degrees, false to drive amount cm
+    float amount;           // Distance in cm, negative backward, or angle in degrees, clockwise
+    double max_mean;        // Largest acceptable mean of the absolute errors
+    double max_error;       // Largest acceptable error of any trial
+} stop_case_t;
+
+/**
+ * @brief Statistics of the errors of the trials of a move.
+ */
+typedef struct
+{
+    double sum;             // Sum of the errors
+    double sum_squares;     // Sum of the squared errors
+    double sum_absolute;    // Sum of the absolute errors
+    double max_absolute;    // Largest absolute error
+    int count;              // Number of trials
+} stop_stats_t;
+
+static const stop_case_t stop_cases[] = {
+    {"distance 10 cm", false, 10, 0.4, 1.0},
+    {"distance 30 cm", false, 30, 0.4, 1.0},
+    {"distance 100 cm", false, 100, 0.4, 1.0},
+    {"distance -30 cm", false, -30, 0.4, 1.0},
+    {"rotate 30 deg", true, 30, 2.0, 4.0},
+    {"rotate 90 deg", true, 90, 2.0, 4.0},
+    {"rotate -90 deg", true, -90, 2.0, 4.0},
+    {"rotate 180 deg", true, 180, 2.0, 4.0},
+};
+
+// Function prototypes
+double get_random_between(double low, double high);
+double get_travelled(bool rotate, double left_start, double right_start);
+double run_stop_trial(const stop_case_t *stop_case, bool predictive, double left_gain, double right_gain);
+void add_stop_error(stop_stats_t *stats, double error);
+double get_stop_mean_absolute(const stop_stats_t *stats);
+void print_stop_stats(const char *name, const char *unit, const stop_stats_t *stats);
+
+/**
+ * @brief Get a random number from get_test_random().
+ *
+ * @param low Smallest number.
+ * @param high Largest number.
+ * @return A number from low to high.
+ */
+double get_random_between(double low, double high)
+{
+    return low + (high - low) * get_test_random() / 2147483647.0;
+}
+
+/**
+ * @brief Get how far the robot has truly moved since the start of a trial.
+ *
+ * @param rotate true for the turn in degrees clockwise, false for the distance of the centre in cm.
+ * @param left_start Turn of the left wheel at the start in ticks.
+ * @param right_start Turn of the right wheel at the start in ticks.
+ * @return The distance or the turn.
+ */
+double get_travelled(bool rotate, double left_start, double right_start)
+{
+    if (rotate)
+    {
+        // start_robot_sim() starts the robot on a heading of 0
+        return -robot_theta * 180 / M_PI;
+    }
+
+    return ((robot_left_wheel.angle - left_start) + (robot_right_wheel.angle - right_start)) / 2 * ENCODER_DISTANCE_PER_TICK_CM;
+}
+
+/**
+ * @brief Run one trial of a move and measure its error once the robot has stopped.
+ *
+ * @param stop_case The move.
+ * @param predictive true to stop with pid_control(), false to stop at the encoder count.
+ * @param left_gain Gain of the left wheel.
+ * @param right_gain Gain of the right wheel.
+ * @return The true distance or turn minus the target.
+ */
+double run_stop_trial(const stop_case_t *stop_case, bool predictive, double left_gain, double right_gain)
+{
+    start_robot_sim(left_gain, right_gain);
+
+    double left_start = robot_left_wheel.angle;
+    double right_start = robot_right_wheel.angle;
+    float magnitude = fabsf(stop_case->amount);
+    int target_count;
+
+    if (predictive)
+    {
+        if (stop_case->rotate)
+        {
+            rotate_by(SPEED, stop_case->amount);
+        }
+        else
+        {
+            move_distance(SPEED, stop_case->amount);
+        }
+    }
+    else
+    {
+        if (stop_case->rotate)
+        {
+            if (stop_case->amount < 0)
+            {
+                turn_left(SPEED, magnitude);
+            }
+            else
+            {
+                turn_right(SPEED, magnitude);
+            }
+            target_count = (int)lroundf(magnitude / ENCODER_DEGREES_PER_TICK);
+        }
+        else
+        {
+            if (stop_case->amount < 0)
+            {
+                move_backward(SPEED);
+            }
+            else
+            {
+                move_forward(SPEED);
+            }
+            target_count = (int)lroundf(magnitude / ENCODER_DISTANCE_PER_TICK_CM);
+        }
+    }
+
+    uint64_t end = shim_time_us + MOVE_TIMEOUT_US;
+    uint64_t next_control = shim_time_us + PID_CONTROL_PERIOD_MS * 1000;
+    while (shim_time_us < end && (movement_direction != 'x' || !is_robot_still()))
+    {
+        step_robot_sim();
+
+        // The old interrupt cut the power on the tick that reached the count
+        if (!predictive && movement_direction != 'x' && (left_encoder_count + right_encoder_count) / 2 >= target_count)
+        {
+            stop_motors();
+        }
+
+        // Control tick of main.c
+        if (shim_time_us >= next_control)
+        {
+            next_control += PID_CONTROL_PERIOD_MS * 1000;
+            update_encoder_speeds(time_us_32());
+            pid_control();
+        }
+    }
+    CHECK(movement_direction == 'x' && is_robot_still());
+
+    return get_travelled(stop_case->rotate, left_start, right_start) - stop_case->amount;
+}
+
+/**
+ * @brief Add the error of a trial to the statistics.
+ *
+ * @param stats The statistics.
+ * @param error The error.
+ */
+void add_stop_error(stop_stats_t *stats, double error)
+{
+    stats->sum += error;
+    stats->sum_squares += error * error;
+    stats->sum_absolute += fabs(error);
+    stats->max_absolute = fmax(stats->max_absolute, fabs(error));
+    stats->count++;
+}
+
+/**
+ * @brief Get the mean of the absolute errors.
+ *
+ * @param stats The statistics.
+ * @return The mean absolute error.
+ */
+double get_stop_mean_absolute(const stop_stats_t *stats)
+{
+    return stats->sum_absolute / stats->count;
+}
+
+/**
+ * @brief Print the statistics of the errors.
+ *
+ * @param name Name of the stop.
+ * @param unit Unit of the errors.
+ * @param stats The statistics.
+ */
+void print_stop_stats(const char *name, const char *unit, const stop_stats_t *stats)
+{
+    double mean = stats->sum / stats->count;
+    double deviation = sqrt(fmax(0, stats->sum_squares / stats->count - mean * mean));
+
+    printf("  %-16s mean %+6.2f %s, deviation %5.2f %s, mean absolute %5.2f %s, largest %5.2f %s\n", name,
+           mean, unit, deviation, unit, get_stop_mean_absolute(stats), unit, stats->max_absolute, unit);
+}
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(stop_cases) / sizeof(stop_cases[0]); i++)
+    {
+        const stop_case_t *stop_case = &stop_cases[i];
+        stop_stats_t predictive = {0};
+        stop_stats_t at_count = {0};
+
+        for (int trial = 0; trial < TRIALS_PER_MOVE; trial++)
+        {
+            // The same plant for both stops
+            double left_gain = get_random_between(PLANT_GAIN_MIN, PLANT_GAIN_MAX);
+            double right_gain = get_random_between(PLANT_GAIN_MIN, PLANT_GAIN_MAX);
+            robot_coast_s = get_random_between(COAST_MIN_S, COAST_MAX_S);
+
+            add_stop_error(&predictive, run_stop_trial(stop_case, true, left_gain, right_gain));
+            add_stop_error(&at_count, run_stop_trial(stop_case, false, left_gain, right_gain));
+        }
+
+        const char *unit = stop_case->rotate ? "deg" : "cm";
+        printf("%s, %d trials:\n", stop_case->name, TRIALS_PER_MOVE);
+        print_stop_stats("predictive stop", unit, &predictive);
+        print_stop_stats("stop at count", unit, &at_count);
+
+        CHECK(get_stop_mean_absolute(&predictive) <= stop_case->max_mean);
+        CHECK(predictive.max_absolute <= stop_case->max_error);
+        CHECK(get_stop_mean_absolute(&predictive) < get_stop_mean_absolute(&at_count));
+    }
+
+    return finish_tests("test_motion_stop");
+}
@@ -0,0 +1,340 @@
+/**
+ * @file test_odometry.c
+ * @brief Host test of the differential drive odometry on arcs and squares.
+ * @details
+ * 1) Wheel distances of known arcs and squares are fed straight into integrate_odometry(), in steps as small
+ *    as one control period and as large as a tenth of a turn, and the pose must end where the geometry says.
+ *    This measures the Q16.16 integration on its own.
+ *    Every update rounds the turn to a step of Q16.16, and the same step repeated for a whole circle adds up
+ *    to a few thousandths of a radian, so the tolerances are relative to the distance travelled.
+ * 2) The robot of robot_sim.h drives squares (move_distance() and rotate_by()) and circles of arcs (move_arc())
+ *    through the motion queue, with the control tick of main.c and update_odometry() every ODOMETRY_PERIOD_MS.
+ *    The odometry is compared with the true pose all along and at the end, with matched and mismatched wheels.
+ *    The difference is the encoder resolution, not the integration: the pose only moves on whole ticks, and
+ *    a single channel encoder counts a wheel that reverses up to a tick late. A tick of one wheel turns the pose
+ *    by ENCODER_DISTANCE_PER_TICK_CM over the wheel base, about 4.5 degrees, so the tolerances are a few of those.
+ * 3) The measured wheel base is checked against the turn calibration: the share of the geometric turn that
+ *    ENCODER_DEGREES_PER_TICK says a pivot makes must be at least ENCODER_PIVOT_TURN_RATIO_MIN and at most 1,
+ *    as scrubbing tyres can only lose turn.
+ *
+ * @date November 26, 2023
+ */
+
+#include <string.h>
+#include "motor.h"
+#include "motion_queue.h"
+#include "odometry.h"
+#include "robot_sim.h"
+
+#define GEOMETRY_POSITION_TOLERANCE 0.001 // Largest position error of the integration over the distance travelled
+#define GEOMETRY_HEADING_TOLERANCE_RAD 0.01 // Largest heading error of the integration, about half a degree
+#define DRIVE_POSITION_TOLERANCE_CM 10.0 // Largest position error of a drive, the heading a tick or two off along a side
+#define DRIVE_HEADING_TOLERANCE_DEG (2 * ENCODER_PIVOT_GEOMETRY_DEGREES_PER_TICK) // Largest heading error of a drive, two ticks of each wheel
+#define DRIVE_TIMEOUT_US 60000000       // Longest time a drive may take
+#define DRIVE_SIDE_CM 40                // Side of the squares driven
+#define DRIVE_RADIUS_CM 40              // Radius of the arcs driven
+
+/**
+ * @brief A drive through the motion queue.
+ */
+typedef struct
+{
+    const char *name;           // Description printed with the result
+    bool square;                // true for a square of distances and pivots, false for a circle of arcs
+    float angle;                // Angle of every pivot or arc in degrees, clockwise
+    double left_gain;           // Gain of the left wheel, see robot_wheel_t
+    double right_gain;          // Gain of the right wheel
+} drive_case_t;
+
+static const drive_case_t drive_cases[] = {
+    {"square anticlockwise", true, -90, 1.0, 1.0},
+    {"square clockwise", true, 90, 1.0, 1.0},
+    {"square, weak left wheel", true, -90, 0.85, 1.0},
+    {"arcs anticlockwise", false, -90, 1.0, 1.0},
+    {"arcs clockwise", false, 90, 1.0, 1.0},
+    {"arcs, weak right wheel", false, 90, 1.0, 0.85},
+};
+
+double drive_position_error_max = 0;    // Largest distance between the odometry and the true position
+double drive_heading_error_max = 0;     // Largest difference between the odometry and the true heading
+
+// Function prototypes
+double get_pose_heading_error(const odometry_pose_t *pose, double theta);
+void check_geometry(const char *name, const odometry_pose_t *pose, double x, double y, double theta);
+void drive_geometry_arc(odometry_pose_t *pose, double radius, double angle, double step);
+void drive_geometry_pivot(odometry_pose_t *pose, double angle);
+void drive_geometry_straight(odometry_pose_t *pose, double distance, double step);
+void test_geometry();
+void compare_odometry();
+bool drive_control_step();
+void run_drive_case(const drive_case_t *drive_case);
+void test_turn_calibration();
+
+/**
+ * @brief Stand in for the handler of main.c, the test waits for the queue to empty instead.
+ *
+ * @param command The command that ended.
+ * @param completed Whether it finished.
+ */
+void handle_motion_complete(const motion_command_t *command, bool completed)
+{
+}
+
+/**
+ * @brief Get the difference between the heading of a pose and a heading, the shortest way round.
+ *
+ * @param pose The pose.
+ * @param theta The heading in radians.
+ * @return The difference in radians, 0 to pi.
+ */
+double get_pose_heading_error(const odometry_pose_t *pose, double theta)
+{
+    double error = fmod(q16_to_float(pose->theta) - theta, 2 * M_PI);
+
+    error = error < 0 ? error + 2 * M_PI : error;
+    return error > M_PI ? 2 * M_PI - error : error;
+}
+
+/**
+ * @brief Check a pose against the end of a known path and print the error.
+ *
+ * @param name Name of the path.
+ * @param pose The pose.
+ * @param x Expected distance along the starting heading in cm.
+ * @param y Expected distance to the left of the starting heading in cm.
+ * @param theta Expected heading in radians.
+ */
+void check_geometry(const char *name, const odometry_pose_t *pose, double x, double y, double theta)
+{
+    double position_error = hypot(q16_to_float(pose->x) - x, q16_to_float(pose->y) - y);
+    double heading_error = get_pose_heading_error(pose, theta);
+
+    printf("%-40s position error %.4f cm, heading error %.5f rad\n", name, position_error, heading_error);
+    CHECK(position_error <= GEOMETRY_POSITION_TOLERANCE * q16_to_float(pose->distance) + 0.01);
+    CHECK(heading_error <= GEOMETRY_HEADING_TOLERANCE_RAD);
+}
+
+/**
+ * @brief Feed the wheel distances of an arc into a pose.
+ *
+ * @param pose The pose.
+ * @param radius Radius of the path of the centre in cm.
+ * @param angle Angle of the arc in radians, positive anticlockwise.
+ * @param step Distance of the centre per update in cm.
+ */
+void drive_geometry_arc(odometry_pose_t *pose, double radius, double angle, double step)
+{
+    double length = radius * fabs(angle);
+    double side = (angle > 0 ? 1 : -1) * ENCODER_WHEEL_BASE_CM / 2 / radius;
+
+    for (double done = 0; done < length; done += step)
+    {
+        double distance = fmin(step, length - done);
+        integrate_odometry(pose, q16_from_float(distance * (1 - side)), q16_from_float(distance * (1 + side)));
+    }
+}
+
+/**
+ * @brief Feed the wheel distances of a pivot into a pose.
+ *
+ * @param pose The pose.
+ * @param angle Angle of the pivot in radians, positive anticlockwise.
+ */
+void drive_geometry_pivot(odometry_pose_t *pose, double angle)
+{
+    double wheel = ENCODER_WHEEL_BASE_CM / 2 * angle;
+
+    // A control period of wheel travel at a time
+    for (int i = 0; i < 20; i++)
+    {
+        integrate_odometry(pose, q16_from_float(-wheel / 20), q16_from_float(wheel / 20));
+    }
+}
+
+/**
+ * @brief Feed the wheel distances of a straight into a pose.
+ *
+ * @param pose The pose.
+ * @param distance Distance in cm, negative backward.
+ * @param step Distance per update in cm.
+ */
+void drive_geometry_straight(odometry_pose_t *pose, double distance, double step)
+{
+    for (double done = 0; done < fabs(distance); done += step)
+    {
+        double part = copysign(fmin(step, fabs(distance) - done), distance);
+        integrate_odometry(pose, q16_from_float(part), q16_from_float(part));
+    }
+}
+
+/**
+ * @brief Check the integration against the geometry of arcs and squares.
+ */
+void test_geometry()
+{
+    static const double radii[] = {20, 50, 100};
+    static const double steps[] = {0.34, 2.0};
+    char name[64];
+
+    for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++)
+    {
+        for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++)
+        {
+            // A quarter turn either way ends a radius along and a radius to the side
+            odometry_pose_t pose = {0};
+            drive_geometry_arc(&pose, radii[r], M_PI / 2, steps[s]);
+            snprintf(name, sizeof(name), "quarter arc left r %.0f step %.2f", radii[r], steps[s]);
+            check_geometry(name, &pose, radii[r], radii[r], M_PI / 2);
+
+            pose = (odometry_pose_t){0};
+            drive_geometry_arc(&pose, radii[r], -M_PI / 2, steps[s]);
+            snprintf(name, sizeof(name), "quarter arc right r %.0f step %.2f", radii[r], steps[s]);
+            check_geometry(name, &pose, radii[r], -radii[r], -M_PI / 2);
+
+            // A whole circle ends where it started
+            pose = (odometry_pose_t){0};
+            drive_geometry_arc(&pose, radii[r], 2 * M_PI, steps[s]);
+            snprintf(name, sizeof(name), "circle left r %.0f step %.2f", radii[r], steps[s]);
+            check_geometry(name, &pose, 0, 0, 0);
+        }
+    }
+
+    // A tenth of a turn in every update
+    odometry_pose_t pose = {0};
+    drive_geometry_arc(&pose, 30, 2 * M_PI, 30 * 2 * M_PI / 10);
+    check_geometry("circle left r 30 in 10 updates", &pose, 0, 0, 0);
+
+    // Squares of straights and pivots, both ways round, and one driven backward
+    pose = (odometry_pose_t){0};
+    for (int i = 0; i < 4; i++)
+    {
+        drive_geometry_straight(&pose, 100, 0.34);
+        drive_geometry_pivot(&pose, M_PI / 2);
+    }
+    check_geometry("square left 100 cm", &pose, 0, 0, 0);
+
+    pose = (odometry_pose_t){0};
+    drive_geometry_straight(&pose, 100, 0.34);
+    drive_geometry_pivot(&pose, -M_PI / 2);
+    check_geometry("square right, first corner", &pose, 100, 0, -M_PI / 2);
+    for (int i = 0; i < 3; i++)
+    {
+        drive_geometry_straight(&pose, 100, 0.34);
+        drive_geometry_pivot(&pose, -M_PI / 2);
+    }
+    check_geometry("square right 100 cm", &pose, 0, 0, 0);
+
+    pose = (odometry_pose_t){0};
+    for (int i = 0; i < 4; i++)
+    {
+        drive_geometry_straight(&pose, -50, 0.34);
+        drive_geometry_pivot(&pose, M_PI / 2);
+    }
+    check_geometry("square backward 50 cm", &pose, 0, 0, 0);
+    CHECK(fabs(q16_to_float(pose.distance) - 200) < 0.05);
+}
+
+/**
+ * @brief Update the odometry and compare it with the true pose.
+ */
+void compare_odometry()
+{
+    odometry_pose_t pose;
+
+    update_odometry(NULL);
+    get_odometry_pose(&pose);
+    drive_position_error_max = fmax(drive_position_error_max, hypot(q16_to_float(pose.x) - robot_x, q16_to_float(pose.y) - robot_y));
+    drive_heading_error_max = fmax(drive_heading_error_max, get_pose_heading_error(&pose, robot_theta));
+}
+
+/**
+ * @brief Run the control tick of main.c and the odometry timer.
+ *
+ * @return false once every queued movement has ended and the robot has stopped.
+ */
+bool drive_control_step()
+{
+    uint32_t now = time_us_32();
+
+    update_encoder_speeds(now);
+    pid_control();
+    update_motion_queue(time_us_32());
+    compare_odometry();
+
+    return motion_active || motion_queue_head != motion_queue_tail || !is_robot_still();
+}
+
+/**
+ * @brief Drive a case through the motion queue and print the odometry errors.
+ *
+ * @param drive_case The case.
+ */
+void run_drive_case(const drive_case_t *drive_case)
+{
+    start_robot_sim(drive_case->left_gain, drive_case->right_gain);
+    stop_motors();
+    clear_motion_queue();
+    odometry_left_displacement = left_encoder_displacement;
+    odometry_right_displacement = right_encoder_displacement;
+    reset_odometry(0, 0, 0);
+    drive_position_error_max = 0;
+    drive_heading_error_max = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (drive_case->square)
+        {
+            queue_distance(SPEED, DRIVE_SIDE_CM);
+            queue_angle(SPEED, drive_case->angle);
+        }
+        else
+        {
+            queue_arc(SPEED, DRIVE_RADIUS_CM, drive_case->angle);
+        }
+    }
+
+    uint64_t start_time = shim_time_us;
+    run_robot_sim(DRIVE_TIMEOUT_US, drive_control_step);
+    compare_odometry();
+
+    odometry_pose_t pose;
+    get_odometry_pose(&pose);
+    double position_error = hypot(q16_to_float(pose.x) - robot_x, q16_to_float(pose.y) - robot_y);
+    double heading_error = get_pose_heading_error(&pose, robot_theta);
+
+    printf("%-26s %4.1f s: true (%6.1f, %6.1f) cm %6.1f deg, odometry (%6.1f, %6.1f) cm %6.1f deg, "
+           "error %.2f cm %.1f deg, largest %.2f cm %.1f deg\n",
+           drive_case->name, (shim_time_us - start_time) / 1e6, robot_x, robot_y, robot_theta * 180 / M_PI,
+           q16_to_float(pose.x), q16_to_float(pose.y), q16_to_float(q16_to_degrees(pose.theta)),
+           position_error, heading_error * 180 / M_PI, drive_position_error_max, drive_heading_error_max * 180 / M_PI);
+
+    CHECK(is_robot_still());
+    CHECK(motion_queue_head == motion_queue_tail && !motion_active);
+    CHECK(drive_position_error_max <= DRIVE_POSITION_TOLERANCE_CM);
+    CHECK(drive_heading_error_max * 180 / M_PI <= DRIVE_HEADING_TOLERANCE_DEG);
+}
+
+/**
+ * @brief Check the measured wheel base against the turn calibration of a pivot.
+ */
+void test_turn_calibration()
+{
+    printf("Wheel base %.1f cm: pivot %.2f deg/tick by geometry, %.2f deg/tick calibrated, turn ratio %.2f\n",
+           ENCODER_WHEEL_BASE_CM, ENCODER_PIVOT_GEOMETRY_DEGREES_PER_TICK, ENCODER_DEGREES_PER_TICK, ENCODER_PIVOT_TURN_RATIO);
+
+    CHECK(ENCODER_PIVOT_TURN_RATIO >= ENCODER_PIVOT_TURN_RATIO_MIN);
+    CHECK(ENCODER_PIVOT_TURN_RATIO <= 1);
+}
+
+int main()
+{
+    test_turn_calibration();
+    test_geometry();
+
+    for (size_t i = 0; i < sizeof(drive_cases) / sizeof(drive_cases[0]); i++)
+    {
+        run_drive_case(&drive_cases[i]);
+    }
+
+    return finish_tests("test_odometry");
+}
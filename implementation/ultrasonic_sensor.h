@@ -12,6 +12,7 @@
 #include "pico/stdlib.h"    // Include the Pico standard library
 #include "hardware/gpio.h"  // Include the GPIO hardware library
 #include "hardware/timer.h" // Include the timer hardware library
+#include "gpio_dispatch.h"  // Include the per-pin GPIO interrupt dispatch
 
 // Define the GPIO pin for ultrasonic
 #define TRIGGER_PIN 0       // Define the GPIO pin for the ultrasonic sensor trigger
@@ -28,9 +29,8 @@ uint32_t end_pulse_time = 0;   // Variable to store the end time of the echo pul
 bool pulse_received = false;   // Flag to indicate if an echo pulse has been received
 
 // Function prototypes
-void interrupt_handler(uint gpio, uint32_t events);
 bool check_pulse_duration(uint32_t start_time, uint32_t end_time);
-void on_echo_pin_change(uint gpio, uint32_t events);
+void on_echo_pin_change(uint pin, uint32_t edge, uint32_t timestamp);
 uint32_t get_pulse_duration();
 void initialise_ultrasonic();
 float measure_distance(float pulse_duration);
@@ -61,20 +61,21 @@ bool check_pulse_duration(uint32_t start_time, uint32_t end_time)
 /**
  * @brief Callback function for handling changes on the ECHO pin.
  *
- * @param gpio The GPIO pin number.
- * @param events The type of events that triggered the callback.
+ * @param pin The GPIO pin number.
+ * @param edge Mask of the edges seen on the pin.
+ * @param timestamp Time of the edge from time_us_32().
  */
-void on_echo_pin_change(uint gpio, uint32_t events)
+void on_echo_pin_change(uint pin, uint32_t edge, uint32_t timestamp)
 {
-    if (gpio_get(ECHO_PIN))
+    if (gpio_edge_level(pin, edge))
     {
         // Record the start time of the echo pulse
-        start_pulse_time = time_us_32(); 
+        start_pulse_time = timestamp; 
     }
     else
     {
         // Record the end time of the echo pulse
-        end_pulse_time = time_us_32();
+        end_pulse_time = timestamp;
         // Set the flag to indicate that the echo pulse has been received                                      
         pulse_received = check_pulse_duration(start_pulse_time, end_pulse_time); 
     }
@@ -89,7 +90,7 @@ void initialise_ultrasonic()
     gpio_init(ECHO_PIN);                 // Initialize the echo pin
     gpio_set_dir(TRIGGER_PIN, GPIO_OUT); // Set trigger pin as output
     gpio_set_dir(ECHO_PIN, GPIO_IN);     // Set echo pin as input
-    gpio_set_irq_enabled_with_callback(ECHO_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &interrupt_handler);
+    register_gpio_handler(ECHO_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, on_echo_pin_change);
     // Enable interrupt on both rising and falling edges of the echo pulse
 }
 
@@ -4,12 +4,14 @@
 #include "pico/cyw43_arch.h"
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
+#include "hardware/sync.h"
 
 #define TCP_PORT 4242
 #define DEBUG_printf printf
 #define BUF_SIZE 2048
-
-void motor_control(char *recv_buffer);
+// Number of received commands that can wait for the main loop, must be a power of 2
+#define COMMAND_QUEUE_SIZE 16
+#define COMMAND_QUEUE_MASK (COMMAND_QUEUE_SIZE - 1)
 
 typedef struct TCP_SERVER_T_
 {
@@ -19,6 +21,61 @@ typedef struct TCP_SERVER_T_
     uint16_t recv_len; // Add recv_len member
 } TCP_SERVER_T;
 
+// State of the TCP server, NULL until start_wifi() has started it
+TCP_SERVER_T *tcp_server_state = NULL;
+
+// Single producer (lwIP receive callback) / single consumer (main loop) ring buffer of received commands
+char command_queue[COMMAND_QUEUE_SIZE];
+volatile uint32_t command_queue_head = 0;       // Number of commands received, only changed by the receive callback
+volatile uint32_t command_queue_tail = 0;       // Number of commands taken out, only changed by the main loop
+volatile uint32_t command_queue_overruns = 0;   // Number of commands dropped because the queue was full
+
+/*
+Queue a command received from the TCP client for the main loop
+The receive callback runs in the lwIP background context, so it must not drive the motors itself
+Returns false if the queue was full
+*/
+bool push_command(char command)
+{
+    uint32_t head = command_queue_head;
+
+    // Drop the command if the main loop has not caught up yet
+    if (head - command_queue_tail >= COMMAND_QUEUE_SIZE)
+    {
+        command_queue_overruns++;
+        return false;
+    }
+
+    // Store the command, then publish it by advancing the head
+    command_queue[head & COMMAND_QUEUE_MASK] = command;
+    __dmb();
+    command_queue_head = head + 1;
+
+    return true;
+}
+
+/*
+Take the oldest received command out of the queue, only called from the main loop
+Returns false if no command is waiting
+*/
+bool pop_command(char *command)
+{
+    uint32_t tail = command_queue_tail;
+
+    if (tail == command_queue_head)
+    {
+        return false;
+    }
+
+    // Copy the command, then release the slot by advancing the tail
+    __dmb();
+    *command = command_queue[tail & COMMAND_QUEUE_MASK];
+    __dmb();
+    command_queue_tail = tail + 1;
+
+    return true;
+}
+
 // Close the TCP server connection
 static err_t tcp_server_close(void *arg)
 {
@@ -55,25 +112,28 @@ err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err
                                              p->tot_len > buffer_left ? buffer_left : p->tot_len, 0);
         tcp_recved(tpcb, p->tot_len);
 
-        char buffer[1];
-        // Print the received buffer as it arrives
+        char command = '\0';
+        // Take the last character received as the command
         for (int i = 0; i < state->recv_len; i++)
         {
             if (state->buffer_recv[i] != '\n')
             {
-                buffer[0] = state->buffer_recv[i];
+                command = state->buffer_recv[i];
             }
         }
         DEBUG_printf("\n");
 
         // Send an acknowledge message to the client
-        const char* ack_msg = strVal;
+        const char* ack_msg = "Message received!";
         tcp_write(tpcb, ack_msg, strlen(ack_msg), 1);
         // Clear the buffer
         memset(state->buffer_recv, 0, BUF_SIZE);
 
-        // Call motor function
-        motor_control(buffer);
+        // Pass the command on to the main loop, which drives the motors
+        if (command != '\0')
+        {
+            push_command(command);
+        }
 
     }
     pbuf_free(p);
@@ -182,6 +242,35 @@ static TCP_SERVER_T *create_tcp_server(void)
     return state;
 }
 
+/*
+Send an event to the connected TCP client, the event must be a complete line
+Returns false if no client is connected or the event could not be queued
+*/
+bool send_tcp_event(const char *event)
+{
+    if (tcp_server_state == NULL || tcp_server_state->client_pcb == NULL)
+    {
+        return false;
+    }
+
+    // lwIP runs in the background, so lock it while queueing the event
+    cyw43_arch_lwip_begin();
+    err_t err = tcp_write(tcp_server_state->client_pcb, event, strlen(event), TCP_WRITE_FLAG_COPY);
+    if (err == ERR_OK)
+    {
+        err = tcp_output(tcp_server_state->client_pcb);
+    }
+    cyw43_arch_lwip_end();
+
+    if (err != ERR_OK)
+    {
+        DEBUG_printf("failed to send event %d\n", err);
+        return false;
+    }
+
+    return true;
+}
+
 /*
 Initialize the Wi-Fi driver
 */
@@ -205,7 +294,10 @@ int wifi_init()
     return 0;
 }
 
-int wifi_main()
+/*
+Connect to the Wi-Fi network and start the TCP server, called once from main()
+*/
+int start_wifi()
 {
 
     // Initialize the Wi-Fi driver
@@ -222,6 +314,7 @@ int wifi_main()
         cyw43_arch_deinit();
         return 1;
     }
+    tcp_server_state = state;
 
     return 0;
 }
\ No newline at end of file